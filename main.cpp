@@ -8,10 +8,52 @@
 #include <chrono>
 #include <thread>
 #include <set>
-#include <list>
 #include <map>
+#include <list>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
 #include <typeinfo>
 #include <fstream>
+#include <deque>
+#include <memory>
+#include <array>
+#include <unordered_set>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <future>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef _WIN32
+// windows.h would otherwise define min and max macros
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 using cv::Mat;
 using cv::samples::findFile;
@@ -49,1508 +91,7025 @@ void initOpenCV() {
     set_dummy_error_handler();
 }
 
-class Interface {
-public:
-    virtual void applyAll() = 0;
-    virtual void write() const = 0;
-    virtual istream &read(istream &in) = 0;
-    virtual ostream &print(ostream &out) const = 0;
-    virtual void serialize(string) const = 0;
-    virtual void deserialize(std::ifstream&) = 0;
-};
-
-class Image : public Interface {
-protected:
-    // boolean for image finding
-    bool absolute;
-    string name, path;
-    Mat img;
-public:
-    Image(string name = "cat.png", string path = "../Images/", bool absolute = false);
-    Image(const Image &obj);
-    Image &operator=(const Image &obj);
-    // virtual to call derivative destructors
-    virtual ~Image();
+// 64 bit hash of a byte range, reads 8 bytes at a time so it runs close to memory speed
+uint64_t hashBytes(const uchar *data, size_t size, uint64_t seed = 1469598103934665603ULL) {
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t hash = seed ^ (size * prime);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) hash = (hash ^ data[i]) * prime;
+    return hash ^ (hash >> 32);
+}
 
-    istream &read(istream &in);
-    ostream &print(ostream &out) const;
-    friend istream &operator>>(istream &in, Image &obj);
-    friend ostream &operator<<(ostream &out, const Image &obj);
+// hash of the pixels of a Mat, row by row so submatrices work too
+uint64_t hashMat(const Mat &mat, uint64_t seed = 1469598103934665603ULL) {
+    uint64_t hash = seed ^ ((uint64_t) mat.rows << 32 | (uint64_t) mat.cols) ^ ((uint64_t) mat.type() << 56);
+    size_t rowBytes = mat.cols * mat.elemSize();
+    for (int i = 0; i < mat.rows; i++) hash = hashBytes(mat.ptr(i), rowBytes, hash);
+    return hash;
+}
 
-    string extension(string word) const;
-    string withoutExtension(string word) const;
-    void scan();
-    void show() const;
-    void show(const Mat &img) const;
-    void write() const;
-    void saveShow() const;
-    void applyAll();
-    string getName() const;
-    string getPath() const;
+// the step opencv fills in itself, the c headers that define it aren't always included
+#ifndef CV_AUTOSTEP
+#define CV_AUTOSTEP 0x7fffffff
+#endif
 
-    bool operator<(const Image& obj) const {
-        return !(this->name > obj.name);
-    }
-    bool operator==(const Image& obj) const {
-        return this->name == obj.name;
-    }
-    virtual void serialize(string) const;
-    virtual void deserialize(std::ifstream&);
+// size class pool behind the pixel buffers of cv::Mat; a video asks for the same few sizes on every frame,
+// so after the first frames create() takes a block from a free list instead of going to malloc and
+// faulting in fresh pages. a block goes back to its class when the last Mat holding it lets go
+class PixelPool : public cv::MatAllocator {
+private:
+    static PixelPool *singleton;
+    static const size_t minBlock = 4096;
+    static const size_t hugePage = 2 * 1024 * 1024;
+    // 4 classes per power of two, so a block is at most 25% bigger than asked for
+    static const int classes = 1 + 4 * (64 - 12);
+
+    mutable std::mutex mutex;
+    mutable std::vector<std::vector<uchar *>> blocks; // free blocks of every class
+    mutable size_t pooled; // bytes in the free lists
+    mutable std::atomic<uint64_t> hits, misses;
+    mutable std::atomic<size_t> inUse;
+
+    PixelPool() : blocks(classes), pooled(0), hits(0), misses(0), inUse(0) {}
+    // class of a buffer of size bytes, block gets the size of the blocks of that class
+    static int classOf(size_t size, size_t &block);
+    static uchar *reserve(size_t block);
+    static void release(uchar *data);
+public:
+    static size_t limit; // bytes kept in the free lists, 0 leaves opencv's allocator in place
+    static bool hugePages; // blocks of 2MB and up are backed by transparent huge pages
+    PixelPool(const PixelPool &) = delete;
+    static PixelPool *getInstance();
+    // every Mat created from now on gets its pixels from the pool
+    static void install();
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+    // gives the free blocks back to the system
+    void trim();
+    void report(ostream &out) const;
 };
 
-void Image::serialize(string fileName) const {
-    std::ofstream out(fileName, std::ios_base::app);
-
-    out<<name<<" "<<path<<" "<<absolute<<" ";
+PixelPool *PixelPool::singleton = NULL;
+size_t PixelPool::limit = 512ull * 1024 * 1024;
+bool PixelPool::hugePages = false;
 
-    out.close();
+PixelPool *PixelPool::getInstance() {
+    if (!singleton) singleton = new PixelPool();
+    return singleton;
 }
 
-void Image::deserialize(std::ifstream& in) {
-    string name,path;
-    bool absolute;
-    in>>name>>path>>absolute;
-    this->name = name;
-    this->path = path;
-    this->absolute = absolute;
-
-    this->scan();
+void PixelPool::install() {
+    if (limit > 0) Mat::setDefaultAllocator(getInstance());
 }
 
-Image::Image(string name, string path, bool absolute) {
-    this->name = name;
-    this->path = path;
-    this->absolute = absolute;
+int PixelPool::classOf(size_t size, size_t &block) {
+    if (size <= minBlock) {
+        block = minBlock;
+        return 0;
+    }
+    size_t n = size - 1;
+    int e = 0;
+    while ((n >> e) > 1) e++;
+    // the two bits under the highest one pick the quarter
+    size_t top = n >> (e - 2);
+    block = (top + 1) << (e - 2);
+    return 1 + 4 * (e - 12) + (int) (top - 4);
 }
 
-Image::Image(const Image &obj) {
-    this->name = obj.name;
-    this->path = obj.path;
-    this->absolute = obj.absolute;
+uchar *PixelPool::reserve(size_t block) {
+    bool huge = hugePages && block >= hugePage;
+    void *data = NULL;
+#ifdef _WIN32
+    // large pages on windows need the lock pages privilege, so the blocks stay on normal pages
+    data = _aligned_malloc(block, 64);
+#else
+    if (posix_memalign(&data, huge ? hugePage : 64, block) != 0) data = NULL;
+#ifdef MADV_HUGEPAGE
+    if (data != NULL && huge) madvise(data, block, MADV_HUGEPAGE);
+#endif
+#endif
+    if (data == NULL) throw std::bad_alloc();
+    return (uchar *) data;
 }
 
-Image &Image::operator=(const Image &obj) {
-    if (this != &obj) {
-        if (!this->name.empty()) this->name.clear();
-        this->name = obj.name;
-        if (!this->path.empty()) this->path.clear();
-        this->path = obj.path;
-        this->absolute = obj.absolute;
-    }
-    return *this;
+void PixelPool::release(uchar *data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
 }
 
-istream &Image::read(istream &in) {
-    if (!this->name.empty()) this->name.clear();
-    if (!this->path.empty()) this->path.clear();
-    cout << "Enter name: \n";
-    in >> this->name;
-    cout << "Do you want to use relative path? (1:yes 0:no)?\n";
-    int temp;
-    cin >> temp;
-    in.get();
-    if (temp == 0) {
-        this->absolute = true;
-        cout << "Enter path to image: \n";
-        // to get \n from buffer
-
-        getline(in, this->path);
-        // deleting "" from path
-        if (this->path[0] == '"') this->path.erase(0, 1), this->path.pop_back();
-    } else this->path = "../Images/";
-
-    return in;
-}
+cv::UMatData *PixelPool::allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag,
+                                  cv::UMatUsageFlags) const {
+    // same layout as opencv's allocator: continuous rows, the steps are filled in from the last dimension
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            // Mat::create never passes data, a step given with it is kept unless it is left to us
+            if (data && step[i] != CV_AUTOSTEP) total = step[i];
+            else step[i] = total;
+        }
+        total *= sizes[i];
+    }
 
-ostream &Image::print(ostream &out) const {
-    out << "Name: " << this->name << endl;
-    if (this->absolute == false) out << "Path to image: " << this->path + this->name << endl;
-    else out << "Path to image: " << this->path << endl;
+    cv::UMatData *u = new cv::UMatData(this);
+    u->size = total;
+    if (data) {
+        u->data = u->origdata = (uchar *) data;
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
 
-    return out;
+    size_t block;
+    int index = classOf(total, block);
+    uchar *pixels = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!blocks[index].empty()) {
+            pixels = blocks[index].back();
+            blocks[index].pop_back();
+            pooled -= block;
+        }
+    }
+    if (pixels != NULL) hits++;
+    else {
+        misses++;
+        pixels = reserve(block);
+    }
+    inUse += block;
+    u->data = u->origdata = pixels;
+    return u;
 }
 
-istream &operator>>(istream &in, Image &obj) {
-    return obj.read(in);
+bool PixelPool::allocate(cv::UMatData *data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != NULL;
 }
 
-ostream &operator<<(ostream &out, const Image &obj) {
-    return obj.print(out);
+void PixelPool::deallocate(cv::UMatData *u) const {
+    if (u == NULL) return;
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED) && u->origdata != NULL) {
+        size_t block;
+        int index = classOf(u->size, block);
+        inUse -= block;
+        bool kept = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pooled + block <= limit) {
+                blocks[index].push_back(u->origdata);
+                pooled += block;
+                kept = true;
+            }
+        }
+        if (!kept) release(u->origdata);
+        u->origdata = NULL;
+    }
+    delete u;
 }
 
-Image::~Image() {
-    if (!this->name.empty()) this->name.clear();
-    if (!this->path.empty()) this->path.clear();
-    this->absolute = false;
+void PixelPool::trim() {
+    std::vector<uchar *> freed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &list: blocks) {
+            freed.insert(freed.end(), list.begin(), list.end());
+            list.clear();
+        }
+        pooled = 0;
+    }
+    for (uchar *data: freed) release(data);
 }
 
-string Image::extension(string word) const {
-    return word.substr(word.find('.'), word.length());
+void PixelPool::report(ostream &out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t requests = hits + misses;
+    out << "Pixel pool: " << inUse / (1024 * 1024) << " MB in use, " << pooled / (1024 * 1024) << " MB free"
+        << (limit > 0 ? "" : " (off)") << endl;
+    out << "Pool hits: " << hits << "/" << requests << " ("
+        << (requests == 0 ? 0 : (int) (100 * hits / requests)) << "%), misses: " << misses << endl;
 }
 
-string Image::withoutExtension(string word) const {
-    return word.substr(0, word.find('.'));
-}
+// operations shared by the image and the video paths
+// specialized at compile time on the channel count (bw turns 8UC3 into 8UC1)
+// and dispatched at runtime to the best instruction set of the cpu
+namespace kernels {
+    enum Isa { SCALAR, SSE4, AVX2, AVX512 };
+    const char *isaNames[] = {"scalar", "sse4", "avx2", "avx512"};
+
+    Isa detectIsa() {
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        bool sse4 = (info[2] >> 19) & 1;
+        // the os has to save the wider registers on context switches
+        bool osxsave = (info[2] >> 27) & 1;
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        bool avx2 = false, avx512 = false;
+        if (maxLeaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = ((info[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+            avx512 = ((info[1] >> 16) & 1) && ((info[1] >> 30) & 1) && (xcr0 & 0xe6) == 0xe6;
+        }
+        if (avx512) return AVX512;
+        if (avx2) return AVX2;
+        if (sse4) return SSE4;
+#elif defined(KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return AVX512;
+        if (__builtin_cpu_supports("avx2")) return AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return SSE4;
+#endif
+        return SCALAR;
+    }
 
-void Image::scan() {
-    string image_path;
-    try {
-        if (this->absolute == false) {
-            string full_name = this->path + this->name;
-            // silent mode true to suppress errors
-            image_path = findFile(full_name, true, true);
-        } else image_path = findFile(this->path, true, true);
+    Isa limit = AVX512; // set lower to force older code paths
 
-        Mat temp = imread(image_path, IMREAD_COLOR);
-        img.create(temp.rows, temp.cols, temp.type());
-        cv::resize(img, img, temp.size());
-        temp.copyTo(img);
+    Isa isa() {
+        static const Isa detected = detectIsa();
+        return detected < limit ? detected : limit;
     }
-    catch (...) { cout << "~ INVALID PATH\n"; }
-    // CV_8UC3 = 8 bit unsigned integer with 3 channels (RGB)
-}
 
-void Image::show() const {
-    try {
-//        Mat img = this->scan();
-        cv::namedWindow("Image", cv::WINDOW_NORMAL);
-//        using this function makes the window not have a title bar
-//        cv::setWindowProperty("Image",cv::WND_PROP_FULLSCREEN, cv::WINDOW_FULLSCREEN);
-        double aspect_ratio = static_cast<double>(img.cols) / img.rows;
-        cv::resizeWindow("Image", static_cast<int>(540 * aspect_ratio), 540);
-        imshow("Image", img);
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_TARGET(features) __attribute__((target(features)))
+#else
+// msvc compiles intrinsics of every instruction set without flags
+#define KERNEL_TARGET(features)
+#endif
+
+    // adds hue to the H bytes of count interleaved HSV pixels, wrapping at 180 like (h + hue) % 180
+    // h + hue wraps exactly when h >= 180 - hue, so the byte arithmetic never needs wider lanes
+    void hueScalar(uchar *data, size_t count, int hue) {
+        for (size_t i = 0; i < count; i++) data[3 * i] = (uchar) ((data[3 * i] + hue) % 180);
+    }
 
-//        Wait for a keystroke in the window
-        int k = waitKey(0);
-//        27 is ascii code for esc and waitKey returns an int
-        if (k == 27) {
-            cv::destroyAllWindows();
-            return;
+#ifdef KERNELS_X86
+    // every third byte is a hue, so a block of 3 vectors always starts on a hue byte;
+    // lanes of S and V get add = 0, threshold = 255 and wrap = 0 so they are left unchanged
+    template<int W>
+    struct HuePattern {
+        alignas(64) uchar add[3 * W], threshold[3 * W], wrap[3 * W];
+
+        explicit HuePattern(int hue) {
+            for (int i = 0; i < 3 * W; i++) {
+                bool isHue = i % 3 == 0;
+                add[i] = isHue ? (uchar) hue : 0;
+                threshold[i] = isHue ? (uchar) (180 - hue) : 255;
+                wrap[i] = isHue ? 180 : 0;
+            }
         }
+    };
+
+    KERNEL_TARGET("sse4.1")
+    void hueSse4(uchar *data, size_t count, int hue) {
+        HuePattern<16> pattern(hue);
+        size_t bytes = 3 * count, i = 0;
+        for (; i + 48 <= bytes; i += 48)
+            for (int k = 0; k < 3; k++) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (data + i + 16 * k));
+                __m128i threshold = _mm_load_si128((const __m128i *) (pattern.threshold + 16 * k));
+                __m128i wraps = _mm_cmpeq_epi8(_mm_max_epu8(v, threshold), v);
+                v = _mm_add_epi8(v, _mm_load_si128((const __m128i *) (pattern.add + 16 * k)));
+                v = _mm_sub_epi8(v, _mm_and_si128(wraps, _mm_load_si128((const __m128i *) (pattern.wrap + 16 * k))));
+                _mm_storeu_si128((__m128i *) (data + i + 16 * k), v);
+            }
+        hueScalar(data + i, count - i / 3, hue);
     }
-    catch (...) { cout << "~ OUTPUT FAILED\n"; }
-}
 
-void Image::show(const Mat &img) const {
-    try {
-        cv::namedWindow("Image", cv::WINDOW_NORMAL);
-//        using this function makes the window not have a title bar
-//        cv::setWindowProperty("Image",cv::WND_PROP_FULLSCREEN, cv::WINDOW_FULLSCREEN);
-        double aspect_ratio = static_cast<double>(img.cols) / img.rows;
-        cv::resizeWindow("Image", static_cast<int>(540 * aspect_ratio), 540);
-        imshow("Image", img);
+    KERNEL_TARGET("avx2")
+    void hueAvx2(uchar *data, size_t count, int hue) {
+        HuePattern<32> pattern(hue);
+        size_t bytes = 3 * count, i = 0;
+        for (; i + 96 <= bytes; i += 96)
+            for (int k = 0; k < 3; k++) {
+                __m256i v = _mm256_loadu_si256((const __m256i *) (data + i + 32 * k));
+                __m256i threshold = _mm256_load_si256((const __m256i *) (pattern.threshold + 32 * k));
+                __m256i wraps = _mm256_cmpeq_epi8(_mm256_max_epu8(v, threshold), v);
+                v = _mm256_add_epi8(v, _mm256_load_si256((const __m256i *) (pattern.add + 32 * k)));
+                v = _mm256_sub_epi8(v, _mm256_and_si256(
+                        wraps, _mm256_load_si256((const __m256i *) (pattern.wrap + 32 * k))));
+                _mm256_storeu_si256((__m256i *) (data + i + 32 * k), v);
+            }
+        hueScalar(data + i, count - i / 3, hue);
+    }
 
-//        Wait for a keystroke in the window
-        int k = waitKey(0);
-//        27 is ascii code for esc and waitKey returns an int
-        if (k == 27) {
-            cv::destroyAllWindows();
-            return;
+    KERNEL_TARGET("avx512f,avx512bw")
+    void hueAvx512(uchar *data, size_t count, int hue) {
+        HuePattern<64> pattern(hue);
+        size_t bytes = 3 * count, i = 0;
+        for (; i + 192 <= bytes; i += 192)
+            for (int k = 0; k < 3; k++) {
+                __m512i v = _mm512_loadu_si512((const void *) (data + i + 64 * k));
+                __mmask64 wraps = _mm512_cmpge_epu8_mask(v, _mm512_load_si512((const void *) (pattern.threshold + 64 * k)));
+                v = _mm512_add_epi8(v, _mm512_load_si512((const void *) (pattern.add + 64 * k)));
+                v = _mm512_mask_sub_epi8(v, wraps, v, _mm512_load_si512((const void *) (pattern.wrap + 64 * k)));
+                _mm512_storeu_si512((void *) (data + i + 64 * k), v);
+            }
+        hueScalar(data + i, count - i / 3, hue);
+    }
+#endif
+
+    void shiftHue(uchar *data, size_t count, int hue) {
+#ifdef KERNELS_X86
+        switch (isa()) {
+            case AVX512: return hueAvx512(data, count, hue);
+            case AVX2: return hueAvx2(data, count, hue);
+            case SSE4: return hueSse4(data, count, hue);
+            default: break;
         }
+#endif
+        hueScalar(data, count, hue);
     }
-    catch (...) { cout << "~ OUTPUT FAILED\n"; }
-}
 
-void Image::write() const {
-    try {
-        // basically does nothing because there is nothing applied to that image
-//        Mat img = this->scan();
-        string full_path = this->path + this->name;
-        cv::imwrite(full_path, img);
+    // combines the bilateral filtered image with the outlines found in its gray version
+    void outline(Mat &img, const Mat &gray) {
+        // kept per thread, the next frame of the same size reuses the buffers
+        thread_local Mat blurred, tresh, edges;
+        // blur image to get a better mask for outlines
+        cv::medianBlur(gray, blurred, 7);
+        // create outline using a treshold
+        cv::adaptiveThreshold(blurred, tresh, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, 21, 7);
+        // blur initial image with a safer method
+        cv::bilateralFilter(img, edges, 21, 250, 250);
+        // combine initial blurred image with the outlines
+        cv::bitwise_and(edges, edges, img, tresh);
     }
-    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
-}
 
-void Image::saveShow() const {
-    cout << "Show image on screen (yes:1 no:0)?\n";
-    int temp;
-    cin >> temp;
-    cin.get();
-    if (temp == 1) this->show();
+    template<int CN>
+    struct Kernel;
 
-    cout << "Save image (yes:1 no:0)?\n";
-    cin >> temp;
-    cin.get();
-    if (temp == 1) this->write();
-}
+    template<>
+    struct Kernel<1> {
+        // gray frames have no hue
+        static void hue(Mat &, int) {}
 
-void Image::applyAll() {
-    cout << "~ NOTHING TO APPLY\n";
-}
+        static void cartoon(Mat &img) {
+            outline(img, img);
+        }
+    };
 
-string Image::getName() const {
-    return name;
-}
+    template<>
+    struct Kernel<3> {
+        static void hue(Mat &img, int hue) {
+            thread_local Mat hsv;
+            // changing color space to HSV (HUE, SATURATION, VALUE)
+            cv::cvtColor(img, hsv, cv::COLOR_BGR2HSV);
+            // cvtColor creates a continuous matrix, so all pixels are one row
+            shiftHue(hsv.ptr(), hsv.total(), hue);
+            // converting back to original color space
+            cv::cvtColor(hsv, img, cv::COLOR_HSV2BGR);
+        }
 
-string Image::getPath() const {
-    return path;
-}
+        static void cartoon(Mat &img) {
+            thread_local Mat gray;
+            cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+            outline(img, gray);
+        }
+    };
 
-class Effect : virtual public Image {
-protected:
-    int blurAmount;
-    bool effect, blackWhite, cartoon;
-public:
-    Effect(string name = "cat.png", string path = "../Images/", bool absolute = false, bool effect = false,
-           int blurAmount = 0, bool blackWhite = false, bool cartoon = false);
-    Effect(const Effect &obj);
-    Effect &operator=(const Effect &obj);
+    // cv::GaussianBlur doesnt work with widths and heigths that are even, or 0,0
+    // sigma 0 derives it from the size
+    void blur(Mat &img, int amount, double sigma = 0, int border = cv::BORDER_DEFAULT) {
+        if (amount % 2 == 0) amount += 1;
+        cv::GaussianBlur(img, img, cv::Size(amount, amount), sigma, 0, border);
+    }
 
-    // override specifier ensures that the function is virtual and is overriding a virtual function from a base class
-    virtual ~Effect() override;
-    istream &read(istream &in);
-    ostream &print(ostream &out) const;
+    void bw(Mat &img) {
+        if (img.channels() != 1) cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
+    }
 
-    void blur();
-    void bw();
-    void cartoon_effect();
-    void write() const;
-    void applyAll();
-    void setBlurAmount(int blurAmount);
-    void setBlackWhite(bool blackWhite);
-    void setCartoon(bool cartoon);
+    // the 256 possible results of saturate(x * alpha + beta)
+    Mat linearTable(double alpha, double beta) {
+        Mat table(1, 256, CV_8U);
+        for (int i = 0; i < 256; i++)
+            // float like convertTo, so the results match it
+            table.ptr()[i] = cv::saturate_cast<uchar>((float) i * (float) alpha + (float) beta);
+        return table;
+    }
 
-    void serialize(string) const;
-    void deserialize(std::ifstream&);
-};
+    void hue(Mat &img, int hue) {
+        if (img.channels() == 3) Kernel<3>::hue(img, hue);
+        else Kernel<1>::hue(img, hue);
+    }
 
-void Effect::serialize(string fileName) const {
-    this->Image::serialize(fileName);
-    std::ofstream out(fileName, std::ios_base::app);
+    void cartoon(Mat &img) {
+        if (img.channels() == 3) Kernel<3>::cartoon(img);
+        else Kernel<1>::cartoon(img);
+    }
 
-    out<<effect<<" "<<blurAmount<<" "<<blackWhite<<" "<<cartoon<<" ";
+    // working formats of a pipeline, frames still come in and go out as packed BGR;
+    // PADDED is BGRx, a pixel is one 32 bit lane, PLANAR is the B, G and R planes stacked in one Mat;
+    // in both every row starts on a cache line, so vector loops run on aligned loads without a 3 byte stride
+    enum Layout { PACKED, PADDED, PLANAR };
+    const char *layoutNames[] = {"packed", "padded", "planar"};
+
+    // rows of cols pixels padded to 64 bytes, the element size has to divide 64;
+    // both allocators hand out 64 byte aligned blocks, so the first row is aligned too
+    Mat alignedMat(int rows, int cols, int type) {
+        size_t elem = CV_ELEM_SIZE(type);
+        int stride = (int) (((cols * elem + 63) & ~(size_t) 63) / elem);
+        Mat buffer(rows, stride, type);
+        return buffer.colRange(0, cols);
+    }
 
-    out.close();
+    // converts a BGR frame to a working layout
+    void ingest(const Mat &frame, Mat &work, Layout layout) {
+        if (layout == PADDED) {
+            work = alignedMat(frame.rows, frame.cols, CV_8UC4);
+            cv::cvtColor(frame, work, cv::COLOR_BGR2BGRA);
+        } else if (layout == PLANAR) {
+            work = alignedMat(3 * frame.rows, frame.cols, CV_8UC1);
+            Mat planes[3];
+            for (int k = 0; k < 3; k++) planes[k] = work.rowRange(k * frame.rows, (k + 1) * frame.rows);
+            const int fromTo[] = {0, 0, 1, 1, 2, 2};
+            cv::mixChannels(&frame, 1, planes, 3, fromTo, 3);
+        } else work = frame;
+    }
+
+    // back to BGR, or to one channel when an op turned the frame gray
+    void egress(const Mat &work, Mat &frame, Layout layout) {
+        if (layout == PADDED && work.channels() == 4) cv::cvtColor(work, frame, cv::COLOR_BGRA2BGR);
+        else if (layout == PLANAR) {
+            int rows = work.rows / 3;
+            Mat planes[3];
+            for (int k = 0; k < 3; k++) planes[k] = work.rowRange(k * rows, (k + 1) * rows);
+            frame.create(rows, work.cols, CV_8UC3);
+            const int fromTo[] = {0, 0, 1, 1, 2, 2};
+            cv::mixChannels(planes, 3, &frame, 1, fromTo, 3);
+        } else work.copyTo(frame);
+    }
+
+    // planes of an I420 frame, one continuous Mat of height * 3 / 2 rows: the Y plane, then U and V at
+    // half the width and height; the views don't hold a reference, frame has to outlive them
+    struct I420 {
+        Mat y, u, v;
+
+        explicit I420(const Mat &frame) {
+            int rows = frame.rows * 2 / 3, cols = frame.cols;
+            uchar *data = const_cast<uchar *>(frame.ptr());
+            y = Mat(rows, cols, CV_8UC1, data);
+            u = Mat(rows / 2, cols / 2, CV_8UC1, data + rows * cols);
+            v = Mat(rows / 2, cols / 2, CV_8UC1, data + rows * cols + (rows / 2) * (cols / 2));
+        }
+
+        static Mat make(cv::Size size) { return Mat(size.height * 3 / 2, size.width, CV_8UC1); }
+    };
+
+    // turns the chroma of every pixel by hue * 2 degrees like the HSV path, red goes towards green
+    // and the saturation stays; the luma isn't touched, so it only matches HSV up to the gamut
+    void rotateChroma(Mat &u, Mat &v, int hue) {
+        double angle = hue * 2 * CV_PI / 180;
+        float c = (float) std::cos(angle), s = (float) std::sin(angle);
+        for (int i = 0; i < u.rows; i++) {
+            uchar *pu = u.ptr(i), *pv = v.ptr(i);
+            for (int j = 0; j < u.cols; j++) {
+                float x = pu[j] - 128.f, y = pv[j] - 128.f;
+                pu[j] = cv::saturate_cast<uchar>(x * c - y * s + 128.f);
+                pv[j] = cv::saturate_cast<uchar>(x * s + y * c + 128.f);
+            }
+        }
+    }
 }
 
-void Effect::deserialize(std::ifstream& in) {
-    this->Image::deserialize(in);
+// one operation of an edit pipeline, the planner reorders and merges them before they run
+struct Op {
+    enum Kind { LINEAR, HUE, BLUR, BW, CARTOON, CROP, RESIZE };
+    Kind kind;
+    string label; // what the user configured, for the plan dump
+    Mat table; // LINEAR: results of all 256 inputs, so composing two of them is exact
+    double alpha, beta; // LINEAR: x * alpha + beta before saturation
+    bool clips; // LINEAR: saturates somewhere in [0,255], so it isn't affine anymore
+    int size; // BLUR: odd kernel size
+    double sigma; // BLUR: 0 derives it from the size like cv::GaussianBlur
+    int hue; // HUE
+    cv::Rect rect; // CROP: in the coordinates of its input, clipped to it
+    int width; // RESIZE: output width, the height keeps the aspect ratio
+    // limits the op to a rectangle and to the nonzero pixels of an 8 bit mask, both in the coordinates
+    // of the full frame; empty ones don't limit anything
+    cv::Rect roi;
+    Mat mask;
+    static constexpr int tileSize = 256; // limited ops run on the tiles of their area the mask touches
+
+    static Op linear(double alpha, double beta, const string &label);
+    static Op blur(int size);
+    static Op hueShift(int hue);
+    static Op bw();
+    static Op cartoon();
+    static Op crop(const cv::Rect &rect);
+    static Op resize(int width);
+
+    // img is the part of the full frame that starts at origin, only limited ops care
+    void run(Mat &img, cv::Point origin = cv::Point()) const;
+    string describe() const;
+    bool geometric() const { return kind == CROP || kind == RESIZE; }
+    bool local() const { return roi.area() > 0 || !mask.empty(); }
+    // true when the op can change pixels of rect, in full frame coordinates
+    bool touches(const cv::Rect &rect) const;
+    // how far from an output pixel the input pixels it depends on can be
+    int radius() const;
+    // true when the op can run on a frame in that working layout without converting it back
+    bool supports(kernels::Layout layout) const;
+    // runs on a frame in a working layout, BW leaves a one channel frame
+    void applyIn(Mat &work, kernels::Layout layout) const;
+    // runs on an I420 frame: luma ops on the Y plane, chroma ops on the quarter size U and V planes
+    void applyYuv(Mat &frame) const;
+private:
+    void apply(Mat &img) const;
+    // the op on the tiles of its area, each from a copy with a halo, so the tiles don't read each other's output
+    void runLocal(Mat &img, cv::Point origin) const;
+};
 
-    bool effect,blackWhite,cartoon;
-    int blurAmount;
+Op Op::linear(double alpha, double beta, const string &label) {
+    Op op{LINEAR, label};
+    op.table = kernels::linearTable(alpha, beta);
+    op.alpha = alpha;
+    op.beta = beta;
+    op.clips = beta < 0 || 255 * alpha + beta > 255;
+    return op;
+}
 
-    in>>effect>>blurAmount>>blackWhite>>cartoon;
-    this->effect = effect;
-    this->blurAmount = blurAmount;
-    this->blackWhite = blackWhite;
-    this->cartoon = cartoon;
+Op Op::blur(int size) {
+    Op op{BLUR, "blur " + std::to_string(size)};
+    op.size = size % 2 == 0 ? size + 1 : size;
+    op.sigma = 0;
+    return op;
 }
 
-Effect::Effect(string name, string path, bool absolute, bool effect, int blurAmount, bool blackWhite, bool cartoon) :
-        Image(name, path, absolute) {
-    this->effect = effect;
-    this->blurAmount = blurAmount;
-    this->blackWhite = blackWhite;
-    this->cartoon = cartoon;
-    this->scan();
+Op Op::hueShift(int hue) {
+    Op op{HUE, "hue " + std::to_string(hue)};
+    op.hue = hue;
+    return op;
 }
 
-Effect::Effect(const Effect &obj) : Image(obj) {
-    this->effect = obj.effect;
-    this->blurAmount = obj.blurAmount;
-    this->blackWhite = obj.blackWhite;
-    this->cartoon = obj.cartoon;
-    this->scan();
+Op Op::bw() {
+    return Op{BW, "black and white"};
 }
 
-Effect &Effect::operator=(const Effect &obj) {
-    if (this != &obj) {
-        Image::operator=(obj);
-        this->effect = obj.effect;
-        this->blurAmount = obj.blurAmount;
-        this->blackWhite = obj.blackWhite;
-        this->cartoon = obj.cartoon;
-        this->scan();
-    }
-    return *this;
+Op Op::cartoon() {
+    return Op{CARTOON, "cartoon"};
 }
 
-istream &Effect::read(istream &in) {
-    this->Image::read(in);
-    cout << "Are there effects applied on the image? (yes:1 no:0) \n";
-    in >> this->effect;
-    cout << "Do you want to blur the image? (yes:1 no:0)?\n";
-    int temp;
-    in >> temp;
-    in.get();
-    if (temp == 1) {
-        cout << "Enter blur amount: \n";
-        in >> this->blurAmount;
-    }
-    cout << "Do you want to apply Black and White effect to the image? (yes:1 no:0)?\n";
-    in >> this->blackWhite;
-    cout << "Do you want to apply Cartoon effect to the image? (yes:1 no:0)?\n";
-    in >> this->cartoon;
-    this->scan();
+Op Op::crop(const cv::Rect &rect) {
+    Op op{CROP, "crop"};
+    op.rect = rect;
+    return op;
+}
 
-    return in;
+Op Op::resize(int width) {
+    Op op{RESIZE, "resize to " + std::to_string(width)};
+    op.width = width;
+    return op;
 }
 
-ostream &Effect::print(ostream &out) const {
-    this->Image::print(out);
-    if (this->effect == true) out << "Has effects applied\n";
-    else out << "Doesn't have effects applied\n";
-    out << "Blur amount: " << this->blurAmount << endl;
-    if (this->blackWhite == true) out << "Has Black and White effect applied\n";
-    else out << "Doesn't have Black and White effect applied\n";
-    if (this->cartoon) out << "Has Cartoon effect applied\n";
-    else out << "Doesn't have Cartoon effect applied\n";
+int Op::radius() const {
+    if (kind == BLUR) return size / 2;
+    // median blur of 7 feeding an adaptive threshold of 21, the bilateral filter reaches 10
+    if (kind == CARTOON) return 3 + 10;
+    return 0;
+}
 
-    return out;
+bool Op::supports(kernels::Layout layout) const {
+    // limited ops composite through masks made for packed frames, geometry is hoisted in front anyway
+    if (this->local() || this->geometric()) return false;
+    if (layout == kernels::PADDED) return kind != CARTOON;
+    if (layout == kernels::PLANAR) return kind == LINEAR || kind == BLUR;
+    return true;
 }
 
-Effect::~Effect() {
-    this->effect = false;
-    this->blurAmount = 0;
+void Op::applyIn(Mat &work, kernels::Layout layout) const {
+    if (layout == kernels::PACKED) return this->apply(work);
+    // the padding is outside the view, BORDER_ISOLATED keeps the filters from reading it
+    int border = cv::BORDER_DEFAULT | cv::BORDER_ISOLATED;
+    switch (kind) {
+        // one table for every channel, so one pass covers all the planes too
+        case LINEAR: cv::LUT(work, table, work); break;
+        case BLUR:
+            if (layout == kernels::PADDED) kernels::blur(work, size, sigma, border);
+            else {
+                int rows = work.rows / 3;
+                for (int k = 0; k < 3; k++) {
+                    Mat plane = work.rowRange(k * rows, (k + 1) * rows);
+                    kernels::blur(plane, size, sigma, border);
+                }
+            }
+            break;
+        case HUE: {
+            thread_local Mat hsv;
+            cv::cvtColor(work, hsv, cv::COLOR_BGR2HSV);
+            kernels::shiftHue(hsv.ptr(), hsv.total(), hue);
+            // written back into the padded rows, x is set to 255
+            cv::cvtColor(hsv, work, cv::COLOR_HSV2BGR, 4);
+            break;
+        }
+        case BW: {
+            Mat gray;
+            cv::cvtColor(work, gray, cv::COLOR_BGRA2GRAY);
+            work = gray;
+            break;
+        }
+        default: break;
+    }
 }
 
-void Effect::write() const {
-    try {
-        string full_path = "../Images with Effects/" + this->withoutExtension(this->name) + "_withEffects" +
-                           this->extension(this->name);
-        cv::imwrite(full_path, this->img);
+void Op::applyYuv(Mat &frame) const {
+    if (this->local() || kind == CARTOON) {
+        // no plane version of these, they run on a converted copy
+        Mat bgr;
+        cv::cvtColor(frame, bgr, cv::COLOR_YUV2BGR_I420);
+        this->run(bgr);
+        if (bgr.channels() == 1) cv::cvtColor(bgr, bgr, cv::COLOR_GRAY2BGR);
+        cv::cvtColor(bgr, frame, cv::COLOR_BGR2YUV_I420);
+        return;
+    }
+    kernels::I420 planes(frame);
+    switch (kind) {
+        // the colors keep their chroma
+        case LINEAR: cv::LUT(planes.y, table, planes.y); break;
+        // neutral chroma is gray, the frame stays 4:2:0 for the encoder
+        case BW: frame.rowRange(planes.y.rows, frame.rows).setTo(cv::Scalar::all(128)); break;
+        case BLUR:
+            kernels::blur(planes.y, size, sigma);
+            // half the resolution, half the kernel
+            kernels::blur(planes.u, size / 2, sigma / 2);
+            kernels::blur(planes.v, size / 2, sigma / 2);
+            break;
+        case HUE: kernels::rotateChroma(planes.u, planes.v, hue); break;
+        case CROP: {
+            cv::Rect inside = rect & cv::Rect(0, 0, planes.y.cols, planes.y.rows);
+            // 4:2:0 needs even edges
+            inside.x &= ~1, inside.y &= ~1, inside.width &= ~1, inside.height &= ~1;
+            if (inside.area() <= 0) break;
+            cv::Rect half(inside.x / 2, inside.y / 2, inside.width / 2, inside.height / 2);
+            Mat cropped = kernels::I420::make(inside.size());
+            kernels::I420 to(cropped);
+            planes.y(inside).copyTo(to.y);
+            planes.u(half).copyTo(to.u);
+            planes.v(half).copyTo(to.v);
+            frame = cropped;
+            break;
+        }
+        case RESIZE:
+            if (width > 0 && width != planes.y.cols) {
+                int even = std::max(2, width & ~1);
+                int height = std::max(2, cvRound(planes.y.rows * even / (double) planes.y.cols) & ~1);
+                int interpolation = even < planes.y.cols ? cv::INTER_AREA : cv::INTER_LINEAR;
+                Mat resized = kernels::I420::make(cv::Size(even, height));
+                kernels::I420 to(resized);
+                cv::resize(planes.y, to.y, to.y.size(), 0, 0, interpolation);
+                cv::resize(planes.u, to.u, to.u.size(), 0, 0, interpolation);
+                cv::resize(planes.v, to.v, to.v.size(), 0, 0, interpolation);
+                frame = resized;
+            }
+            break;
+        default: break;
     }
-    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
 }
 
-void Effect::blur() {
-    if (this->blurAmount > 0) {
-        try {
-            Mat blurredImage;
-            // cv::GaussianBlur doesnt work with widths and heigths that are even, or 0,0
-            if (this->blurAmount % 2 == 0) this->blurAmount += 1;
+void Op::run(Mat &img, cv::Point origin) const {
+    if (this->local()) this->runLocal(img, origin);
+    else this->apply(img);
+}
+
+bool Op::touches(const cv::Rect &rect) const {
+    cv::Rect area = roi.area() > 0 ? roi & rect : rect;
+    if (!mask.empty()) area &= cv::Rect(0, 0, mask.cols, mask.rows);
+    if (area.area() <= 0) return false;
+    return mask.empty() || cv::countNonZero(mask(area)) > 0;
+}
+
+void Op::runLocal(Mat &img, cv::Point origin) const {
+    // the area in the coordinates of img
+    cv::Rect frame(0, 0, img.cols, img.rows);
+    cv::Rect area = roi.area() > 0 ? cv::Rect(roi.x - origin.x, roi.y - origin.y, roi.width, roi.height) & frame : frame;
+    if (!mask.empty()) area &= cv::Rect(-origin.x, -origin.y, mask.cols, mask.rows);
+    if (area.area() <= 0) return;
+
+    std::vector<cv::Rect> tiles;
+    for (int y = area.y; y < area.y + area.height; y += tileSize)
+        for (int x = area.x; x < area.x + area.width; x += tileSize) {
+            cv::Rect tile = cv::Rect(x, y, tileSize, tileSize) & area;
+            if (mask.empty() || cv::countNonZero(mask(tile + origin)) > 0) tiles.push_back(tile);
+        }
 
-            cv::GaussianBlur(this->img, this->img, cv::Size(this->blurAmount, this->blurAmount), 0);
-//        blurredImage.copyTo(this->img);
-            this->effect = true;
+    int halo = this->radius();
+    std::vector<Mat> results(tiles.size());
+    cv::parallel_for_(cv::Range(0, (int) tiles.size()), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            const cv::Rect &tile = tiles[i];
+            cv::Rect input = cv::Rect(tile.x - halo, tile.y - halo, tile.width + 2 * halo, tile.height + 2 * halo) & frame;
+            Mat part = img(input).clone();
+            this->apply(part);
+            results[i] = part(tile - input.tl());
+            // black and white in a region keeps the channels of the rest of the frame
+            if (results[i].channels() != img.channels()) cv::cvtColor(results[i], results[i], cv::COLOR_GRAY2BGR);
         }
-        catch (...) { cout << "~ APPLYING EFFECT FAILED\n"; }
+    });
+    for (size_t i = 0; i < tiles.size(); i++) {
+        Mat target = img(tiles[i]);
+        if (mask.empty()) results[i].copyTo(target);
+        else results[i].copyTo(target, mask(tiles[i] + origin));
     }
 }
 
-void Effect::bw() {
-    if (this->blackWhite == true) {
-        try {
-            cv::cvtColor(img, img, cv::COLOR_BGR2GRAY);
-            this->effect = true;
+void Op::apply(Mat &img) const {
+    switch (kind) {
+        case LINEAR: cv::LUT(img, table, img); break;
+        case HUE: kernels::hue(img, hue); break;
+        case BLUR: kernels::blur(img, size, sigma); break;
+        case BW: kernels::bw(img); break;
+        case CARTOON: kernels::cartoon(img); break;
+        case CROP: {
+            cv::Rect inside = rect & cv::Rect(0, 0, img.cols, img.rows);
+            // cloned so the rest of the frame is freed and the crop is continuous
+            if (inside.area() > 0) img = img(inside).clone();
+            break;
         }
-        catch (...) { cout << "~ APPLYING EFFECT FAILED\n"; }
+        case RESIZE:
+            if (width > 0 && width != img.cols) {
+                int height = std::max(1, cvRound(img.rows * width / (double) img.cols));
+                // area averaging is the one that doesn't alias when shrinking
+                cv::resize(img, img, cv::Size(width, height), 0, 0, width < img.cols ? cv::INTER_AREA : cv::INTER_LINEAR);
+            }
+            break;
     }
 }
 
-void Effect::cartoon_effect() {
-    if (this->cartoon == true) {
-        try {
-            Mat gray, tresh, edges;
-            // to check if the image is already gray
-            if (img.channels() != 1) cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-            else img.copyTo(gray);
-
-            // blur image to get a better mask for outlines
-            cv::medianBlur(gray, gray, 7);
-            // create outline using a treshold
-            cv::adaptiveThreshold(gray, tresh, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, 21, 7);
+string Op::describe() const {
+    std::ostringstream out;
+    out.precision(4);
+    switch (kind) {
+        case LINEAR: out << label << " (x * " << alpha << " + " << beta << (clips ? ", saturates)" : ")"); break;
+        case BLUR:
+            out << label << " (" << size << "x" << size;
+            if (sigma > 0) out << ", sigma " << sigma;
+            out << ")";
+            break;
+        case CROP: out << label << " (" << rect.width << "x" << rect.height << " at " << rect.x << "," << rect.y << ")"; break;
+        default: out << label;
+    }
+    if (roi.area() > 0) out << " in " << roi.width << "x" << roi.height << " at " << roi.x << "," << roi.y;
+    if (!mask.empty()) out << " masked";
+    return out.str();
+}
 
-            // blur initial image with a safer method
-            cv::bilateralFilter(img, edges, 21, 250, 250);
+// operations in the order they will run, with the reasons they differ from the configured ones
+class Plan {
+private:
+    std::vector<Op> configured, steps;
+    std::vector<std::pair<string, string>> dependencies; // op -> op that has to stay after it
+    std::vector<string> rewrites;
+    kernels::Layout layout = kernels::PACKED; // working format of run(img)
+    friend class Planner;
+public:
+    // converts once on the way in and once on the way out, and in between only around ops
+    // that don't support the layout
+    void run(Mat &img) const;
+    // runs on an I420 frame, see Op::applyYuv
+    void runYuv(Mat &frame) const;
+    // runs the steps from index from to the end
+    void run(Mat &img, size_t from) const;
+    // runs on the part of the full frame that starts at origin
+    void runAt(Mat &img, cv::Point origin) const;
+    const std::vector<Op> &getSteps() const { return steps; }
+    // true when every step is limited to a region, so pixels outside all of them stay as they are
+    bool local() const;
+    bool touches(const cv::Rect &rect) const;
+    bool empty() const { return steps.empty(); }
+    size_t size() const { return steps.size(); }
+    kernels::Layout getLayout() const { return layout; }
+    void setLayout(kernels::Layout layout) { this->layout = layout; }
+    void explain(ostream &out) const;
+};
 
-            // combine initial blurred image with the outlines
-            cv::bitwise_and(edges, edges, img, tresh);
-            this->effect = true;
+void Plan::run(Mat &img) const {
+    if (layout == kernels::PACKED || img.channels() != 3) {
+        for (const Op &op: steps) op.run(img);
+        return;
+    }
+    Mat work;
+    kernels::Layout current = kernels::PACKED;
+    for (const Op &op: steps) {
+        kernels::Layout wanted = img.channels() == 3 && op.supports(layout) ? layout : kernels::PACKED;
+        if (wanted != current) {
+            if (current != kernels::PACKED) kernels::egress(work, img, current);
+            else kernels::ingest(img, work, wanted);
+            current = wanted;
+        }
+        if (current == kernels::PACKED) op.run(img);
+        else op.applyIn(work, current);
+        // a gray frame has nothing to pad or split
+        if (current == kernels::PADDED && work.channels() == 1) {
+            kernels::egress(work, img, current);
+            current = kernels::PACKED;
         }
-        catch (...) { cout << "~ APPLYING EFFECT FAILED\n"; }
     }
+    if (current != kernels::PACKED) kernels::egress(work, img, current);
 }
 
-void Effect::applyAll() {
-    this->blur();
-    this->bw();
-    this->cartoon_effect();
+void Plan::runYuv(Mat &frame) const {
+    for (const Op &op: steps) op.applyYuv(frame);
 }
 
-void Effect::setBlurAmount(int blurAmount) {
-    this->blurAmount = blurAmount;
+void Plan::run(Mat &img, size_t from) const {
+    for (size_t i = from; i < steps.size(); i++) steps[i].run(img);
 }
 
-void Effect::setBlackWhite(bool blackWhite) {
-    this->blackWhite = blackWhite;
+void Plan::runAt(Mat &img, cv::Point origin) const {
+    for (const Op &op: steps) op.run(img, origin);
 }
 
-void Effect::setCartoon(bool cartoon) {
-    this->cartoon = cartoon;
+bool Plan::local() const {
+    for (const Op &op: steps) if (!op.local()) return false;
+    return true;
 }
 
-class Adjustment : virtual public Image {
-protected:
-    double brightness, contrast;
-    int hue;
-    bool adjustment;
-public:
-    Adjustment(string name = "cat.png", string path = "../Images/", bool absolute = false, bool adjustment = false,
-               double brightness = 0, double contrast = 1, int hue = 0);
-    Adjustment(const Adjustment &obj);
-    Adjustment &operator=(const Adjustment &obj);
-
-    // override specifier ensures that the function is virtual and is overriding a virtual function from a base class
-    virtual ~Adjustment() override;
-    istream &read(istream &in);
-    ostream &print(ostream &out) const;
+bool Plan::touches(const cv::Rect &rect) const {
+    for (const Op &op: steps) if (op.touches(rect)) return true;
+    return false;
+}
 
-    void brightness_adjustment();
-    void contrast_adjustment();
-    void hue_adjustment();
-    void write() const;
-    void applyAll();
-    void setBrightness(double brightness);
-    void setContrast(double contrast);
-    void setHue(int hue);
+void Plan::explain(ostream &out) const {
+    out << "~ PLAN\n";
+    out << "Configured:\n";
+    for (size_t i = 0; i < configured.size(); i++) out << "\t" << i + 1 << ". " << configured[i].describe() << endl;
+    out << "Dependencies:\n";
+    if (dependencies.empty()) out << "\tnone\n";
+    for (const auto &edge: dependencies) out << "\t" << edge.first << " before " << edge.second << endl;
+    out << "Runs" << (layout != kernels::PACKED ? string(" on ") + kernels::layoutNames[layout] + " frames" : "")
+        << ":\n";
+    if (steps.empty()) out << "\tnothing\n";
+    for (size_t i = 0; i < steps.size(); i++) out << "\t" << i + 1 << ". " << steps[i].describe() << endl;
+    out << "Rewrites:\n";
+    if (rewrites.empty()) out << "\tnone\n";
+    for (const string &rewrite: rewrites) out << "\t" << rewrite << endl;
+}
 
-    void serialize(string) const;
-    void deserialize(std::ifstream&);
+// builds the dependency graph of the configured operations and rewrites it into a cheaper plan that
+// computes the same pixels (up to rounding): gray conversion moves as early as it can, so blur and
+// cartoon run on one channel instead of three, adjacent linear ops become one lookup table and
+// adjacent gaussian blurs become one blur with sigma = sqrt(sigma1^2 + sigma2^2);
+// a crop and a downscale at the end move in front of the ops, so those run on fewer pixels
+class Planner {
+public:
+    static bool explain; // print every plan before it runs
+    static kernels::Layout layout; // working format of the plans, --layout
+    // input is the size of the frames the plan will run on, geometry only moves when it is known
+    static Plan plan(const std::vector<Op> &ops, cv::Size input = cv::Size());
+    // true when running a then b gives the same pixels as b then a
+    static bool commute(const Op &a, const Op &b);
+private:
+    static bool identity(const Op &op);
+    static bool mergeable(const Op &a, const Op &b);
+    static Op merge(const Op &first, const Op &second);
+    static double sigmaOf(const Op &op);
+    // a downscale can move in front of weighted sums that don't saturate
+    static bool resizable(const Op &op);
+    static void hoistGeometry(std::vector<Op> &ops, cv::Size input, std::vector<string> &rewrites);
 };
 
-void Adjustment::serialize(string fileName) const {
-    this->Image::serialize(fileName);
-    std::ofstream out(fileName, std::ios_base::app);
-
-    out<<adjustment<<" "<<brightness<<" "<<contrast<<" "<<hue<<" ";
-
-    out.close();
+bool Planner::explain = false;
+kernels::Layout Planner::layout = kernels::PACKED;
+
+bool Planner::commute(const Op &a, const Op &b) {
+    // hoistGeometry() already placed crops and resizes
+    if (a.geometric() || b.geometric()) return false;
+    // at the edges of a region the neighbours of a pixel are a mix of edited and unedited ones
+    if (a.local() || b.local()) return false;
+    if (a.kind == Op::CARTOON || b.kind == Op::CARTOON) return false;
+    if (a.kind == b.kind) return a.kind == Op::BLUR || a.kind == Op::BW;
+    if (a.kind == Op::HUE || b.kind == Op::HUE) return false;
+    // gray conversion and blur are weighted sums, so they commute with each other
+    // and with x * alpha + beta as long as it never saturates
+    if (a.kind == Op::LINEAR) return !a.clips;
+    if (b.kind == Op::LINEAR) return !b.clips;
+    return true;
 }
 
-void Adjustment::deserialize(std::ifstream& in) {
-    this->Image::deserialize(in);
+bool Planner::identity(const Op &op) {
+    switch (op.kind) {
+        case Op::LINEAR:
+            for (int i = 0; i < 256; i++) if (op.table.ptr()[i] != i) return false;
+            return true;
+        case Op::BLUR: return op.size <= 1;
+        case Op::HUE: return op.hue % 180 == 0;
+        case Op::CROP: return op.rect.area() <= 0;
+        case Op::RESIZE: return op.width <= 0;
+        default: return false;
+    }
+}
 
-    bool adjustment;
-    double brightness, contrast;
-    int hue;
+bool Planner::mergeable(const Op &a, const Op &b) {
+    if (a.kind != b.kind) return false;
+    // lookup tables work per pixel, so two of them over the same region still compose
+    if (a.kind == Op::LINEAR) return a.roi == b.roi && a.mask.data == b.mask.data;
+    return a.kind == Op::BLUR && !a.local() && !b.local();
+}
 
-    in>>adjustment>>brightness>>contrast>>hue;
-    this->adjustment = adjustment;
-    this->brightness = brightness;
-    this->contrast = contrast;
-    this->hue = hue;
+double Planner::sigmaOf(const Op &op) {
+    // what cv::GaussianBlur uses when sigma is 0
+    return op.sigma > 0 ? op.sigma : 0.3 * ((op.size - 1) * 0.5 - 1) + 0.8;
 }
 
-Adjustment::Adjustment(string name, string path, bool absolute, bool adjustment,
-                       double brightness, double contrast, int hue) :
-        Image(name, path, absolute) {
-    this->adjustment = adjustment;
-    this->brightness = brightness;
-    this->contrast = contrast;
-    this->hue = hue;
-    this->scan();
+Op Planner::merge(const Op &first, const Op &second) {
+    Op op = first;
+    op.label = first.label + " + " + second.label;
+    if (first.kind == Op::LINEAR) {
+        op.table = Mat(1, 256, CV_8U);
+        for (int i = 0; i < 256; i++) op.table.ptr()[i] = second.table.ptr()[first.table.ptr()[i]];
+        op.alpha = second.alpha * first.alpha;
+        op.beta = second.alpha * first.beta + second.beta;
+        op.clips = first.clips || second.clips;
+    }
+    else {
+        op.sigma = std::sqrt(sigmaOf(first) * sigmaOf(first) + sigmaOf(second) * sigmaOf(second));
+        // same size cv::GaussianBlur picks for 8 bit images
+        op.size = cvRound(op.sigma * 6 + 1) | 1;
+    }
+    return op;
 }
 
-Adjustment::Adjustment(const Adjustment &obj) : Image(obj) {
-    this->adjustment = obj.adjustment;
-    this->brightness = obj.brightness;
-    this->contrast = obj.contrast;
-    this->hue = obj.hue;
-    this->scan();
+bool Planner::resizable(const Op &op) {
+    return op.kind == Op::BW || op.kind == Op::BLUR || (op.kind == Op::LINEAR && !op.clips);
 }
 
-Adjustment &Adjustment::operator=(const Adjustment &obj) {
-    if (this != &obj) {
-        Image::operator=(obj);
-        this->adjustment = obj.adjustment;
-        this->brightness = obj.brightness;
-        this->contrast = obj.contrast;
-        this->hue = obj.hue;
-        this->scan();
+void Planner::hoistGeometry(std::vector<Op> &ops, cv::Size input, std::vector<string> &rewrites) {
+    if (input.area() <= 0) return;
+    std::vector<Op> pixels = ops;
+    Op crop = Op::crop(cv::Rect()), resize = Op::resize(0);
+    if (!pixels.empty() && pixels.back().kind == Op::RESIZE) resize = pixels.back(), pixels.pop_back();
+    if (!pixels.empty() && pixels.back().kind == Op::CROP) crop = pixels.back(), pixels.pop_back();
+    // regions are in the coordinates of the full frame
+    for (const Op &op: pixels) if (op.geometric() || op.local()) return;
+
+    cv::Rect full(cv::Point(0, 0), input);
+    cv::Rect rect = crop.rect.area() > 0 ? crop.rect & full : full;
+    if (rect.area() <= 0) return;
+
+    double scale = resize.width > 0 && resize.width < rect.width ? resize.width / (double) rect.width : 1;
+    size_t split = pixels.size();
+    if (scale < 1) while (split > 0 && resizable(pixels[split - 1])) split--;
+
+    // blurs that run after the downscale shrink with it
+    std::vector<Op> tail;
+    int headRadius = 0, tailRadius = 0;
+    for (size_t i = 0; i < split; i++) headRadius += pixels[i].radius();
+    for (size_t i = split; i < pixels.size(); i++) {
+        Op op = pixels[i];
+        if (op.kind == Op::BLUR) {
+            double sigma = sigmaOf(op) * scale;
+            int size = cvRound(sigma * 6 + 1) | 1;
+            if (size <= 1) {
+                rewrites.push_back("dropped " + op.label + ", it is under a pixel at the output size");
+                continue;
+            }
+            op.sigma = sigma;
+            op.size = size;
+            rewrites.push_back("rescaled " + op.label + " to the output size");
+        }
+        tailRadius += op.radius();
+        tail.push_back(op);
     }
-    return *this;
+
+    // the crop keeps a halo, so pixels near its edges see the same neighbours as in the full frame
+    int halo = headRadius + (int) std::ceil(tailRadius / scale);
+    cv::Rect expanded = rect == full ? full :
+                        cv::Rect(rect.x - halo, rect.y - halo, rect.width + 2 * halo, rect.height + 2 * halo) & full;
+
+    std::vector<Op> result;
+    if (expanded != full) {
+        Op early = Op::crop(expanded);
+        early.label = crop.label;
+        result.push_back(early);
+        if (!pixels.empty())
+            rewrites.push_back("moved " + crop.label + " before " + pixels[0].label + " with a halo of " +
+                               std::to_string(halo) + " pixels");
+    }
+    result.insert(result.end(), pixels.begin(), pixels.begin() + split);
+
+    cv::Size resized = expanded.size();
+    if (scale < 1) {
+        int width = cvRound(expanded.width * scale);
+        resized = cv::Size(width, std::max(1, cvRound(expanded.height * width / (double) expanded.width)));
+        Op early = Op::resize(width);
+        early.label = resize.label;
+        result.push_back(early);
+        if (split < pixels.size()) rewrites.push_back("moved " + resize.label + " before " + pixels[split].label);
+    }
+    result.insert(result.end(), tail.begin(), tail.end());
+
+    // cuts the halo off again
+    double sx = resized.width / (double) expanded.width, sy = resized.height / (double) expanded.height;
+    cv::Rect trim(cvRound((rect.x - expanded.x) * sx), cvRound((rect.y - expanded.y) * sy),
+                  cvRound(rect.width * sx), cvRound(rect.height * sy));
+    trim &= cv::Rect(cv::Point(0, 0), resized);
+    if (trim.size() != resized) {
+        Op late = Op::crop(trim);
+        late.label = crop.label;
+        result.push_back(late);
+    }
+    // enlarging stays last, and rounding can leave the downscaled crop a pixel off
+    if (resize.width > 0 && trim.width != resize.width) result.push_back(resize);
+    ops = result;
 }
 
-istream &Adjustment::read(istream &in) {
-    this->Image::read(in);
-    cout << "Is the image adjusted? (yes:1 no:0)\n";
-    in >> this->adjustment;
-    in.get();
-    cout << "Enter brightness [-100,100]: \n";
-    in >> this->brightness;
-    in.get();
-    cout << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
-    in >> this->contrast;
-    in.get();
-    cout << "Enter hue [0,180]: \n";
-    in >> this->hue;
-    in.get();
-    this->scan();
+Plan Planner::plan(const std::vector<Op> &ops, cv::Size input) {
+    Plan plan;
+    plan.configured = ops;
 
-    return in;
-}
+    std::vector<Op> kept;
+    for (const Op &op: ops) {
+        if (identity(op)) plan.rewrites.push_back("dropped " + op.label + ", it changes nothing");
+        else kept.push_back(op);
+    }
+    hoistGeometry(kept, input, plan.rewrites);
+
+    // edge i -> j when op j has to run after op i
+    size_t n = kept.size();
+    std::vector<std::vector<size_t>> next(n);
+    std::vector<int> waiting(n, 0);
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = i + 1; j < n; j++)
+            if (!commute(kept[i], kept[j])) {
+                next[i].push_back(j);
+                waiting[j]++;
+                plan.dependencies.push_back({kept[i].label, kept[j].label});
+            }
 
-ostream &Adjustment::print(ostream &out) const {
-    this->Image::print(out);
-    if (this->adjustment == true) out << "Has adjustments applied\n";
-    else out << "Doesn't have adjustments applied\n";
-    out << "Brightness value: " << this->brightness << endl;
-    out << "Contrast value: " << this->contrast << endl;
-    out << "Hue value: " << this->hue << endl;
+    // topological order that prefers gray conversion, then whatever merges with the previous op,
+    // then the configured order
+    std::vector<bool> done(n, false);
+    std::vector<size_t> order;
+    while (order.size() < n) {
+        size_t pick = n;
+        int best = 3;
+        for (size_t i = 0; i < n; i++) {
+            if (done[i] || waiting[i] != 0) continue;
+            const Op &op = kept[i];
+            int rank = op.kind == Op::BW ? 0 : !order.empty() && mergeable(kept[order.back()], op) ? 1 : 2;
+            if (rank < best) {
+                best = rank;
+                pick = i;
+            }
+        }
+        size_t first = 0;
+        while (done[first]) first++;
+        if (pick != first)
+            plan.rewrites.push_back("moved " + kept[pick].label + " before " + kept[first].label);
+        done[pick] = true;
+        order.push_back(pick);
+        for (size_t j: next[pick]) waiting[j]--;
+    }
 
-    return out;
+    bool gray = false;
+    for (size_t i: order) {
+        const Op &op = kept[i];
+        if (gray && (op.kind == Op::HUE || op.kind == Op::BW)) {
+            plan.rewrites.push_back("dropped " + op.label + ", the image is already gray");
+            continue;
+        }
+        if (op.kind == Op::BW && !op.local()) gray = true;
+        if (!plan.steps.empty() && mergeable(plan.steps.back(), op)) {
+            plan.rewrites.push_back("merged " + plan.steps.back().label + " with " + op.label);
+            plan.steps.back() = merge(plan.steps.back(), op);
+        }
+        else plan.steps.push_back(op);
+    }
+    // the conversions only pay off when some op runs in the layout
+    for (const Op &op: plan.steps) if (layout != kernels::PACKED && op.supports(layout)) plan.layout = layout;
+    return plan;
 }
 
-Adjustment::~Adjustment() {
-    this->contrast = 0;
-    this->brightness = 0;
-    this->hue = 0;
-    this->adjustment = false;
+// encoder parameters of every format, set from the command line so each deployment picks its own
+// trade off between encoding time and file size; the defaults are the ones of cv::imwrite
+struct EncoderSettings {
+    int pngLevel; // zlib level 0-9
+    int pngStrategy; // one of cv::IMWRITE_PNG_STRATEGY_*
+    int jpegQuality; // 0-100
+    bool jpegProgressive;
+    int webpQuality; // 1-100, above 100 is lossless
+
+    EncoderSettings() : pngLevel(1), pngStrategy(cv::IMWRITE_PNG_STRATEGY_RLE), jpegQuality(95),
+                        jpegProgressive(false), webpQuality(101) {}
+
+    std::vector<int> params(const string &extension) const;
+    // part of the render cache key, different settings give different files
+    string describe(const string &extension) const;
+} encoderSettings;
+
+std::vector<int> EncoderSettings::params(const string &extension) const {
+    if (extension == ".png") return {cv::IMWRITE_PNG_COMPRESSION, pngLevel, cv::IMWRITE_PNG_STRATEGY, pngStrategy};
+    if (extension == ".jpg" || extension == ".jpeg")
+        return {cv::IMWRITE_JPEG_QUALITY, jpegQuality, cv::IMWRITE_JPEG_PROGRESSIVE, jpegProgressive};
+    if (extension == ".webp") return {cv::IMWRITE_WEBP_QUALITY, webpQuality};
+    return {};
 }
 
-void Adjustment::write() const {
-    try {
-        string full_path = "../Images with Adjustments/" + this->withoutExtension(this->name) + "_withAdjustments" +
-                           this->extension(this->name);
-        cv::imwrite(full_path, this->img);
-    }
-    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
+string EncoderSettings::describe(const string &extension) const {
+    string description;
+    for (int value: this->params(extension)) description += std::to_string(value) + ",";
+    return description;
 }
 
-void Adjustment::brightness_adjustment() {
-    if (this->brightness != 0 && this->brightness >= -100 && this->brightness <= 100) {
-        try {
-            // rtype == -1 means same type as source image
-            // alpha = contrast, beta = brightness
-            img.convertTo(img, -1, 1, this->brightness);
-            this->adjustment = true;
-        }
-        catch (...) { cout << "~ APPLYING ADJUSTMENT FAILED\n"; }
-    }
+// background threads that encode and write images, so the menus don't wait for the codecs
+class EncoderPool {
+private:
+    static EncoderPool *singleton;
+    std::vector<std::thread> workers;
+    std::deque<std::packaged_task<bool()>> queue;
+    size_t running; // tasks taken from the queue that didn't finish yet
+    std::mutex mutex;
+    std::condition_variable wake, idle;
+
+    explicit EncoderPool(size_t threads);
+    void work();
+public:
+    static size_t threads; // workers started by the first getInstance(), 0 = half the cores
+    EncoderPool(const EncoderPool &) = delete;
+    static EncoderPool *getInstance();
+
+    std::shared_future<bool> submit(const std::function<bool()> &task);
+    // a future that is already done, for writes that failed before reaching the pool
+    static std::shared_future<bool> finished(bool ok);
+    // blocks until every submitted task finished
+    void wait();
+    size_t pending();
+};
+
+EncoderPool *EncoderPool::singleton = NULL;
+size_t EncoderPool::threads = 0;
+
+EncoderPool::EncoderPool(size_t threads) : running(0) {
+    for (size_t i = 0; i < threads; i++) workers.emplace_back(&EncoderPool::work, this);
+    // the pool lives until the program exits
+    for (std::thread &worker: workers) worker.detach();
 }
 
-void Adjustment::contrast_adjustment() {
-    if (this->contrast >= 0 && this->contrast <= 10) {
-        try {
-            // rtype == -1 means same type as source image
-            // alpha = contrast, beta = brightness
-            img.convertTo(img, -1, this->contrast, 0);
-            this->adjustment = true;
-        }
-        catch (...) { cout << "~ APPLYING ADJUSTMENT FAILED\n"; }
+EncoderPool *EncoderPool::getInstance() {
+    if (!singleton) {
+        size_t count = threads;
+        if (count == 0) count = std::max(1u, std::thread::hardware_concurrency() / 2);
+        singleton = new EncoderPool(count);
     }
+    return singleton;
 }
 
-void Adjustment::hue_adjustment() {
-    if (this->hue != 0 && this->hue >= 0 && this->hue <= 180) {
-        try {
-            Mat hsv_img;
-            // changing color space to HSV (HUE, SATURATION, VALUE)
-            cv::cvtColor(img, hsv_img, cv::COLOR_BGR2HSV);
-
-            for (int i = 0; i < hsv_img.rows; i++)
-                for (int j = 0; j < hsv_img.cols; j++) {
-                    // to extract hue of the current pixel
-                    int h = hsv_img.at<cv::Vec3b>(i, j)[0];
-                    // adding value of this->hue to h
-                    h = (h + this->hue) % 180;
-                    // changing pixel hue
-                    hsv_img.at<cv::Vec3b>(i, j)[0] = h;
-                }
-            // converting back to original color space
-            cv::cvtColor(hsv_img, img, cv::COLOR_HSV2BGR);
-            this->adjustment = true;
+void EncoderPool::work() {
+    while (true) {
+        std::packaged_task<bool()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return !queue.empty(); });
+            task = std::move(queue.front());
+            queue.pop_front();
+            running++;
         }
-        catch (...) { cout << "~ APPLYING ADJUSTMENT FAILED\n"; }
+        task();
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+        if (queue.empty() && running == 0) idle.notify_all();
     }
 }
 
-void Adjustment::applyAll() {
-    this->brightness_adjustment();
-    this->contrast_adjustment();
-    this->hue_adjustment();
+std::shared_future<bool> EncoderPool::submit(const std::function<bool()> &task) {
+    std::packaged_task<bool()> packaged(task);
+    std::shared_future<bool> result = packaged.get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(packaged));
+    }
+    wake.notify_one();
+    return result;
 }
 
-void Adjustment::setBrightness(double brightness) {
-    this->brightness = brightness;
+std::shared_future<bool> EncoderPool::finished(bool ok) {
+    std::promise<bool> promise;
+    promise.set_value(ok);
+    return promise.get_future().share();
 }
 
-void Adjustment::setContrast(double contrast) {
-    this->contrast = contrast;
+void EncoderPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return queue.empty() && running == 0; });
 }
 
-void Adjustment::setHue(int hue) {
-    this->hue = hue;
+size_t EncoderPool::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size() + running;
 }
 
-class Edited : public Effect, public Adjustment {
-private:
-    bool edited;
-    string date;
+#ifdef HAVE_ZLIB
+// png writer that deflates bands of rows on every core, like pigz: each band is a raw deflate stream
+// primed with the last 32K of the data before it and flushed to a byte boundary, so the bands
+// concatenate into the single zlib stream any png decoder expects
+class ParallelPng {
 public:
-    Edited(string name = "cat.png", string path = "../Images/", bool absolute = false, bool effect = false,
-           int blurAmount = 0, bool blackWhite = false, bool cartoon = false,
-           bool adjustment = false, double brightness = 0, double contrast = 1, int hue = 0, bool edited = false,
-           string date = "13/06/1826");
-    Edited(const Edited &obj);
-    Edited &operator=(const Edited &obj);
-
-    ~Edited();
-    istream &read(istream &in);
-    ostream &print(ostream &out) const;
-
-    void write() const;
-    void applyAll();
-    void serialize(string) const;
-    void deserialize(std::ifstream&);
+    static constexpr size_t minBytes = 16 << 20; // smaller images encode fast enough on one core
+    static bool supports(const Mat &img);
+    // rows first to last of the image being written, asked for in increasing order, so they can be
+    // computed while the file is written
+    typedef std::function<Mat(int first, int last)> RowSource;
+    // passes the file to sink in order, a window of bands at a time, so it never has to be in memory whole
+    static bool write(cv::Size size, int type, const RowSource &rows, int level, int strategy,
+                      const std::function<bool(const uchar *, size_t)> &sink);
+    static bool write(const Mat &img, int level, int strategy,
+                      const std::function<bool(const uchar *, size_t)> &sink);
+    static bool encode(const Mat &img, std::vector<uchar> &buffer, int level, int strategy);
+private:
+    static constexpr size_t window = 32768; // deflate looks back this far
+    static constexpr size_t bandBytes = 4 << 20;
+    static int contextRows(size_t rowBytes) { return (int) ((window + rowBytes) / (rowBytes + 1)); }
+
+    struct Band {
+        int first, last; // rows
+        std::vector<uchar> data; // compressed
+        uLong adler, length, crc; // of the uncompressed rows, their size, crc of the IDAT chunk
+        bool ok;
+    };
+
+    static void rgbRow(const Mat &img, int row, uchar *out);
+    static void filterRow(const uchar *row, const uchar *previous, size_t bytes, int channels, uchar *out,
+                          std::vector<uchar> &scratch);
+    // rows holds the image rows from offset on
+    static void compress(const Mat &rows, int offset, Band &band, bool last, int level, int strategy);
+    static bool chunk(const char *type, const uchar *data, size_t size, uLong crc,
+                      const std::function<bool(const uchar *, size_t)> &sink);
 };
 
-void Edited::serialize(string fileName) const {
-    this->Effect::serialize(fileName);
-    std::ofstream out(fileName, std::ios_base::app);
+bool ParallelPng::supports(const Mat &img) {
+    return img.depth() == CV_8U && (img.channels() == 1 || img.channels() == 3 || img.channels() == 4) &&
+           img.total() * img.elemSize() >= minBytes;
+}
 
-    out<<adjustment<<" "<<brightness<<" "<<contrast<<" "<<hue<<" "<<edited<<" "<<date;
-
-    out.close();
+void ParallelPng::rgbRow(const Mat &img, int row, uchar *out) {
+    const uchar *in = img.ptr(row);
+    int channels = img.channels();
+    if (channels == 1) {
+        std::memcpy(out, in, img.cols);
+        return;
+    }
+    // opencv keeps BGR(A), png wants RGB(A)
+    for (int x = 0; x < img.cols; x++, in += channels, out += channels) {
+        out[0] = in[2];
+        out[1] = in[1];
+        out[2] = in[0];
+        if (channels == 4) out[3] = in[3];
+    }
 }
 
-void Edited::deserialize(std::ifstream& in) {
-    this->Effect::deserialize(in);
-
-    bool adjustment,edited;
-    double brightness, contrast;
-    int hue;
-    string date;
+void ParallelPng::filterRow(const uchar *row, const uchar *previous, size_t bytes, int channels, uchar *out,
+                            std::vector<uchar> &scratch) {
+    // tries all five filters and keeps the one with the smallest sum of absolute differences, like libpng
+    scratch.resize(5 * bytes);
+    uchar *candidates[5];
+    for (int f = 0; f < 5; f++) candidates[f] = scratch.data() + f * bytes;
+    for (size_t i = 0; i < bytes; i++) {
+        int a = i >= (size_t) channels ? row[i - channels] : 0;
+        int b = previous ? previous[i] : 0;
+        int c = previous && i >= (size_t) channels ? previous[i - channels] : 0;
+        int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        int paeth = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        candidates[0][i] = row[i];
+        candidates[1][i] = (uchar) (row[i] - a);
+        candidates[2][i] = (uchar) (row[i] - b);
+        candidates[3][i] = (uchar) (row[i] - (a + b) / 2);
+        candidates[4][i] = (uchar) (row[i] - paeth);
+    }
+    int best = 0;
+    uint64_t bestSum = UINT64_MAX;
+    for (int f = 0; f < 5; f++) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < bytes; i++) sum += std::abs((int) (signed char) candidates[f][i]);
+        if (sum < bestSum) bestSum = sum, best = f;
+    }
+    out[0] = (uchar) best;
+    std::memcpy(out + 1, candidates[best], bytes);
+}
 
-    in>>adjustment>>brightness>>contrast>>hue>>edited>>date;
-    this->adjustment = adjustment;
-    this->brightness = brightness;
-    this->contrast = contrast;
-    this->hue = hue;
-    this->edited = edited;
-    this->date = date;
+void ParallelPng::compress(const Mat &rows, int offset, Band &band, bool last, int level, int strategy) {
+    size_t rowBytes = (size_t) rows.cols * rows.channels();
+    // rows before the band are filtered again, their tail is the dictionary
+    int context = std::min(band.first, contextRows(rowBytes));
+    int start = band.first - context;
+
+    std::vector<uchar> filtered((size_t) (band.last - start) * (rowBytes + 1));
+    std::vector<uchar> current(rowBytes), previous(rowBytes), scratch;
+    if (start > 0) rgbRow(rows, start - 1 - offset, previous.data());
+    for (int y = start; y < band.last; y++) {
+        rgbRow(rows, y - offset, current.data());
+        filterRow(current.data(), y > 0 ? previous.data() : NULL, rowBytes, rows.channels(),
+                  filtered.data() + (size_t) (y - start) * (rowBytes + 1), scratch);
+        std::swap(current, previous);
+    }
+    size_t dictionaryBytes = std::min(window, (size_t) context * (rowBytes + 1));
+    const uchar *input = filtered.data() + (size_t) context * (rowBytes + 1);
+    band.length = (uLong) (filtered.size() - (size_t) context * (rowBytes + 1));
+    band.adler = adler32(adler32(0, NULL, 0), input, band.length);
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // negative window bits: raw deflate, the zlib header and checksum are written once for the whole file
+    band.ok = deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy) == Z_OK;
+    if (!band.ok) return;
+    if (dictionaryBytes > 0) deflateSetDictionary(&stream, input - dictionaryBytes, (uInt) dictionaryBytes);
+    band.data.resize(deflateBound(&stream, band.length) + 64);
+    stream.next_in = (Bytef *) input;
+    stream.avail_in = (uInt) band.length;
+    size_t written = 0;
+    int result;
+    do {
+        if (written == band.data.size()) band.data.resize(band.data.size() * 2);
+        stream.next_out = band.data.data() + written;
+        stream.avail_out = (uInt) (band.data.size() - written);
+        // a sync flush ends the band on a byte boundary without ending the stream
+        result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        written = band.data.size() - stream.avail_out;
+    } while (result == Z_OK && stream.avail_out == 0);
+    band.ok = last ? result == Z_STREAM_END : result == Z_OK || result == Z_BUF_ERROR;
+    deflateEnd(&stream);
+    band.data.resize(written);
+    band.crc = crc32(crc32(0, (const Bytef *) "IDAT", 4), band.data.data(), (uInt) band.data.size());
 }
 
-Edited::Edited(string name, string path, bool absolute, bool effect, int blurAmount, bool blackWhite, bool cartoon,
-               bool adjustment, double brightness, double contrast, int hue, bool edited, string date) : Image(name,path,absolute),
-                                                                                                         Effect(name,path,absolute,effect,blurAmount,blackWhite,cartoon),
-                                                                                                         Adjustment(name,path,absolute,adjustment,brightness,contrast,hue) {
-    this->edited = edited;
-    this->date = date;
-    this->scan();
+bool ParallelPng::chunk(const char *type, const uchar *data, size_t size, uLong crc,
+                        const std::function<bool(const uchar *, size_t)> &sink) {
+    uchar header[8] = {(uchar) (size >> 24), (uchar) (size >> 16), (uchar) (size >> 8), (uchar) size,
+                       (uchar) type[0], (uchar) type[1], (uchar) type[2], (uchar) type[3]};
+    uchar footer[4] = {(uchar) (crc >> 24), (uchar) (crc >> 16), (uchar) (crc >> 8), (uchar) crc};
+    return sink(header, 8) && (size == 0 || sink(data, size)) && sink(footer, 4);
 }
 
-Edited::Edited(const Edited &obj) : Image(obj), Effect(obj), Adjustment(obj) {
-    this->edited = obj.edited;
-    this->date = obj.date;
-    this->scan();
+bool ParallelPng::write(const Mat &img, int level, int strategy,
+                        const std::function<bool(const uchar *, size_t)> &sink) {
+    if (img.empty()) return false;
+    return write(img.size(), img.type(), [&img](int first, int last) { return img.rowRange(first, last); },
+                 level, strategy, sink);
 }
 
-Edited &Edited::operator=(const Edited &obj) {
-    if (this != &obj) {
-        Effect::operator=(obj);
-        Adjustment::operator=(obj);
-        this->edited = obj.edited;
-        this->date = obj.date;
-        this->scan();
+bool ParallelPng::write(cv::Size size, int type, const RowSource &rows, int level, int strategy,
+                        const std::function<bool(const uchar *, size_t)> &sink) {
+    int channels = CV_MAT_CN(type);
+    if (size.area() == 0 || CV_MAT_DEPTH(type) != CV_8U || channels == 2 || channels > 4) return false;
+    auto crcOf = [](const char *type, const uchar *data, size_t size) {
+        uLong crc = crc32(0, (const Bytef *) type, 4);
+        // crc32() of a NULL buffer returns the initial value, not crc
+        return size == 0 ? crc : crc32(crc, data, (uInt) size);
+    };
+
+    static const uchar signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    uchar colorType = channels == 1 ? 0 : channels == 3 ? 2 : 6;
+    uchar header[13] = {(uchar) (size.width >> 24), (uchar) (size.width >> 16), (uchar) (size.width >> 8),
+                        (uchar) size.width, (uchar) (size.height >> 24), (uchar) (size.height >> 16),
+                        (uchar) (size.height >> 8), (uchar) size.height, 8, colorType, 0, 0, 0};
+    if (!sink(signature, 8) || !chunk("IHDR", header, 13, crcOf("IHDR", header, 13), sink)) return false;
+
+    // the zlib header, level bits only tell decoders how hard the encoder tried
+    uchar zlibHeader[2] = {0x78, (uchar) (level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda)};
+    if (!chunk("IDAT", zlibHeader, 2, crcOf("IDAT", zlibHeader, 2), sink)) return false;
+
+    size_t rowBytes = (size_t) size.width * channels + 1;
+    int bandRows = (int) std::max<size_t>(1, bandBytes / rowBytes);
+    int bands = (size.height + bandRows - 1) / bandRows;
+    // a window of bands is compressed at a time, so memory stays bounded for any image size
+    int perWindow = std::max(2, 2 * cv::getNumThreads());
+    uLong adler = adler32(0, NULL, 0);
+    for (int from = 0; from < bands; from += perWindow) {
+        std::vector<Band> pending(std::min(perWindow, bands - from));
+        for (size_t i = 0; i < pending.size(); i++) {
+            pending[i].first = (from + (int) i) * bandRows;
+            pending[i].last = std::min(size.height, pending[i].first + bandRows);
+        }
+        // the window's rows, with the ones before it the first band needs for its dictionary and filter
+        int offset = std::max(0, pending[0].first - contextRows(rowBytes - 1) - 1);
+        Mat block = rows(offset, pending.back().last);
+        if (block.rows != pending.back().last - offset || block.type() != type) return false;
+        cv::parallel_for_(cv::Range(0, (int) pending.size()), [&](const cv::Range &range) {
+            for (int i = range.start; i < range.end; i++)
+                compress(block, offset, pending[i], from + i == bands - 1, level, strategy);
+        });
+        for (const Band &band: pending) {
+            if (!band.ok || !chunk("IDAT", band.data.data(), band.data.size(), band.crc, sink)) return false;
+            adler = adler32_combine(adler, band.adler, band.length);
+        }
     }
-    return *this;
-}
 
-Edited::~Edited() {
-    this->edited = false;
-    if (!this->date.empty()) this->date.clear();
+    uchar checksum[4] = {(uchar) (adler >> 24), (uchar) (adler >> 16), (uchar) (adler >> 8), (uchar) adler};
+    return chunk("IDAT", checksum, 4, crcOf("IDAT", checksum, 4), sink) &&
+           chunk("IEND", NULL, 0, crcOf("IEND", NULL, 0), sink);
 }
 
-istream &Edited::read(istream &in) {
-    this->Effect::read(in);
-
-    cout << "Is the image adjusted? (yes:1 no:0)\n";
-    in >> this->adjustment;
-    in.get();
-    cout << "Enter brightness [-100,100]: \n";
-    in >> this->brightness;
-    in.get();
-    cout << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
-    in >> this->contrast;
-    in.get();
-    cout << "Enter hue [0,180]: \n";
-    in >> this->hue;
-    in.get();
+bool ParallelPng::encode(const Mat &img, std::vector<uchar> &buffer, int level, int strategy) {
+    buffer.clear();
+    return write(img, level, strategy, [&buffer](const uchar *data, size_t size) {
+        buffer.insert(buffer.end(), data, data + size);
+        return true;
+    });
+}
 
-    cout << "Is the image edited (yes:1 no:0)?\n";
-    in >> this->edited;
-    in.get();
-    cout << "Enter date of edited image: \n";
-    std::getline(in, this->date);
+// reads an 8 bit, non interlaced png a strip of rows at a time, for sources too large to decode whole
+class PngReader {
+private:
+    std::ifstream in;
+    z_stream stream;
+    bool inflating, inChunk;
+    cv::Size size;
+    int channels; // in the file: gray, gray and alpha, rgb or rgba
+    int row; // next row to read
+    uint32_t chunkLeft; // bytes of the current IDAT chunk not read yet
+    std::vector<uchar> input, current, previous; // compressed bytes, filter byte and row
+
+    static uint32_t big32(const uchar *p) { return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+    bool fill();
+    bool nextRow();
+public:
+    PngReader() : inflating(false), inChunk(false), channels(0), row(0), chunkLeft(0) {}
+    PngReader(const PngReader &) = delete;
+    ~PngReader() { if (inflating) inflateEnd(&stream); }
+
+    // false for other files and for pngs this reader doesn't handle, cv::imread takes those
+    bool open(const string &path);
+    cv::Size getSize() const { return size; }
+    // the next rows in BGR like cv::imread with IMREAD_COLOR, fewer at the bottom of the image
+    bool read(int rows, Mat &strip);
+};
 
-    this->scan();
-    return in;
+bool PngReader::open(const string &path) {
+    static const uchar signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    in.open(path, std::ios_base::binary);
+    uchar head[33];
+    if (!in.read((char *) head, 33) || std::memcmp(head, signature, 8) != 0 || std::memcmp(head + 12, "IHDR", 4) != 0)
+        return false;
+    const uchar *header = head + 16;
+    size = cv::Size((int) big32(header), (int) big32(header + 4));
+    int depth = header[8], colorType = header[9], interlace = header[12];
+    // palettes, 16 bit samples and interlacing are left to the full decoder
+    if (depth != 8 || interlace != 0 || size.area() <= 0) return false;
+    if (colorType == 0) channels = 1;
+    else if (colorType == 4) channels = 2;
+    else if (colorType == 2) channels = 3;
+    else if (colorType == 6) channels = 4;
+    else return false;
+
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) return false;
+    inflating = true;
+    input.resize(1 << 16);
+    current.assign((size_t) size.width * channels + 1, 0);
+    previous.assign(current.size(), 0);
+    return true;
 }
 
-ostream &Edited::print(ostream &out) const {
-    this->Effect::print(out);
+bool PngReader::fill() {
+    while (chunkLeft == 0) {
+        // the crc of the chunk before, the zlib checksum already covers the data
+        if (inChunk) in.seekg(4, std::ios_base::cur);
+        uchar header[8];
+        if (!in.read((char *) header, 8)) return false;
+        uint32_t length = big32(header);
+        if (std::memcmp(header + 4, "IDAT", 4) == 0) chunkLeft = length, inChunk = true;
+        else if (std::memcmp(header + 4, "IEND", 4) == 0) return false;
+        else in.seekg(length + 4, std::ios_base::cur), inChunk = false;
+    }
+    uint32_t bytes = std::min<uint32_t>(chunkLeft, (uint32_t) input.size());
+    if (!in.read((char *) input.data(), bytes)) return false;
+    chunkLeft -= bytes;
+    stream.next_in = input.data();
+    stream.avail_in = bytes;
+    return true;
+}
 
-    if (this->adjustment == true) out << "Has adjustments applied\n";
-    else out << "Doesn't have adjustments applied\n";
-    out << "Brightness value: " << this->brightness << endl;
-    out << "Contrast value: " << this->contrast << endl;
-    out << "Hue value: " << this->hue << endl;
+bool PngReader::nextRow() {
+    stream.next_out = current.data();
+    stream.avail_out = (uInt) current.size();
+    while (stream.avail_out > 0) {
+        if (stream.avail_in == 0 && !this->fill()) return false;
+        int result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+            if (stream.avail_out > 0) return false;
+            break;
+        }
+        if (result != Z_OK && result != Z_BUF_ERROR) return false;
+    }
 
-    if (this->edited == true) out << "Is edited\n";
-    else out << "Is not edited\n";
+    uchar *out = current.data() + 1;
+    const uchar *up = previous.data() + 1;
+    size_t bytes = current.size() - 1;
+    switch (current[0]) {
+        case 0: break;
+        case 1: for (size_t i = channels; i < bytes; i++) out[i] += out[i - channels]; break;
+        case 2: for (size_t i = 0; i < bytes; i++) out[i] += up[i]; break;
+        case 3:
+            for (size_t i = 0; i < bytes; i++) out[i] += ((i >= (size_t) channels ? out[i - channels] : 0) + up[i]) / 2;
+            break;
+        case 4:
+            for (size_t i = 0; i < bytes; i++) {
+                int a = i >= (size_t) channels ? out[i - channels] : 0, b = up[i];
+                int c = i >= (size_t) channels ? up[i - channels] : 0;
+                int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                out[i] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            }
+            break;
+        default: return false;
+    }
+    std::swap(current, previous);
+    return true;
+}
 
-    out << "Date of completion: " << this->date << endl;
+bool PngReader::read(int rows, Mat &strip) {
+    int count = std::min(rows, size.height - row);
+    if (count <= 0) return false;
+    strip.create(count, size.width, CV_8UC3);
+    for (int y = 0; y < count; y++) {
+        if (!this->nextRow()) return false;
+        const uchar *in = previous.data() + 1;
+        uchar *out = strip.ptr(y);
+        // alpha is dropped and gray is repeated, like the full decoder does for color
+        for (int x = 0; x < size.width; x++, in += channels, out += 3) {
+            if (channels <= 2) out[0] = out[1] = out[2] = in[0];
+            else out[0] = in[2], out[1] = in[1], out[2] = in[0];
+        }
+    }
+    row += count;
+    return true;
+}
+#endif
+
+// png settings out of a cv::imwrite parameter list
+void pngParams(const std::vector<int> &params, int &level, int &strategy) {
+    level = 1;
+    strategy = cv::IMWRITE_PNG_STRATEGY_RLE;
+    for (size_t i = 0; i + 1 < params.size(); i += 2) {
+        if (params[i] == cv::IMWRITE_PNG_COMPRESSION) level = params[i + 1];
+        else if (params[i] == cv::IMWRITE_PNG_STRATEGY) strategy = params[i + 1];
+    }
+}
 
-    return out;
+// cv::imencode, except for large png images that go through the parallel writer
+bool encodeImage(const string &extension, const Mat &img, std::vector<uchar> &buffer, const std::vector<int> &params) {
+#ifdef HAVE_ZLIB
+    if (extension == ".png" && ParallelPng::supports(img)) {
+        int level, strategy;
+        pngParams(params, level, strategy);
+        return ParallelPng::encode(img, buffer, level, strategy);
+    }
+#endif
+    return cv::imencode(extension, img, buffer, params);
 }
 
-void Edited::write() const {
-    try {
-        string full_path =
-                "../Edited Images/" + this->withoutExtension(this->name) + "_Edited" + this->extension(this->name);
-        cv::imwrite(full_path, this->img);
+// cv::imwrite, except for large png images that are streamed to the file while they compress
+bool writeImage(const string &path, const Mat &img, const std::vector<int> &params) {
+#ifdef HAVE_ZLIB
+    size_t dot = path.find_last_of('.');
+    if (dot != string::npos && path.substr(dot) == ".png" && ParallelPng::supports(img)) {
+        int level, strategy;
+        pngParams(params, level, strategy);
+        std::ofstream out(path, std::ios_base::binary);
+        return ParallelPng::write(img, level, strategy, [&out](const uchar *data, size_t size) {
+            out.write((const char *) data, size);
+            return (bool) out;
+        });
     }
-    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
+#endif
+    return cv::imwrite(path, img, params);
 }
 
-void Edited::applyAll() {
-    this->brightness_adjustment();
-    this->contrast_adjustment();
-    this->hue_adjustment();
+// lossless raw pixel format for history tiles, spill files and sidecar caches; a record is a 64 byte
+// header and the pixels, either stored exactly as in memory with 64 byte aligned rows, so a mapped
+// file is used without copying, or compressed in the LZ4 block format, which decodes at memory speed
+class RawImage {
+public:
+    enum Codec { STORED = 0, LZ4 = 1 };
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        int32_t rows, cols, type;
+        uint32_t codec;
+        uint64_t step; // bytes per row in the payload
+        uint64_t packed; // compressed bytes, equal to step * rows when stored
+        uint64_t payload; // bytes after the header, the next record starts 64 byte aligned
+    };
+    static constexpr size_t headerBytes = 64, alignment = 64;
+
+    // appends a record of img to out
+    static void encode(const Mat &img, std::vector<uchar> &out, Codec codec);
+    // reads the record at data into img and returns its size, 0 when it is damaged; stored records
+    // become a Mat header over data when copy is false, so data has to outlive img
+    static size_t decode(const uchar *data, size_t size, Mat &img, bool copy);
+    // size of the record at data without decoding it, 0 when it is damaged
+    static size_t skip(const uchar *data, size_t size);
+
+    static size_t lz4Bound(size_t size) { return size + size / 255 + 16; }
+    static size_t lz4Compress(const uchar *in, size_t size, uchar *out);
+    static bool lz4Decompress(const uchar *in, size_t size, uchar *out, size_t outSize);
+private:
+    static size_t aligned(size_t bytes) { return (bytes + alignment - 1) / alignment * alignment; }
+};
 
-    this->blur();
-    this->bw();
-    this->cartoon_effect();
+void RawImage::encode(const Mat &img, std::vector<uchar> &out, Codec codec) {
+    size_t rowBytes = img.cols * img.elemSize();
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "RAWM", 4);
+    header.version = 1;
+    header.rows = img.rows;
+    header.cols = img.cols;
+    header.type = img.type();
+    header.codec = codec;
+
+    size_t start = out.size();
+    if (codec == STORED) {
+        header.step = aligned(rowBytes);
+        header.packed = header.step * img.rows;
+        header.payload = header.packed;
+        out.resize(start + headerBytes + header.payload, 0);
+        for (int i = 0; i < img.rows; i++)
+            std::memcpy(out.data() + start + headerBytes + i * header.step, img.ptr(i), rowBytes);
+    } else {
+        // lz4 needs the rows next to each other
+        Mat continuous = img.isContinuous() ? img : img.clone();
+        size_t bytes = rowBytes * img.rows;
+        header.step = rowBytes;
+        out.resize(start + headerBytes + lz4Bound(bytes));
+        header.packed = lz4Compress(continuous.ptr(), bytes, out.data() + start + headerBytes);
+        header.payload = aligned(header.packed);
+        out.resize(start + headerBytes + header.payload, 0);
+    }
+    std::memset(out.data() + start, 0, headerBytes);
+    std::memcpy(out.data() + start, &header, sizeof(header));
 }
 
-class Photoshop {
-private:
-    Image *image;
-    bool favorite, goBack;
+size_t RawImage::skip(const uchar *data, size_t size) {
+    Header header;
+    if (size < headerBytes) return 0;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, "RAWM", 4) != 0 || header.version != 1 || header.rows < 0 || header.cols < 0)
+        return 0;
+    if (header.payload > size - headerBytes || header.packed > header.payload) return 0;
+    return headerBytes + header.payload;
+}
 
-public:
-    Image *getImage() { return this->image; }
-    Image*& getImageByReference() {return this->image;}
-    friend istream &operator>>(istream &in, Photoshop &obj);
-    friend ostream &operator<<(ostream &out, const Photoshop &obj);
+size_t RawImage::decode(const uchar *data, size_t size, Mat &img, bool copy) {
+    Header header;
+    if (skip(data, size) == 0) return 0;
+    std::memcpy(&header, data, sizeof(header));
+
+    size_t rowBytes = header.cols * CV_ELEM_SIZE(header.type);
+    const uchar *payload = data + headerBytes;
+    if (header.codec == STORED) {
+        if (header.step < rowBytes || header.step * header.rows > header.payload) return 0;
+        Mat view(header.rows, header.cols, header.type, (void *) payload, header.step);
+        img = copy ? view.clone() : view;
+    } else if (header.codec == LZ4) {
+        img.create(header.rows, header.cols, header.type);
+        if (!lz4Decompress(payload, header.packed, img.ptr(), rowBytes * header.rows)) return 0;
+    } else return 0;
+    return headerBytes + header.payload;
+}
 
-    bool isGoBack() const;
+size_t RawImage::lz4Compress(const uchar *in, size_t size, uchar *out) {
+    // greedy matching through a hash table of the last position of every 4 byte sequence
+    const int hashLog = 16;
+    const size_t minMatch = 4, lastLiterals = 5, matchLimit = 12;
+    std::vector<uint32_t> table(1 << hashLog, 0);
+    uchar *op = out;
+    size_t anchor = 0, i = 0;
+
+    auto writeLength = [&op](size_t length) {
+        for (; length >= 255; length -= 255) *op++ = 255;
+        *op++ = (uchar) length;
+    };
+    auto writeLiterals = [&](size_t end, uchar *token) {
+        size_t literals = end - anchor;
+        *token = (uchar) (std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15) writeLength(literals - 15);
+        std::memcpy(op, in + anchor, literals);
+        op += literals;
+    };
+
+    // the block has to end with literals, and the last match has to start 12 bytes before the end
+    while (size >= matchLimit && i + matchLimit <= size) {
+        uint32_t sequence, candidateSequence;
+        std::memcpy(&sequence, in + i, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - hashLog);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t) i;
+        std::memcpy(&candidateSequence, in + candidate, 4);
+        if (candidate >= i || i - candidate > 65535 || candidateSequence != sequence) {
+            // skips faster through data that doesn't compress
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
 
-    // methods for template
-    void scan(){image->scan();}
-    void write() const {image->write();}
-    void show() const {image->show();}
-    void applyAll(){image->applyAll();}
+        size_t length = minMatch;
+        while (i + length < size - lastLiterals && in[candidate + length] == in[i + length]) length++;
 
-    // setters for template
-    void setBlurAmount(int);
-    void setBlackWhite(bool);
-    void setCartoon(bool);
-    void setBrightness(double);
-    void setContrast(double);
-    void setHue(int);
+        uchar *token = op++;
+        writeLiterals(i, token);
+        size_t offset = i - candidate;
+        *op++ = (uchar) offset;
+        *op++ = (uchar) (offset >> 8);
+        size_t extra = length - minMatch;
+        *token |= (uchar) std::min<size_t>(extra, 15);
+        if (extra >= 15) writeLength(extra - 15);
 
-    string getType() {
-        return typeid(*image).name();
+        i += length;
+        anchor = i;
     }
-    void serialize(string) const;
-    void deserialize(std::ifstream&);
+    uchar *token = op++;
+    writeLiterals(size, token);
+    return op - out;
+}
 
-    bool operator<(const Photoshop& obj) const {
-        return *(this->image) < *(obj.image);
-    }
-    bool operator==(const Photoshop& obj) const {
-        return *(this->image) == *(obj.image);
+bool RawImage::lz4Decompress(const uchar *in, size_t size, uchar *out, size_t outSize) {
+    size_t ip = 0, op = 0;
+    auto readLength = [&](size_t &length) {
+        uchar byte;
+        do {
+            if (ip >= size) return false;
+            byte = in[ip++];
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    while (ip < size) {
+        uchar token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) return false;
+        if (literals > size - ip || literals > outSize - op) return false;
+        std::memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        // the last sequence has no match
+        if (ip == size) break;
+
+        if (size - ip < 2) return false;
+        size_t offset = in[ip] | (size_t) in[ip + 1] << 8;
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length)) return false;
+        length += 4;
+        if (offset == 0 || offset > op || length > outSize - op) return false;
+
+        // a match can overlap its own output, it repeats the last offset bytes; copying whole
+        // periods from the start keeps every memcpy free of overlap
+        uchar *target = out + op;
+        const uchar *source = target - offset;
+        for (size_t done = 0; done < length;) {
+            size_t chunk = std::min(length - done, offset + done);
+            std::memcpy(target + done, source, chunk);
+            done += chunk;
+        }
+        op += length;
     }
+    return op == outSize;
+}
+
+// a file of raw records mapped into memory
+class RawFile {
+private:
+    uchar *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int descriptor;
+#endif
+public:
+    RawFile();
+    RawFile(const RawFile &) = delete;
+    RawFile &operator=(const RawFile &) = delete;
+    ~RawFile() { this->close(); }
+
+    bool open(const string &path);
+    void close();
+    // the frames of every record, stored ones point into the mapping unless copy is true,
+    // so they are only valid until close()
+    std::vector<Mat> frames(bool copy) const;
+    // where every record starts, for reading them in any order with frame()
+    std::vector<size_t> records() const;
+    Mat frame(size_t offset, bool copy) const;
+
+    // writes frames under a temporary name first, so a half written file is never read
+    static bool write(const string &path, const std::vector<Mat> &frames, RawImage::Codec codec);
 };
 
-void Photoshop::serialize(string fileName) const {
-    image->serialize(fileName);
+#ifdef _WIN32
+RawFile::RawFile() : data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+
+bool RawFile::open(const string &path) {
+    this->close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) return this->close(), false;
+    size = (size_t) length.QuadPart;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) return this->close(), false;
+    data = (uchar *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) return this->close(), false;
+    return true;
 }
 
-void Photoshop::deserialize(std::ifstream& in) {
-    image->deserialize(in);
+void RawFile::close() {
+    if (data != NULL) UnmapViewOfFile(data);
+    if (mapping != NULL) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    data = NULL, size = 0, mapping = NULL, file = INVALID_HANDLE_VALUE;
 }
-
-void Photoshop::setBrightness(double brightness) {
-    if (typeid(*image) == typeid(Adjustment) || typeid(*image) == typeid(Edited)) {
-        dynamic_cast<Adjustment&>(*image).setBrightness(brightness);
-        std::cout << "~ ADJUSTMENT WAS APPLIED SUCCESSFULLY\n";
-    } else std::cout << "~ OBJECT IS NOT OF TYPE ADJUSTMENT OR EDITING\n";
+#else
+RawFile::RawFile() : data(NULL), size(0), descriptor(-1) {}
+
+bool RawFile::open(const string &path) {
+    this->close();
+    descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) return false;
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || info.st_size == 0) return this->close(), false;
+    size = (size_t) info.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (mapped == MAP_FAILED) return this->close(), false;
+    data = (uchar *) mapped;
+    return true;
 }
 
-void Photoshop::setContrast(double contrast) {
-    if (typeid(*image) == typeid(Adjustment) || typeid(*image) == typeid(Edited)) {
-        dynamic_cast<Adjustment&>(*image).setContrast(contrast);
-        std::cout << "~ ADJUSTMENT WAS APPLIED SUCCESSFULLY\n";
-    } else std::cout << "~ OBJECT IS NOT OF TYPE ADJUSTMENT OR EDITING\n";
+void RawFile::close() {
+    if (data != NULL) munmap(data, size);
+    if (descriptor >= 0) ::close(descriptor);
+    data = NULL, size = 0, descriptor = -1;
+}
+#endif
+
+std::vector<Mat> RawFile::frames(bool copy) const {
+    std::vector<Mat> result;
+    for (size_t offset = 0; offset < size;) {
+        Mat frame;
+        size_t used = RawImage::decode(data + offset, size - offset, frame, copy);
+        if (used == 0) break;
+        result.push_back(frame);
+        offset += used;
+    }
+    return result;
 }
 
-void Photoshop::setHue(int hue) {
-    if (typeid(*image) == typeid(Adjustment) || typeid(*image) == typeid(Edited)) {
-        dynamic_cast<Adjustment&>(*image).setHue(hue);
-        std::cout << "~ ADJUSTMENT WAS APPLIED SUCCESSFULLY\n";
-    } else std::cout << "~ OBJECT IS NOT OF TYPE ADJUSTMENT OR EDITING\n";
+std::vector<size_t> RawFile::records() const {
+    std::vector<size_t> offsets;
+    for (size_t offset = 0; offset < size;) {
+        size_t used = RawImage::skip(data + offset, size - offset);
+        if (used == 0) break;
+        offsets.push_back(offset);
+        offset += used;
+    }
+    return offsets;
 }
 
-void Photoshop::setBlurAmount(int blurAmount) {
-    if (typeid(*image) == typeid(Effect) || typeid(*image) == typeid(Edited)) {
-        dynamic_cast<Effect&>(*image).setBlurAmount(blurAmount);
-        std::cout << "~ EFFECT WAS APPLIED SUCCESSFULLY\n";
-    } else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT OR EDITING\n";
+Mat RawFile::frame(size_t offset, bool copy) const {
+    Mat frame;
+    if (offset < size) RawImage::decode(data + offset, size - offset, frame, copy);
+    return frame;
 }
 
-void Photoshop::setBlackWhite(bool blackWhite) {
-    if (typeid(*image) == typeid(Effect) || typeid(*image) == typeid(Edited)) {
-        dynamic_cast<Effect&>(*image).setBlackWhite(blackWhite);
-        std::cout<< "~ EFFECT WAS APPLIED SUCCESSFULLY\n";
+bool RawFile::write(const string &path, const std::vector<Mat> &frames, RawImage::Codec codec) {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    {
+        std::ofstream out(path + ".tmp", std::ios_base::binary);
+        std::vector<uchar> record;
+        for (const Mat &frame: frames) {
+            record.clear();
+            RawImage::encode(frame, record, codec);
+            out.write((const char *) record.data(), record.size());
+        }
+        if (!out) return false;
     }
-    else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT OR EDITING\n";
+    std::filesystem::rename(path + ".tmp", path, error);
+    return !error;
 }
 
-void Photoshop::setCartoon(bool cartoon) {
-    if (typeid(*image) == typeid(Effect) || typeid(*image) == typeid(Edited)) {
-        dynamic_cast<Effect&>(*image).setCartoon(cartoon);
-        std::cout<< "~ EFFECT WAS APPLIED SUCCESSFULLY\n";
+// on disk cache of encoded renders, a render is identified by a hash of the source file bytes,
+// every edit applied since the file was scanned, the output format and the pipeline version
+class RenderCache {
+public:
+    // bump when an operation starts producing different pixels, so old renders stop matching
+    static constexpr int pipelineVersion = 3;
+private:
+    struct Item {
+        uintmax_t size;
+        std::filesystem::file_time_type used;
+    };
+
+    static RenderCache *singleton;
+    string directory;
+    uintmax_t capacity, total;
+    bool indexed;
+    std::map<string, Item> items; // cache file -> size and last use
+    std::map<uint64_t, std::shared_future<bool>> inFlight; // renders being computed right now
+    std::mutex mutex;
+
+    RenderCache() : directory("../.render_cache/"), capacity(2048ull * 1024 * 1024), total(0), indexed(false) {}
+    void index();
+    void evict();
+    string fileOf(uint64_t key, const string &extension) const;
+public:
+    RenderCache(const RenderCache &) = delete;
+    static RenderCache *getInstance();
+
+    static uint64_t sourceHash(const string &path);
+    static uint64_t key(uint64_t source, const string &recipe, const string &extension);
+
+    bool contains(uint64_t key, const string &extension);
+    // copies the render identified by key to path, encode() only runs when it isn't cached yet;
+    // identical requests running at the same time wait for the first one instead of encoding again
+    bool write(uint64_t key, const string &extension, const string &path,
+               const std::function<bool(std::vector<uchar> &)> &encode);
+    void setCapacity(uintmax_t bytes);
+};
+
+RenderCache *RenderCache::singleton = NULL;
+
+RenderCache *RenderCache::getInstance() {
+    if (!singleton) singleton = new RenderCache();
+    return singleton;
+}
+
+uint64_t RenderCache::sourceHash(const string &path) {
+    // hashing the source again is only needed when it changed on disk
+    struct Known {
+        uintmax_t size;
+        std::filesystem::file_time_type time;
+        uint64_t hash;
+    };
+    static std::map<string, Known> known;
+    static std::mutex knownMutex;
+
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    if (error) return 0;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    if (error) return 0;
+    {
+        std::lock_guard<std::mutex> lock(knownMutex);
+        auto it = known.find(path);
+        if (it != known.end() && it->second.size == size && it->second.time == time) return it->second.hash;
     }
-    else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT OR EDITING\n";
+
+    std::ifstream in(path, std::ios_base::binary);
+    std::vector<char> bytes(1 << 20);
+    uint64_t hash = 1469598103934665603ULL;
+    while (in) {
+        in.read(bytes.data(), bytes.size());
+        hash = hashBytes((const uchar *) bytes.data(), in.gcount(), hash);
+    }
+
+    std::lock_guard<std::mutex> lock(knownMutex);
+    known[path] = Known{size, time, hash};
+    return hash;
 }
 
-istream &operator>>(istream &in, Photoshop &obj) {
-    obj.goBack = false;
+uint64_t RenderCache::key(uint64_t source, const string &recipe, const string &extension) {
+    string parameters = std::to_string(pipelineVersion) + "|" + extension + "|" + encoderSettings.describe(extension) +
+                        "|" + recipe;
+    return hashBytes((const uchar *) parameters.data(), parameters.size(), source);
+}
 
-    for (int i = 0; i < 10; i++) cout << "-";
-    cout << " CREATE ";
-    for (int i = 0; i < 10; i++) cout << "-";
-    cout << endl;
+string RenderCache::fileOf(uint64_t key, const string &extension) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long) key);
+    return directory + name + extension;
+}
 
-    cout << "1. Effects\n";
-    cout << "2. Adjustments\n";
-    cout << "3. Editing\n";
-    cout << "0. Go back\n";
+void RenderCache::index() {
+    if (indexed) return;
+    indexed = true;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    for (const auto &entry: std::filesystem::directory_iterator(directory, error)) {
+        if (!entry.is_regular_file()) continue;
+        Item item{entry.file_size(), entry.last_write_time()};
+        items[entry.path().string()] = item;
+        total += item.size;
+    }
+}
 
-    int temp;
-    cin >> temp;
-    if(std::cin.fail()) {
-        std::cout<<"~ INVALID INPUT\n";
-        std::cin.clear();
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(),'\n');
-        return in;
+void RenderCache::evict() {
+    // least recently used renders go first
+    while (total > capacity && !items.empty()) {
+        auto oldest = items.begin();
+        for (auto it = items.begin(); it != items.end(); it++)
+            if (it->second.used < oldest->second.used) oldest = it;
+        std::error_code error;
+        std::filesystem::remove(oldest->first, error);
+        total -= oldest->second.size;
+        items.erase(oldest);
     }
-    cin.get();
+}
 
-    switch (temp) {
-        case 0: {
-            obj.goBack = true;
-            break;
-        }
-        case 1: {
-            obj.image = new Effect();
-            break;
-        }
-        case 2: {
-            obj.image = new Adjustment();
-            break;
+bool RenderCache::contains(uint64_t key, const string &extension) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->index();
+    return items.find(this->fileOf(key, extension)) != items.end();
+}
+
+bool RenderCache::write(uint64_t key, const string &extension, const string &path,
+                        const std::function<bool(std::vector<uchar> &)> &encode) {
+    string file = this->fileOf(key, extension);
+    std::promise<bool> promise;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->index();
+
+        auto running = inFlight.find(key);
+        if (running != inFlight.end()) {
+            std::shared_future<bool> result = running->second;
+            lock.unlock();
+            if (!result.get()) return false;
+            lock.lock();
         }
-        case 3: {
-            obj.image = new Edited();
-            break;
+
+        auto it = items.find(file);
+        if (it != items.end()) {
+            std::error_code error;
+            it->second.used = std::filesystem::file_time_type::clock::now();
+            std::filesystem::last_write_time(file, it->second.used, error);
+            lock.unlock();
+            return std::filesystem::copy_file(file, path, std::filesystem::copy_options::overwrite_existing,
+                                              error) && !error;
         }
-        default:
-            cout << "~ INVALID OPTION\n";
+        inFlight[key] = promise.get_future().share();
     }
 
-    if (obj.goBack == false) {
-        in >> *obj.image;
-        cout << "Is this a favorite image (yes:1 no:0)?\n";
-        in >> obj.favorite;
+    std::vector<uchar> buffer;
+    bool ok = encode(buffer);
+    if (ok) {
+        std::ofstream out(path, std::ios_base::binary);
+        out.write((const char *) buffer.data(), buffer.size());
+        ok = (bool) out;
+    }
+    if (ok) {
+        // written under a temporary name so a half written render is never served
+        std::ofstream cached(file + ".tmp", std::ios_base::binary);
+        cached.write((const char *) buffer.data(), buffer.size());
+        cached.close();
+        std::error_code error;
+        std::filesystem::rename(file + ".tmp", file, error);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            items[file] = Item{buffer.size(), std::filesystem::file_time_type::clock::now()};
+            total += buffer.size();
+            this->evict();
+        }
     }
 
-    return in;
+    std::lock_guard<std::mutex> lock(mutex);
+    inFlight.erase(key);
+    promise.set_value(ok);
+    return ok;
 }
 
-ostream &operator<<(ostream &out, const Photoshop &obj) {
-    out << *obj.image;
+void RenderCache::setCapacity(uintmax_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = bytes;
+    this->index();
+    this->evict();
+}
 
-    if (obj.favorite == true) out << "Is a favorite image\n";
-    else out << "Is not a favorite image\n";
+// small previews for file listings: decoded at reduced resolution (jpeg decoders scale the dct blocks,
+// so a 1/8 decode never builds the full image) on background threads, and kept in a sidecar cache
+// keyed by the hash of the file contents so copies and renamed files share one thumbnail
+class ThumbnailService {
+public:
+    static constexpr int longEdge = 192;
+    static bool enabled; // --no-thumbnails turns the preview windows off
+private:
+    struct Known {
+        uintmax_t size;
+        long long time;
+        uint64_t hash;
+    };
+    struct Job {
+        string path;
+        std::shared_ptr<std::promise<Mat>> promise;
+    };
+
+    static ThumbnailService *singleton;
+    static constexpr size_t capacity = 1024; // thumbnails kept in memory, about 100 KB each
+    string directory;
+    bool indexed;
+    // path -> content hash of the version that was hashed, saved so a folder is only hashed once
+    std::map<string, Known> known;
+    std::map<string, std::shared_future<Mat>> requests; // file version -> thumbnail, done or queued
+    std::deque<string> order; // file versions by age of the request
+    std::deque<Job> queue;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    ThumbnailService();
+    void work();
+    void index();
+    uint64_t contentHash(const string &path, uintmax_t size, long long time);
+    Mat build(const string &path);
+public:
+    ThumbnailService(const ThumbnailService &) = delete;
+    static ThumbnailService *getInstance();
+
+    // dimensions read from the png or jpeg header, empty for other formats
+    static cv::Size headerSize(const string &path);
+    // decodes with the largest reduction that keeps the long edge at least maxEdge
+    static Mat decodeReduced(const string &path, int maxEdge);
+    // the future is shared by every request for the same version of the file; urgent requests
+    // go before the queued ones, for the page the user is looking at
+    std::shared_future<Mat> request(const string &path, bool urgent = true);
+    void prefetch(const std::vector<string> &paths);
+    // thumbnails in a grid, numbered from first
+    static Mat contactSheet(const std::vector<Mat> &thumbnails, size_t first, int columns = 5);
+};
 
-    return out;
+ThumbnailService *ThumbnailService::singleton = NULL;
+bool ThumbnailService::enabled = true;
+
+ThumbnailService::ThumbnailService() : directory("../.thumbnails/"), indexed(false) {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    for (size_t i = 0; i < threads; i++) workers.emplace_back(&ThumbnailService::work, this);
+    // like the encoder pool, the workers live until the program exits
+    for (std::thread &worker: workers) worker.detach();
 }
 
-bool Photoshop::isGoBack() const {
-    return this->goBack;
+ThumbnailService *ThumbnailService::getInstance() {
+    if (!singleton) singleton = new ThumbnailService();
+    return singleton;
 }
 
-class Video {
-private:
-    static int counter;
-    const int id;
-    string name;
-    double fps;
-    int blurAmount, hue;
-    bool blackWhite, cartoon;
-    double brightness, contrast;
-    cv::VideoCapture capture;
-    std::vector<Mat> sequence;
+void ThumbnailService::work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return !queue.empty(); });
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        Mat thumbnail;
+        try { thumbnail = this->build(job.path); }
+        catch (...) {}
+        job.promise->set_value(thumbnail);
+    }
+}
+
+void ThumbnailService::index() {
+    if (indexed) return;
+    indexed = true;
+    // lines of "size time hash path"
+    std::ifstream in(directory + "index");
+    Known entry;
+    string path;
+    while (in >> entry.size >> entry.time >> std::hex >> entry.hash >> std::dec) {
+        in.get();
+        if (!getline(in, path)) break;
+        known[path] = entry;
+    }
+}
+
+uint64_t ThumbnailService::contentHash(const string &path, uintmax_t size, long long time) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->index();
+        auto it = known.find(path);
+        if (it != known.end() && it->second.size == size && it->second.time == time) return it->second.hash;
+    }
+    uint64_t hash = RenderCache::sourceHash(path);
+    if (hash == 0) return 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    known[path] = Known{size, time, hash};
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    // appended, a file hashed again later simply has a newer line
+    std::ofstream out(directory + "index", std::ios_base::app);
+    out << size << " " << time << " " << std::hex << hash << std::dec << " " << path << "\n";
+    return hash;
+}
+
+Mat ThumbnailService::build(const string &path) {
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    if (error) return Mat();
+    long long time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    if (error) return Mat();
+    uint64_t hash = this->contentHash(path, size, time);
+    if (hash == 0) return Mat();
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx_%d.raw", (unsigned long long) hash, longEdge);
+    string sidecar = directory + name;
+    {
+        RawFile file;
+        if (file.open(sidecar)) {
+            std::vector<Mat> frames = file.frames(true);
+            if (!frames.empty()) return frames[0];
+        }
+    }
+
+    Mat decoded = decodeReduced(path, longEdge);
+    if (decoded.empty()) return Mat();
+    Mat thumbnail = decoded;
+    double scale = (double) longEdge / std::max(decoded.cols, decoded.rows);
+    if (scale < 1)
+        cv::resize(decoded, thumbnail, cv::Size(), scale, scale, cv::INTER_AREA);
+    RawFile::write(sidecar, {thumbnail}, RawImage::LZ4);
+    return thumbnail;
+}
+
+cv::Size ThumbnailService::headerSize(const string &path) {
+    std::ifstream in(path, std::ios_base::binary);
+    uchar head[24];
+    if (!in.read((char *) head, 2)) return cv::Size();
+    auto big16 = [](const uchar *p) { return (p[0] << 8) | p[1]; };
+
+    if (head[0] == 0x89 && head[1] == 'P') {
+        // the signature is followed by the IHDR chunk, width and height come first
+        if (!in.read((char *) head + 2, 22)) return cv::Size();
+        return cv::Size((big16(head + 16) << 16) | big16(head + 18), (big16(head + 20) << 16) | big16(head + 22));
+    }
+    if (head[0] != 0xFF || head[1] != 0xD8) return cv::Size();
+    // jpeg: walk the marker segments up to the start of frame
+    while (in) {
+        int byte = in.get();
+        if (byte != 0xFF) return cv::Size();
+        int marker = in.get();
+        while (marker == 0xFF) marker = in.get();
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+        if (!in.read((char *) head, 2)) break;
+        int length = big16(head);
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // precision, height, width
+            if (!in.read((char *) head, 5)) break;
+            return cv::Size(big16(head + 3), big16(head + 1));
+        }
+        if (marker == 0xDA || length < 2) break;
+        in.seekg(length - 2, std::ios_base::cur);
+    }
+    return cv::Size();
+}
+
+Mat ThumbnailService::decodeReduced(const string &path, int maxEdge) {
+    cv::Size size = headerSize(path);
+    int edge = std::max(size.width, size.height);
+    int flag = cv::IMREAD_COLOR;
+    if (edge >= 8 * maxEdge) flag = cv::IMREAD_REDUCED_COLOR_8;
+    else if (edge >= 4 * maxEdge) flag = cv::IMREAD_REDUCED_COLOR_4;
+    else if (edge >= 2 * maxEdge) flag = cv::IMREAD_REDUCED_COLOR_2;
+    return cv::imread(path, flag);
+}
+
+std::shared_future<Mat> ThumbnailService::request(const string &path, bool urgent) {
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    long long time = error ? 0 : std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    string version = path + "|" + std::to_string(size) + "|" + std::to_string(time);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = requests.find(version);
+    if (it != requests.end()) return it->second;
+
+    auto promise = std::make_shared<std::promise<Mat>>();
+    std::shared_future<Mat> result = promise->get_future().share();
+    requests[version] = result;
+    order.push_back(version);
+    // callers still holding a future keep their thumbnail, only the lookup is forgotten
+    while (order.size() > capacity) {
+        requests.erase(order.front());
+        order.pop_front();
+    }
+    if (urgent) queue.push_front(Job{path, promise});
+    else queue.push_back(Job{path, promise});
+    wake.notify_one();
+    return result;
+}
+
+void ThumbnailService::prefetch(const std::vector<string> &paths) {
+    for (const string &path: paths) this->request(path, false);
+}
+
+Mat ThumbnailService::contactSheet(const std::vector<Mat> &thumbnails, size_t first, int columns) {
+    if (thumbnails.empty()) return Mat();
+    const int margin = 8, label = 20, cell = longEdge + margin;
+    int rows = ((int) thumbnails.size() + columns - 1) / columns;
+    columns = std::min(columns, (int) thumbnails.size());
+    Mat sheet(rows * (cell + label) + margin, columns * cell + margin, CV_8UC3, cv::Scalar(40, 40, 40));
+
+    for (size_t i = 0; i < thumbnails.size(); i++) {
+        int x = margin + (int) (i % columns) * cell, y = margin + (int) (i / columns) * (cell + label);
+        Mat thumbnail = thumbnails[i];
+        if (thumbnail.empty() || thumbnail.depth() != CV_8U) {
+            // nothing could be decoded, the cell is crossed out
+            cv::Rect place(x, y, longEdge, longEdge);
+            cv::rectangle(sheet, place, cv::Scalar(90, 90, 90), 1);
+            cv::line(sheet, place.tl(), place.br(), cv::Scalar(90, 90, 90), 1);
+            cv::line(sheet, cv::Point(place.x + place.width, place.y), cv::Point(place.x, place.y + place.height),
+                     cv::Scalar(90, 90, 90), 1);
+        } else {
+            if (thumbnail.channels() == 1) cv::cvtColor(thumbnail, thumbnail, cv::COLOR_GRAY2BGR);
+            else if (thumbnail.channels() == 4) cv::cvtColor(thumbnail, thumbnail, cv::COLOR_BGRA2BGR);
+            double scale = (double) longEdge / std::max(thumbnail.cols, thumbnail.rows);
+            if (scale < 1) cv::resize(thumbnail, thumbnail, cv::Size(), scale, scale, cv::INTER_AREA);
+            // centered in its cell
+            Mat place = sheet(cv::Rect(x + (longEdge - thumbnail.cols) / 2, y + (longEdge - thumbnail.rows) / 2,
+                                       thumbnail.cols, thumbnail.rows));
+            thumbnail.copyTo(place);
+        }
+        cv::putText(sheet, std::to_string(first + i), cv::Point(x, y + longEdge + label - 4),
+                    cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(230, 230, 230), 1);
+    }
+    return sheet;
+}
+
+// an image kept on disk as a grid of tiles in a mapped file, for sources larger than memory; tiles are
+// decoded when they are needed into a cache of bounded size, so memory doesn't grow with the image
+class TiledImage {
 public:
-    Video(const string &name = "", double fps = 0.0, int blurAmount = 0, bool blackWhite = false,
-          bool cartoon = false, double brightness = 0, double contrast = 1, int hue = 0);
-    Video(const Video &obj);
-    ~Video();
-    Video &operator=(const Video &obj);
-    friend istream &operator>>(istream &in, Video &obj);
-    friend ostream &operator<<(ostream &out, const Video &obj);
+    static constexpr int tileSize = 512;
+    static size_t threshold; // sources that decode to more bytes than this are tiled, 0 never
+    static size_t cacheBytes; // decoded tiles kept in memory
+private:
+    typedef std::list<std::pair<int, Mat>> Cache;
+
+    RawFile file;
+    cv::Size size;
+    int type;
+    std::vector<size_t> offsets; // record of every tile, by rows of tiles
+    Cache cache; // most recently used first
+    std::map<int, Cache::iterator> cached;
+    size_t cachedBytes;
+    std::mutex mutex;
+
+    Mat tile(int index);
+    // the plan on one tile, computed with a halo around it as wide as the plan reaches
+    Mat renderTile(const Plan &plan, int halo, const cv::Rect &rect);
+    static bool writeTiles(std::ofstream &out, const Mat &strip);
+public:
+    TiledImage() : type(0), cachedBytes(0) {}
+    TiledImage(const TiledImage &) = delete;
+
+    bool open(const string &path);
+    cv::Size getSize() const { return size; }
+    int tilesX() const { return (size.width + tileSize - 1) / tileSize; }
+    int tilesY() const { return (size.height + tileSize - 1) / tileSize; }
+    // pixels of a region inside the image, copied out of the tiles it touches
+    Mat read(const cv::Rect &region);
+    // the plan on the rows of region that fall in strip index, strips are one tile high
+    Mat renderStrip(const Plan &plan, const cv::Rect &region, int index);
+    // renders region through plan into path one strip at a time; png is streamed, other formats
+    // are put together in memory first
+    bool write(const string &path, const Plan &plan, const cv::Rect &region, const std::vector<int> &params);
+
+    // true when the header of source says it is above the threshold
+    static bool large(const string &source);
+    // tiles source into the tile directory once per version of its contents and returns the tiled file,
+    // png files are converted a strip at a time
+    static string convert(const string &source);
+};
 
-    bool operator<(const Video& obj) const {
-        return this->id <= obj.id;
+size_t TiledImage::threshold = 256ull * 1024 * 1024;
+size_t TiledImage::cacheBytes = 256ull * 1024 * 1024;
+
+bool TiledImage::open(const string &path) {
+    if (!file.open(path)) return false;
+    offsets = file.records();
+    // the first record holds rows, cols and type
+    if (offsets.empty()) return false;
+    Mat info = file.frame(offsets[0], true);
+    if (info.total() != 3 || info.type() != CV_32S) return false;
+    const int *values = info.ptr<int>();
+    size = cv::Size(values[1], values[0]);
+    type = values[2];
+    offsets.erase(offsets.begin());
+    return (int) offsets.size() == tilesX() * tilesY();
+}
+
+Mat TiledImage::tile(int index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cached.find(index);
+        if (it != cached.end()) {
+            cache.splice(cache.begin(), cache, it->second);
+            return it->second->second;
+        }
     }
-    bool operator==(const Video& obj) const {
-        return (this->id == obj.id);
+    // decoded outside the lock, two threads asking for the same tile just both decode it
+    Mat decoded = file.frame(offsets[index], true);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cached.find(index) == cached.end()) {
+        cache.emplace_front(index, decoded);
+        cached[index] = cache.begin();
+        cachedBytes += decoded.total() * decoded.elemSize();
+    }
+    // tiles still in use by a caller stay alive through their Mat, only the cache forgets them
+    while (cachedBytes > cacheBytes && cache.size() > 1) {
+        cachedBytes -= cache.back().second.total() * cache.back().second.elemSize();
+        cached.erase(cache.back().first);
+        cache.pop_back();
     }
+    return decoded;
+}
 
-//    methods
+Mat TiledImage::read(const cv::Rect &region) {
+    Mat pixels(region.size(), type);
+    int x0 = region.x / tileSize, x1 = (region.x + region.width - 1) / tileSize;
+    int y0 = region.y / tileSize, y1 = (region.y + region.height - 1) / tileSize;
+    for (int ty = y0; ty <= y1; ty++)
+        for (int tx = x0; tx <= x1; tx++) {
+            cv::Rect bounds(tx * tileSize, ty * tileSize, tileSize, tileSize);
+            cv::Rect part = bounds & region;
+            Mat source = this->tile(ty * tilesX() + tx), target = pixels(part - region.tl());
+            source(part - bounds.tl()).copyTo(target);
+        }
+    return pixels;
+}
+
+Mat TiledImage::renderTile(const Plan &plan, int halo, const cv::Rect &rect) {
+    // limited ops only write inside their regions, tiles none of them reaches are the source
+    if (plan.local() && !plan.touches(rect)) return this->read(rect);
+    // clipped to the image, so at its borders the filters see the same edge they would on the whole image
+    cv::Rect input = cv::Rect(rect.x - halo, rect.y - halo, rect.width + 2 * halo, rect.height + 2 * halo) &
+                     cv::Rect(0, 0, size.width, size.height);
+    Mat pixels = this->read(input);
+    plan.runAt(pixels, input.tl());
+    return pixels(rect - input.tl());
+}
+
+Mat TiledImage::renderStrip(const Plan &plan, const cv::Rect &region, int index) {
+    int halo = 0;
+    for (const Op &op: plan.getSteps()) halo += op.radius();
+    int top = region.y + index * tileSize, bottom = std::min(region.y + region.height, top + tileSize);
+    int columns = (region.width + tileSize - 1) / tileSize;
+
+    std::vector<Mat> tiles(columns);
+    cv::parallel_for_(cv::Range(0, columns), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            int left = region.x + i * tileSize;
+            cv::Rect rect(left, top, std::min(tileSize, region.x + region.width - left), bottom - top);
+            tiles[i] = this->renderTile(plan, halo, rect);
+        }
+    });
+    // the plan decides the type, black and white has one channel
+    Mat strip(bottom - top, region.width, tiles[0].type());
+    for (int i = 0; i < columns; i++) {
+        Mat target = strip(cv::Rect(i * tileSize, 0, tiles[i].cols, tiles[i].rows));
+        tiles[i].copyTo(target);
+    }
+    return strip;
+}
+
+bool TiledImage::write(const string &path, const Plan &plan, const cv::Rect &region, const std::vector<int> &params) {
+    int strips = (region.height + tileSize - 1) / tileSize;
+    size_t dot = path.find_last_of('.');
+    string extension = dot == string::npos ? "" : path.substr(dot);
+#ifdef HAVE_ZLIB
+    if (extension == ".png") {
+        // strips are rendered as the writer asks for rows, the ones it is done with are dropped
+        std::map<int, Mat> strips;
+        auto strip = [&](int index) -> Mat & {
+            auto it = strips.find(index);
+            if (it == strips.end()) it = strips.emplace(index, this->renderStrip(plan, region, index)).first;
+            return it->second;
+        };
+        int type = strip(0).type();
+        ParallelPng::RowSource rows = [&](int first, int last) {
+            while (!strips.empty() && (strips.begin()->first + 1) * tileSize <= first) strips.erase(strips.begin());
+            std::vector<Mat> parts;
+            for (int index = first / tileSize; index * tileSize < last; index++) {
+                Mat &rendered = strip(index);
+                int from = std::max(first - index * tileSize, 0), to = std::min(last - index * tileSize, rendered.rows);
+                parts.push_back(rendered.rowRange(from, to));
+            }
+            Mat joined;
+            if (parts.size() == 1) joined = parts[0];
+            else cv::vconcat(parts, joined);
+            return joined;
+        };
+        int level, strategy;
+        pngParams(params, level, strategy);
+        std::ofstream out(path, std::ios_base::binary);
+        return ParallelPng::write(region.size(), type, rows, level, strategy, [&out](const uchar *data, size_t size) {
+            out.write((const char *) data, size);
+            return (bool) out;
+        });
+    }
+#endif
+    cout << "~ NO STREAMING ENCODER FOR " << extension << ", THE OUTPUT IS PUT TOGETHER IN MEMORY\n";
+    std::vector<Mat> parts;
+    for (int index = 0; index < strips; index++) parts.push_back(this->renderStrip(plan, region, index));
+    Mat whole;
+    cv::vconcat(parts, whole);
+    return writeImage(path, whole, params);
+}
+
+bool TiledImage::large(const string &source) {
+    if (threshold == 0) return false;
+    cv::Size size = ThumbnailService::headerSize(source);
+    return (size_t) size.area() * 3 > threshold;
+}
+
+bool TiledImage::writeTiles(std::ofstream &out, const Mat &strip) {
+    std::vector<uchar> record;
+    for (int x = 0; x < strip.cols; x += tileSize) {
+        record.clear();
+        RawImage::encode(strip(cv::Rect(x, 0, std::min(tileSize, strip.cols - x), strip.rows)), record, RawImage::LZ4);
+        out.write((const char *) record.data(), record.size());
+    }
+    return (bool) out;
+}
+
+string TiledImage::convert(const string &source) {
+    uint64_t hash = RenderCache::sourceHash(source);
+    if (hash == 0) return "";
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.tiles", (unsigned long long) hash);
+    string path = string("../.tiles/") + name;
+    std::error_code error;
+    if (std::filesystem::exists(path, error)) return path;
+    std::filesystem::create_directories("../.tiles/", error);
+
+    std::ofstream out(path + ".tmp", std::ios_base::binary);
+    auto writeInfo = [&out](cv::Size size) {
+        Mat info(1, 3, CV_32S);
+        int *values = info.ptr<int>();
+        values[0] = size.height, values[1] = size.width, values[2] = CV_8UC3;
+        std::vector<uchar> record;
+        RawImage::encode(info, record, RawImage::STORED);
+        out.write((const char *) record.data(), record.size());
+    };
+    bool ok = false;
+#ifdef HAVE_ZLIB
+    PngReader reader;
+    if (reader.open(source)) {
+        writeInfo(reader.getSize());
+        Mat strip;
+        ok = true;
+        for (int y = 0; ok && y < reader.getSize().height; y += tileSize)
+            ok = reader.read(tileSize, strip) && writeTiles(out, strip);
+    } else
+#endif
+    {
+        // without a streaming decoder the source is decoded whole this once
+        Mat whole = imread(source, IMREAD_COLOR);
+        if (!whole.empty()) {
+            writeInfo(whole.size());
+            ok = true;
+            for (int y = 0; ok && y < whole.rows; y += tileSize)
+                ok = writeTiles(out, whole.rowRange(y, std::min(whole.rows, y + tileSize)));
+        }
+    }
+    out.close();
+    if (ok) std::filesystem::rename(path + ".tmp", path, error);
+    if (!ok || error) {
+        std::filesystem::remove(path + ".tmp", error);
+        return "";
+    }
+    return path;
+}
+
+// one output of an export job
+struct Rendition {
+    string format; // extension with the dot, like ".jpg"
+    int quality; // jpeg and webp 0-100, png compression level 0-9, -1 keeps the encoder settings
+    int width; // 0 keeps the width of the edit
+    string directory;
+
+    std::vector<int> encoderParams() const;
+    // recipe part of the render cache key
+    string describe() const;
+};
+
+std::vector<int> Rendition::encoderParams() const {
+    // the rest of the settings come from the command line
+    EncoderSettings settings = encoderSettings;
+    if (quality >= 0) {
+        if (format == ".jpg" || format == ".jpeg") settings.jpegQuality = quality;
+        else if (format == ".png") settings.pngLevel = quality;
+        else if (format == ".webp") settings.webpQuality = quality;
+    }
+    return settings.params(format);
+}
+
+string Rendition::describe() const {
+    return "rendition width=" + std::to_string(width) + " quality=" + std::to_string(quality);
+}
+
+// where an operation applies, in the coordinates of the source
+struct Region {
+    cv::Rect rect; // empty for the whole frame
+    string mask; // grayscale image the size of the source, nonzero where the operation applies
+    bool empty() const { return rect.area() <= 0 && mask.empty(); }
+};
+
+// the regions the operations of a file are limited to, by operation name
+class Regions {
+private:
+    std::map<string, Region> regions;
+public:
+    // an empty region makes the operation apply to the whole frame again
+    void set(const string &operation, const Region &region);
+    // op limited to the region of operation, a mask that isn't the size of the frame is left out
+    Op limit(Op op, const string &operation, cv::Size frame) const;
+    // follows a crop to area of a frame of size before, scaled to after; masks are kept as the
+    // rectangle around them, they are files the size of the source
+    void reframe(const cv::Rect &area, cv::Size before, cv::Size after);
+    // part of the recipe, masks by the hash of their contents
+    string describe() const;
+    // marked with #, so files from before regions still load
+    void serialize(ostream &out) const;
+    void deserialize(istream &in);
+    void print(ostream &out) const;
+};
+
+void Regions::set(const string &operation, const Region &region) {
+    if (region.empty()) regions.erase(operation);
+    else regions[operation] = region;
+}
+
+Op Regions::limit(Op op, const string &operation, cv::Size frame) const {
+    auto it = regions.find(operation);
+    if (it == regions.end()) return op;
+    op.roi = it->second.rect;
+    if (!it->second.mask.empty()) {
+        Mat mask = cv::imread(it->second.mask, cv::IMREAD_GRAYSCALE);
+        if (mask.empty() || (frame.area() > 0 && mask.size() != frame))
+            cout << "~ MASK " << it->second.mask << " DOESN'T MATCH THE IMAGE, ONLY THE RECTANGLE IS USED\n";
+        else op.mask = mask;
+    }
+    return op;
+}
+
+void Regions::reframe(const cv::Rect &area, cv::Size before, cv::Size after) {
+    if (area.area() <= 0) return;
+    double scaleX = (double) after.width / area.width, scaleY = (double) after.height / area.height;
+    for (auto it = regions.begin(); it != regions.end();) {
+        Region &region = it->second;
+        cv::Rect rect = region.rect.area() > 0 ? region.rect : cv::Rect(0, 0, before.width, before.height);
+        if (!region.mask.empty()) {
+            Mat mask = cv::imread(region.mask, cv::IMREAD_GRAYSCALE);
+            if (!mask.empty() && mask.size() == before) rect &= cv::boundingRect(mask);
+            cout << "~ MASK OF " << it->first << " DOESN'T FIT THE NEW SIZE, THE RECTANGLE AROUND IT IS KEPT\n";
+            region.mask.clear();
+        }
+        rect &= area;
+        rect = cv::Rect(cvRound((rect.x - area.x) * scaleX), cvRound((rect.y - area.y) * scaleY),
+                        cvRound(rect.width * scaleX), cvRound(rect.height * scaleY)) &
+               cv::Rect(0, 0, after.width, after.height);
+        if (rect.area() <= 0) {
+            cout << "~ REGION OF " << it->first << " WAS CROPPED AWAY, IT APPLIES TO THE WHOLE IMAGE AGAIN\n";
+            it = regions.erase(it);
+            continue;
+        }
+        region.rect = rect;
+        ++it;
+    }
+}
+
+string Regions::describe() const {
+    string description;
+    for (const auto &entry: regions) {
+        const cv::Rect &rect = entry.second.rect;
+        description += entry.first + "=" + std::to_string(rect.x) + "," + std::to_string(rect.y) + "," +
+                       std::to_string(rect.width) + "," + std::to_string(rect.height);
+        if (!entry.second.mask.empty())
+            description += "," + std::to_string(RenderCache::sourceHash(entry.second.mask));
+        description += " ";
+    }
+    return description;
+}
+
+void Regions::serialize(ostream &out) const {
+    if (regions.empty()) return;
+    out << "# " << regions.size() << " ";
+    for (const auto &entry: regions) {
+        const cv::Rect &rect = entry.second.rect;
+        out << entry.first << " " << rect.x << " " << rect.y << " " << rect.width << " " << rect.height << " "
+            << std::quoted(entry.second.mask) << " ";
+    }
+}
+
+void Regions::deserialize(istream &in) {
+    regions.clear();
+    if ((in >> std::ws).peek() != '#') return;
+    in.get();
+    size_t count = 0;
+    in >> count;
+    for (size_t i = 0; i < count && in; i++) {
+        string operation;
+        Region region;
+        in >> operation >> region.rect.x >> region.rect.y >> region.rect.width >> region.rect.height
+           >> std::quoted(region.mask);
+        this->set(operation, region);
+    }
+}
+
+void Regions::print(ostream &out) const {
+    for (const auto &entry: regions) {
+        const cv::Rect &rect = entry.second.rect;
+        out << "Region of " << entry.first << ":";
+        if (rect.area() > 0) out << " " << rect.width << "x" << rect.height << " at " << rect.x << "," << rect.y;
+        if (!entry.second.mask.empty()) out << " masked by " << entry.second.mask;
+        out << endl;
+    }
+}
+
+// copy on write: copies of a file share their pixel buffers, and a buffer is cloned right before it
+// changes if another Mat still holds it; external data, like a mapped file, is never written either
+void detachPixels(Mat &pixels) {
+    if (!pixels.empty() && (pixels.u == NULL || pixels.u->refcount > 1)) pixels = pixels.clone();
+}
+
+class Interface {
+public:
+    virtual void applyAll() = 0;
+    // the encoding runs on the encoder pool, the future tells when the file is written
+    virtual std::shared_future<bool> write() const = 0;
+    virtual istream &read(istream &in) = 0;
+    virtual ostream &print(ostream &out) const = 0;
+    virtual void serialize(ostream&) const = 0;
+    virtual void deserialize(istream&) = 0;
+};
+
+class Image : public Interface {
+protected:
+    // boolean for image finding
+    bool absolute;
+    string name, path;
+    Mat img;
+    string recipe; // edits applied since the last scan, part of the render cache key
+    // rendition: region kept and output width, 0 keeps the width
+    cv::Rect crop;
+    int width;
+    // out of core: the source as tiles on disk and the operations applied since the scan, which run
+    // tile by tile when the image is written
+    std::shared_ptr<TiledImage> tiled;
+    std::vector<Op> pending;
+    Regions regions;
+
+    string sourcePath() const;
+    // encodes img to full_path on the encoder pool, served from the render cache when the same render
+    // was written before
+    std::shared_future<bool> writeRendered(const string &full_path) const;
+    std::shared_future<bool> writeTiled(const string &full_path) const;
+    uint64_t renderKey(const string &extension) const;
+    // appends the configured operations, plain images have none; the file isn't changed, so
+    // exports can build them too
+    virtual void addOps(std::vector<Op> &ops) const {}
+    // appends the crop and the resize, last so the planner decides how early they can run
+    void addGeometry(std::vector<Op> &ops) const;
+    // op limited to the region set for operation
+    Op limited(const Op &op, const string &operation) const;
+    string geometry() const;
+    // plans the operations and runs them on img
+    void runOps(const std::vector<Op> &ops);
+public:
+    Image(string name = "cat.png", string path = "../Images/", bool absolute = false);
+    // copies share the pixels until one of them changes
+    Image(const Image &obj);
+    Image(Image &&obj) noexcept;
+    Image &operator=(const Image &obj);
+    Image &operator=(Image &&obj) noexcept;
+    // virtual to call derivative destructors
+    virtual ~Image();
+    // a copy of the most derived type
+    virtual std::unique_ptr<Image> clone() const { return std::make_unique<Image>(*this); }
+
+    istream &read(istream &in);
+    ostream &print(ostream &out) const;
+    friend istream &operator>>(istream &in, Image &obj);
+    friend ostream &operator<<(ostream &out, const Image &obj);
+
+    string extension(string word) const;
+    string withoutExtension(string word) const;
     void scan();
-    void write() const;
     void show() const;
+    void show(const Mat &img) const;
+    // shows the pixels the current settings would give, on a copy
+    void preview() const;
+    std::shared_future<bool> write() const;
+    void saveShow() const;
     void applyAll();
-    void blur();
-    void bw();
-    void cartoon_effect();
-    void brightness_adjustment();
-    void contrast_adjustment();
-    void hue_adjustment();
-
-//    setters
-    void setBlurAmount(int blurAmount);
-    void setBlackWhite(bool blackWhite);
-    void setCartoon(bool cartoon);
-    void setBrightness(double brightness);
-    void setContrast(double contrast);
-    void setHue(int hue);
+    string getName() const;
+    string getPath() const;
+    // pixels as a list of frames, used by the version history
+    std::vector<Mat> getFrames() const { return {img}; }
+    void setFrames(const std::vector<Mat> &frames) { if (!frames.empty()) img = frames[0]; }
+    // frees the pixels, scan() or setFrames() bring them back
+    void release() { img.release(); }
+    bool isResident() const { return !img.empty() || tiled; }
+    bool hasSource() const { return true; }
+    string getRecipe() const { return recipe; }
+    void setRecipe(const string &recipe) { this->recipe = recipe; }
+    cv::Rect getCrop() const { return crop; }
+    void setCrop(const cv::Rect &crop) { this->crop = crop; }
+    int getWidth() const { return width; }
+    void setWidth(int width) { this->width = width; }
+    void setRegion(const string &operation, const Region &region) { regions.set(operation, region); }
+    // true when write() would be served from the render cache
+    virtual bool isCached() const { return false; }
+    // preview of the source file, decoded on the thumbnail service
+    std::shared_future<Mat> thumbnail(bool urgent = true) const {
+        return ThumbnailService::getInstance()->request(this->sourcePath(), urgent);
+    }
+    // renders the pixels write() encodes in every rendition, with the settings on top while nothing is
+    // applied yet; the steps the renditions have in common run once, and the rest runs for all of them
+    // in parallel
+    void exportRenditions(const std::vector<Rendition> &renditions);
 
-    string getType(){return typeid(*this).name();}
-    void serialize(string) const;
-    void deserialize(std::ifstream&);
+    bool operator<(const Image& obj) const {
+        return !(this->name > obj.name);
+    }
+    bool operator==(const Image& obj) const {
+        return this->name == obj.name;
+    }
+    virtual void serialize(ostream&) const;
+    virtual void deserialize(istream&);
 };
 
-void Video::serialize(string fileName) const {
-    std::ofstream out(fileName, std::ios_base::app);
+void Image::serialize(ostream& out) const {
+    out<<name<<" "<<path<<" "<<absolute<<" ";
+    // marked so project files from before renditions still load
+    out<<"@ "<<crop.x<<" "<<crop.y<<" "<<crop.width<<" "<<crop.height<<" "<<width<<" ";
+    regions.serialize(out);
+}
 
-    out<<name<<" "<<blurAmount<<" "<<blackWhite<<" "<<cartoon<<" "<<brightness<<" "<<contrast<<" "<<hue;
+void Image::deserialize(istream& in) {
+    string name,path;
+    bool absolute;
+    in>>name>>path>>absolute;
+    this->name = name;
+    this->path = path;
+    this->absolute = absolute;
+    this->crop = cv::Rect();
+    this->width = 0;
+    if ((in >> std::ws).peek() == '@') {
+        in.get();
+        in>>crop.x>>crop.y>>crop.width>>crop.height>>width;
+    }
+    regions.deserialize(in);
 
-    out.close();
+    this->scan();
 }
 
-void Video::deserialize(std::ifstream& in) {
-    string name;
-    bool blackWhite,cartoon;
-    int blurAmount,hue;
-    double brightness, contrast;
-
-    in>>name>>blurAmount>>blackWhite>>cartoon>>brightness>>contrast>>hue;
+Image::Image(string name, string path, bool absolute) {
     this->name = name;
-    this->blurAmount = blurAmount;
-    this->blackWhite = blackWhite;
-    this->cartoon = cartoon;
-    this->brightness = brightness;
-    this->contrast = contrast;
-    this->hue = hue;
+    this->path = path;
+    this->absolute = absolute;
+    this->width = 0;
 }
 
-int Video::counter = 0;
+Image::Image(const Image &obj) {
+    this->name = obj.name;
+    this->path = obj.path;
+    this->absolute = obj.absolute;
+    this->img = obj.img;
+    this->recipe = obj.recipe;
+    this->crop = obj.crop;
+    this->width = obj.width;
+    this->tiled = obj.tiled;
+    this->pending = obj.pending;
+    this->regions = obj.regions;
+}
 
-Video::Video(const string &name, double fps, int blurAmount, bool blackWhite,
-             bool cartoon, double brightness, double contrast, int hue) : id(counter++) {
-    if (name.empty()) {
-        this->name = "video" + std::to_string(id);
-        this->name += ".mp4";
+Image &Image::operator=(const Image &obj) {
+    if (this != &obj) {
+        if (!this->name.empty()) this->name.clear();
+        this->name = obj.name;
+        if (!this->path.empty()) this->path.clear();
+        this->path = obj.path;
+        this->absolute = obj.absolute;
+        this->img = obj.img;
+        this->recipe = obj.recipe;
+        this->crop = obj.crop;
+        this->width = obj.width;
+        this->tiled = obj.tiled;
+        this->pending = obj.pending;
+        this->regions = obj.regions;
     }
-    else this->name = name;
-    this->fps = fps;
-    this->blurAmount = blurAmount;
-    this->hue = hue;
-    this->blackWhite = blackWhite;
-    this->cartoon = cartoon;
-    this->brightness = brightness;
-    this->contrast = contrast;
-//    to open the laptop camera
-    this->capture.open(0);
+    return *this;
+}
+
+Image::Image(Image &&obj) noexcept : absolute(obj.absolute), name(std::move(obj.name)), path(std::move(obj.path)),
+                                     img(std::move(obj.img)), recipe(std::move(obj.recipe)), crop(obj.crop),
+                                     width(obj.width), tiled(std::move(obj.tiled)), pending(std::move(obj.pending)),
+                                     regions(std::move(obj.regions)) {}
+
+Image &Image::operator=(Image &&obj) noexcept {
+    if (this != &obj) {
+        this->absolute = obj.absolute;
+        this->name = std::move(obj.name);
+        this->path = std::move(obj.path);
+        this->img = std::move(obj.img);
+        this->recipe = std::move(obj.recipe);
+        this->crop = obj.crop;
+        this->width = obj.width;
+        this->tiled = std::move(obj.tiled);
+        this->pending = std::move(obj.pending);
+        this->regions = std::move(obj.regions);
+    }
+    return *this;
+}
+
+istream &Image::read(istream &in) {
+    if (!this->name.empty()) this->name.clear();
+    if (!this->path.empty()) this->path.clear();
+    cout << "Enter name: \n";
+    in >> this->name;
+    cout << "Do you want to use relative path? (1:yes 0:no)?\n";
+    int temp;
+    cin >> temp;
+    in.get();
+    if (temp == 0) {
+        this->absolute = true;
+        cout << "Enter path to image: \n";
+        // to get \n from buffer
+
+        getline(in, this->path);
+        // deleting "" from path
+        if (this->path[0] == '"') this->path.erase(0, 1), this->path.pop_back();
+    } else this->path = "../Images/";
+
+    return in;
+}
+
+ostream &Image::print(ostream &out) const {
+    out << "Name: " << this->name << endl;
+    if (this->absolute == false) out << "Path to image: " << this->path + this->name << endl;
+    else out << "Path to image: " << this->path << endl;
+    if (this->crop.area() > 0)
+        out << "Crop: " << this->crop.width << "x" << this->crop.height << " at " << this->crop.x << "," << this->crop.y
+            << endl;
+    if (this->width > 0) out << "Output width: " << this->width << endl;
+    regions.print(out);
+    if (this->tiled)
+        out << "Out of core: " << tiled->getSize().width << "x" << tiled->getSize().height << " in "
+            << tiled->tilesX() * tiled->tilesY() << " tiles" << endl;
+
+    return out;
+}
+
+istream &operator>>(istream &in, Image &obj) {
+    return obj.read(in);
+}
+
+ostream &operator<<(ostream &out, const Image &obj) {
+    return obj.print(out);
+}
+
+Image::~Image() {
+    if (!this->name.empty()) this->name.clear();
+    if (!this->path.empty()) this->path.clear();
+    this->absolute = false;
+}
+
+string Image::extension(string word) const {
+    return word.substr(word.find('.'), word.length());
+}
+
+string Image::withoutExtension(string word) const {
+    return word.substr(0, word.find('.'));
+}
+
+void Image::scan() {
+    string image_path;
+    try {
+        if (this->absolute == false) {
+            string full_name = this->path + this->name;
+            // silent mode true to suppress errors
+            image_path = findFile(full_name, true, true);
+        } else image_path = findFile(this->path, true, true);
+
+        pending.clear();
+        tiled.reset();
+        if (TiledImage::large(image_path)) {
+            std::shared_ptr<TiledImage> source = std::make_shared<TiledImage>();
+            string tiles = TiledImage::convert(image_path);
+            if (!tiles.empty() && source->open(tiles)) {
+                tiled = source;
+                img.release();
+                recipe.clear();
+                cout << "~ OUT OF CORE: " << tiled->getSize().width << "x" << tiled->getSize().height << " IN "
+                     << tiled->tilesX() * tiled->tilesY() << " TILES\n";
+                return;
+            }
+        }
+
+        // a new buffer, the old one may still be shared with copies and queued writes
+        img = imread(image_path, IMREAD_COLOR);
+        recipe.clear();
+    }
+    catch (...) { cout << "~ INVALID PATH\n"; }
+    // CV_8UC3 = 8 bit unsigned integer with 3 channels (RGB)
+}
+
+string Image::sourcePath() const {
+    if (this->absolute == false) return this->path + this->name;
+    return this->path;
+}
+
+uint64_t Image::renderKey(const string &extension) const {
+    uint64_t source = RenderCache::sourceHash(this->sourcePath());
+    // 0 means the source couldn't be read, such renders aren't cached
+    if (source == 0) return 0;
+    return RenderCache::key(source, recipe, extension);
+}
+
+std::shared_future<bool> Image::writeTiled(const string &full_path) const {
+    if (this->width > 0) cout << "~ OUTPUT WIDTH IS IGNORED OUT OF CORE\n";
+    std::shared_ptr<TiledImage> source = tiled;
+    cv::Rect region(0, 0, source->getSize().width, source->getSize().height);
+    if ((this->crop & region).area() > 0) region &= this->crop;
+    Plan plan = Planner::plan(pending, region.size());
+    if (Planner::explain) plan.explain(cout);
+    std::vector<int> params = encoderSettings.params(this->extension(this->name));
+    return EncoderPool::getInstance()->submit([source, plan, region, full_path, params]() {
+        bool ok = false;
+        try {
+            ok = source->write(full_path, plan, region, params);
+        }
+        catch (...) {}
+        if (!ok) cout << "~ WRITING " << full_path << " FAILED\n";
+        return ok;
+    });
+}
+
+std::shared_future<bool> Image::writeRendered(const string &full_path) const {
+    if (tiled) return this->writeTiled(full_path);
+    string extension = this->extension(this->name);
+    uint64_t key = this->renderKey(extension);
+    // the encoder shares the buffer, an edit while the write waits in the queue detaches img first
+    Mat pixels = img;
+    return EncoderPool::getInstance()->submit([key, extension, full_path, pixels]() {
+        std::vector<int> params = encoderSettings.params(extension);
+        bool ok = false;
+        try {
+            if (key == 0) ok = !pixels.empty() && writeImage(full_path, pixels, params);
+            else
+                ok = RenderCache::getInstance()->write(key, extension, full_path, [&](std::vector<uchar> &buffer) {
+                    return !pixels.empty() && encodeImage(extension, pixels, buffer, params);
+                });
+        }
+        catch (...) {}
+        if (!ok) cout << "~ WRITING " << full_path << " FAILED\n";
+        return ok;
+    });
+}
+
+void Image::preview() const {
+    // the copy shares the pixels until its applyAll changes them
+    std::unique_ptr<Image> copy = this->clone();
+    copy->applyAll();
+    copy->show();
+}
+
+void Image::show() const {
+    if (tiled) {
+        // a screen sized decode with the pending operations, the filters reach further than they
+        // will on the full image, but the tiles are only worth reading when writing
+        try {
+            Mat preview = ThumbnailService::decodeReduced(findFile(this->sourcePath(), true, true), 1080);
+            Planner::plan(pending, preview.size()).run(preview);
+            this->show(preview);
+        }
+        catch (...) { cout << "~ OUTPUT FAILED\n"; }
+        return;
+    }
+    try {
+//        Mat img = this->scan();
+        cv::namedWindow("Image", cv::WINDOW_NORMAL);
+//        using this function makes the window not have a title bar
+//        cv::setWindowProperty("Image",cv::WND_PROP_FULLSCREEN, cv::WINDOW_FULLSCREEN);
+        double aspect_ratio = static_cast<double>(img.cols) / img.rows;
+        cv::resizeWindow("Image", static_cast<int>(540 * aspect_ratio), 540);
+        imshow("Image", img);
+
+//        Wait for a keystroke in the window
+        int k = waitKey(0);
+//        27 is ascii code for esc and waitKey returns an int
+        if (k == 27) {
+            cv::destroyAllWindows();
+            return;
+        }
+    }
+    catch (...) { cout << "~ OUTPUT FAILED\n"; }
+}
+
+void Image::show(const Mat &img) const {
+    try {
+        cv::namedWindow("Image", cv::WINDOW_NORMAL);
+//        using this function makes the window not have a title bar
+//        cv::setWindowProperty("Image",cv::WND_PROP_FULLSCREEN, cv::WINDOW_FULLSCREEN);
+        double aspect_ratio = static_cast<double>(img.cols) / img.rows;
+        cv::resizeWindow("Image", static_cast<int>(540 * aspect_ratio), 540);
+        imshow("Image", img);
+
+//        Wait for a keystroke in the window
+        int k = waitKey(0);
+//        27 is ascii code for esc and waitKey returns an int
+        if (k == 27) {
+            cv::destroyAllWindows();
+            return;
+        }
+    }
+    catch (...) { cout << "~ OUTPUT FAILED\n"; }
+}
+
+std::shared_future<bool> Image::write() const {
+    // basically does nothing because there is nothing applied to that image
+//        Mat img = this->scan();
+    string full_path = this->path + this->name;
+    if (tiled) return this->writeTiled(full_path);
+    std::vector<int> params = encoderSettings.params(this->extension(this->name));
+    Mat pixels = img;
+    return EncoderPool::getInstance()->submit([full_path, params, pixels]() {
+        try {
+            return writeImage(full_path, pixels, params);
+        }
+        catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
+        return false;
+    });
+}
+
+void Image::saveShow() const {
+    cout << "Show image on screen (yes:1 no:0)?\n";
+    int temp;
+    cin >> temp;
+    cin.get();
+    if (temp == 1) this->show();
+
+    cout << "Save image (yes:1 no:0)?\n";
+    cin >> temp;
+    cin.get();
+    if (temp == 1) this->write();
+}
+
+void Image::applyAll() {
+    cout << "~ NOTHING TO APPLY\n";
+}
+
+void Image::addGeometry(std::vector<Op> &ops) const {
+    if (this->crop.area() > 0) ops.push_back(Op::crop(this->crop));
+    if (this->width > 0) ops.push_back(Op::resize(this->width));
+}
+
+string Image::geometry() const {
+    // regions change where the pixels change, so they are part of it too
+    return "crop=" + std::to_string(crop.x) + "," + std::to_string(crop.y) + "," + std::to_string(crop.width) + "," +
+           std::to_string(crop.height) + " width=" + std::to_string(width) + " regions=" + regions.describe();
+}
+
+Op Image::limited(const Op &op, const string &operation) const {
+    cv::Size frame = tiled ? tiled->getSize() : img.size();
+    return regions.limit(op, operation, frame);
+}
+
+void Image::exportRenditions(const std::vector<Rendition> &renditions) {
+    if (tiled) {
+        cout << "~ RENDITIONS AREN'T AVAILABLE OUT OF CORE\n";
+        return;
+    }
+    // renditions start from the pixels write() encodes, the applied edits with their crop and width are in
+    // them already; until something is applied the settings are rendered on top, after an apply they are
+    // the ones applied, and the crop and the regions are in the coordinates of the new pixels
+    bool applied = !recipe.empty();
+    std::vector<Op> ops;
+    if (!applied) this->addOps(ops);
+    string edit = recipe;
+    for (const Op &op: ops) edit += op.describe() + ";";
+    if (!applied) edit += this->geometry() + ";";
+
+    struct Job {
+        const Rendition *rendition;
+        string path;
+        uint64_t key;
+        Plan plan;
+    };
+    RenderCache *cache = RenderCache::getInstance();
+    uint64_t source = RenderCache::sourceHash(this->sourcePath());
+    std::vector<Job> jobs;
+    size_t cached = 0;
+    for (const Rendition &rendition: renditions) {
+        std::error_code error;
+        std::filesystem::create_directories(rendition.directory, error);
+        string path = rendition.directory + this->withoutExtension(this->name) + "_" +
+                      (rendition.width > 0 ? std::to_string(rendition.width) : string("full")) + rendition.format;
+        uint64_t key = source == 0 ? 0 : RenderCache::key(source, edit + rendition.describe(), rendition.format);
+        // cached renders are copied without decoding anything
+        if (key != 0 && cache->contains(key, rendition.format) &&
+            cache->write(key, rendition.format, path, [](std::vector<uchar> &) { return false; })) {
+            cached++;
+            continue;
+        }
+        jobs.push_back(Job{&rendition, path, key, Plan()});
+    }
+
+    size_t shared = 0;
+    std::atomic<size_t> failed(0);
+    if (!jobs.empty()) {
+        Mat decoded = img;
+        if (decoded.empty()) {
+            cout << "~ NOTHING TO EXPORT\n";
+            return;
+        }
+        for (Job &job: jobs) {
+            std::vector<Op> steps = ops;
+            if (!applied && this->crop.area() > 0) steps.push_back(Op::crop(this->crop));
+            int width = job.rendition->width > 0 ? job.rendition->width : applied ? 0 : this->width;
+            if (width > 0) steps.push_back(Op::resize(width));
+            job.plan = Planner::plan(steps, decoded.size());
+            if (Planner::explain) job.plan.explain(cout);
+        }
+
+        // longest run of steps every plan starts with
+        shared = jobs[0].plan.size();
+        for (const Job &job: jobs) {
+            size_t same = 0;
+            const std::vector<Op> &a = jobs[0].plan.getSteps(), &b = job.plan.getSteps();
+            while (same < shared && same < b.size() && a[same].describe() == b[same].describe()) same++;
+            shared = same;
+        }
+        // the pixels are the image's own, the common steps run on a buffer of their own
+        if (shared > 0) detachPixels(decoded);
+        for (size_t i = 0; i < shared; i++) jobs[0].plan.getSteps()[i].run(decoded);
+
+        cv::parallel_for_(cv::Range(0, (int) jobs.size()), [&](const cv::Range &range) {
+            for (int i = range.start; i < range.end; i++) {
+                const Job &job = jobs[i];
+                auto encode = [&](std::vector<uchar> &buffer) {
+                    // the decoded pixels are shared, so a tail works on its own copy
+                    Mat frame = shared == job.plan.size() ? decoded : decoded.clone();
+                    job.plan.run(frame, shared);
+                    return encodeImage(job.rendition->format, frame, buffer, job.rendition->encoderParams());
+                };
+                bool ok = false;
+                try {
+                    if (job.key != 0) ok = cache->write(job.key, job.rendition->format, job.path, encode);
+                    else {
+                        std::vector<uchar> buffer;
+                        if (encode(buffer)) {
+                            std::ofstream out(job.path, std::ios_base::binary);
+                            ok = (bool) out.write((const char *) buffer.data(), buffer.size());
+                        }
+                    }
+                }
+                catch (...) {}
+                if (!ok) {
+                    cout << "~ WRITING " << job.path << " FAILED\n";
+                    failed++;
+                }
+            }
+        });
+    }
+    cout << "~ EXPORTED " << renditions.size() - failed << " RENDITIONS (" << cached << " FROM RENDER CACHE, "
+         << shared << " SHARED STEPS)";
+    if (failed > 0) cout << ", " << failed << " FAILED";
+    cout << "\n";
+}
+
+void Image::runOps(const std::vector<Op> &ops) {
+    if (tiled) {
+        // nothing is decoded, the crop is applied by only rendering its tiles
+        for (const Op &op: ops) if (!op.geometric()) pending.push_back(op);
+        return;
+    }
+    Plan plan = Planner::plan(ops, img.size());
+    if (Planner::explain) plan.explain(cout);
+    try {
+        cv::Size before = img.size();
+        detachPixels(img);
+        plan.run(img);
+        // the crop and the width are in the pixels now, the next apply would crop the crop,
+        // and the regions move with the pixels
+        cv::Rect area(0, 0, before.width, before.height);
+        if (crop.area() > 0 && (crop & area).area() > 0) area &= crop;
+        if (img.size() != before) regions.reframe(area, before, img.size());
+        crop = cv::Rect();
+        width = 0;
+    }
+    catch (...) { cout << "~ APPLYING CHANGES FAILED\n"; }
+}
+
+string Image::getName() const {
+    return name;
+}
+
+string Image::getPath() const {
+    return path;
+}
+
+class Effect : virtual public Image {
+protected:
+    int blurAmount;
+    bool effect, blackWhite, cartoon;
+
+    // appends the configured effects, in the order they used to run
+    void addOps(std::vector<Op> &ops) const;
+public:
+    Effect(string name = "cat.png", string path = "../Images/", bool absolute = false, bool effect = false,
+           int blurAmount = 0, bool blackWhite = false, bool cartoon = false);
+    Effect(const Effect &obj);
+    Effect(Effect &&obj) noexcept;
+    Effect &operator=(const Effect &obj);
+    Effect &operator=(Effect &&obj) noexcept;
+    std::unique_ptr<Image> clone() const { return std::make_unique<Effect>(*this); }
+
+    // override specifier ensures that the function is virtual and is overriding a virtual function from a base class
+    virtual ~Effect() override;
+    istream &read(istream &in);
+    ostream &print(ostream &out) const;
+
+    std::shared_future<bool> write() const;
+    bool isCached() const;
+    void applyAll();
+    string describe() const;
+    void setBlurAmount(int blurAmount);
+    void setBlackWhite(bool blackWhite);
+    void setCartoon(bool cartoon);
+
+    void serialize(ostream&) const;
+    void deserialize(istream&);
+};
+
+void Effect::serialize(ostream& out) const {
+    this->Image::serialize(out);
+
+    out<<effect<<" "<<blurAmount<<" "<<blackWhite<<" "<<cartoon<<" ";
+}
+
+void Effect::deserialize(istream& in) {
+    this->Image::deserialize(in);
+
+    bool effect,blackWhite,cartoon;
+    int blurAmount;
+
+    in>>effect>>blurAmount>>blackWhite>>cartoon;
+    this->effect = effect;
+    this->blurAmount = blurAmount;
+    this->blackWhite = blackWhite;
+    this->cartoon = cartoon;
+}
+
+Effect::Effect(string name, string path, bool absolute, bool effect, int blurAmount, bool blackWhite, bool cartoon) :
+        Image(name, path, absolute) {
+    this->effect = effect;
+    this->blurAmount = blurAmount;
+    this->blackWhite = blackWhite;
+    this->cartoon = cartoon;
+    this->scan();
+}
+
+Effect::Effect(const Effect &obj) : Image(obj) {
+    this->effect = obj.effect;
+    this->blurAmount = obj.blurAmount;
+    this->blackWhite = obj.blackWhite;
+    this->cartoon = obj.cartoon;
+}
+
+// the virtual base is only moved by the most derived class, Image(...) is skipped for Edited
+Effect::Effect(Effect &&obj) noexcept : Image(std::move(obj)) {
+    this->effect = obj.effect;
+    this->blurAmount = obj.blurAmount;
+    this->blackWhite = obj.blackWhite;
+    this->cartoon = obj.cartoon;
+}
+
+Effect &Effect::operator=(const Effect &obj) {
+    if (this != &obj) {
+        Image::operator=(obj);
+        this->effect = obj.effect;
+        this->blurAmount = obj.blurAmount;
+        this->blackWhite = obj.blackWhite;
+        this->cartoon = obj.cartoon;
+    }
+    return *this;
+}
+
+Effect &Effect::operator=(Effect &&obj) noexcept {
+    if (this != &obj) {
+        Image::operator=(std::move(obj));
+        this->effect = obj.effect;
+        this->blurAmount = obj.blurAmount;
+        this->blackWhite = obj.blackWhite;
+        this->cartoon = obj.cartoon;
+    }
+    return *this;
+}
+
+istream &Effect::read(istream &in) {
+    this->Image::read(in);
+    cout << "Are there effects applied on the image? (yes:1 no:0) \n";
+    in >> this->effect;
+    cout << "Do you want to blur the image? (yes:1 no:0)?\n";
+    int temp;
+    in >> temp;
+    in.get();
+    if (temp == 1) {
+        cout << "Enter blur amount: \n";
+        in >> this->blurAmount;
+    }
+    cout << "Do you want to apply Black and White effect to the image? (yes:1 no:0)?\n";
+    in >> this->blackWhite;
+    cout << "Do you want to apply Cartoon effect to the image? (yes:1 no:0)?\n";
+    in >> this->cartoon;
+    this->scan();
+
+    return in;
+}
+
+ostream &Effect::print(ostream &out) const {
+    this->Image::print(out);
+    if (this->effect == true) out << "Has effects applied\n";
+    else out << "Doesn't have effects applied\n";
+    out << "Blur amount: " << this->blurAmount << endl;
+    if (this->blackWhite == true) out << "Has Black and White effect applied\n";
+    else out << "Doesn't have Black and White effect applied\n";
+    if (this->cartoon) out << "Has Cartoon effect applied\n";
+    else out << "Doesn't have Cartoon effect applied\n";
+
+    return out;
+}
+
+Effect::~Effect() {
+    this->effect = false;
+    this->blurAmount = 0;
+}
+
+std::shared_future<bool> Effect::write() const {
+    try {
+        string full_path = "../Images with Effects/" + this->withoutExtension(this->name) + "_withEffects" +
+                           this->extension(this->name);
+        return this->writeRendered(full_path);
+    }
+    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
+    return EncoderPool::finished(false);
+}
+
+bool Effect::isCached() const {
+    string extension = this->extension(this->name);
+    uint64_t key = this->renderKey(extension);
+    return key != 0 && RenderCache::getInstance()->contains(key, extension);
+}
+
+string Effect::describe() const {
+    return "blur=" + std::to_string(blurAmount) + " bw=" + std::to_string(blackWhite) + " cartoon=" +
+           std::to_string(cartoon);
+}
+
+void Effect::addOps(std::vector<Op> &ops) const {
+    if (this->blurAmount > 0) {
+        // cv::GaussianBlur doesnt work with widths and heigths that are even, or 0,0
+        int amount = this->blurAmount % 2 == 0 ? this->blurAmount + 1 : this->blurAmount;
+        ops.push_back(this->limited(Op::blur(amount), "blur"));
+    }
+    if (this->blackWhite == true) ops.push_back(this->limited(Op::bw(), "bw"));
+    if (this->cartoon == true) ops.push_back(this->limited(Op::cartoon(), "cartoon"));
+}
+
+void Effect::applyAll() {
+    recipe += "effect " + this->describe() + " " + this->geometry() + ";";
+    std::vector<Op> ops;
+    this->addOps(ops);
+    if (!ops.empty()) this->effect = true;
+    this->addGeometry(ops);
+    this->runOps(ops);
+}
+
+void Effect::setBlurAmount(int blurAmount) {
+    this->blurAmount = blurAmount;
+}
+
+void Effect::setBlackWhite(bool blackWhite) {
+    this->blackWhite = blackWhite;
+}
+
+void Effect::setCartoon(bool cartoon) {
+    this->cartoon = cartoon;
+}
+
+class Adjustment : virtual public Image {
+protected:
+    double brightness, contrast;
+    int hue;
+    bool adjustment;
+
+    // appends the configured adjustments, in the order they used to run
+    void addOps(std::vector<Op> &ops) const;
+public:
+    Adjustment(string name = "cat.png", string path = "../Images/", bool absolute = false, bool adjustment = false,
+               double brightness = 0, double contrast = 1, int hue = 0);
+    Adjustment(const Adjustment &obj);
+    Adjustment(Adjustment &&obj) noexcept;
+    Adjustment &operator=(const Adjustment &obj);
+    Adjustment &operator=(Adjustment &&obj) noexcept;
+    std::unique_ptr<Image> clone() const { return std::make_unique<Adjustment>(*this); }
+
+    // override specifier ensures that the function is virtual and is overriding a virtual function from a base class
+    virtual ~Adjustment() override;
+    istream &read(istream &in);
+    ostream &print(ostream &out) const;
+
+    std::shared_future<bool> write() const;
+    bool isCached() const;
+    void applyAll();
+    string describe() const;
+    void setBrightness(double brightness);
+    void setContrast(double contrast);
+    void setHue(int hue);
+
+    void serialize(ostream&) const;
+    void deserialize(istream&);
+};
+
+void Adjustment::serialize(ostream& out) const {
+    this->Image::serialize(out);
+
+    out<<adjustment<<" "<<brightness<<" "<<contrast<<" "<<hue<<" ";
+}
+
+void Adjustment::deserialize(istream& in) {
+    this->Image::deserialize(in);
+
+    bool adjustment;
+    double brightness, contrast;
+    int hue;
+
+    in>>adjustment>>brightness>>contrast>>hue;
+    this->adjustment = adjustment;
+    this->brightness = brightness;
+    this->contrast = contrast;
+    this->hue = hue;
+}
+
+Adjustment::Adjustment(string name, string path, bool absolute, bool adjustment,
+                       double brightness, double contrast, int hue) :
+        Image(name, path, absolute) {
+    this->adjustment = adjustment;
+    this->brightness = brightness;
+    this->contrast = contrast;
+    this->hue = hue;
+    this->scan();
+}
+
+Adjustment::Adjustment(const Adjustment &obj) : Image(obj) {
+    this->adjustment = obj.adjustment;
+    this->brightness = obj.brightness;
+    this->contrast = obj.contrast;
+    this->hue = obj.hue;
+}
+
+Adjustment::Adjustment(Adjustment &&obj) noexcept : Image(std::move(obj)) {
+    this->adjustment = obj.adjustment;
+    this->brightness = obj.brightness;
+    this->contrast = obj.contrast;
+    this->hue = obj.hue;
+}
+
+Adjustment &Adjustment::operator=(const Adjustment &obj) {
+    if (this != &obj) {
+        Image::operator=(obj);
+        this->adjustment = obj.adjustment;
+        this->brightness = obj.brightness;
+        this->contrast = obj.contrast;
+        this->hue = obj.hue;
+    }
+    return *this;
+}
+
+Adjustment &Adjustment::operator=(Adjustment &&obj) noexcept {
+    if (this != &obj) {
+        Image::operator=(std::move(obj));
+        this->adjustment = obj.adjustment;
+        this->brightness = obj.brightness;
+        this->contrast = obj.contrast;
+        this->hue = obj.hue;
+    }
+    return *this;
+}
+
+istream &Adjustment::read(istream &in) {
+    this->Image::read(in);
+    cout << "Is the image adjusted? (yes:1 no:0)\n";
+    in >> this->adjustment;
+    in.get();
+    cout << "Enter brightness [-100,100]: \n";
+    in >> this->brightness;
+    in.get();
+    cout << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
+    in >> this->contrast;
+    in.get();
+    cout << "Enter hue [0,180]: \n";
+    in >> this->hue;
+    in.get();
+    this->scan();
+
+    return in;
+}
+
+ostream &Adjustment::print(ostream &out) const {
+    this->Image::print(out);
+    if (this->adjustment == true) out << "Has adjustments applied\n";
+    else out << "Doesn't have adjustments applied\n";
+    out << "Brightness value: " << this->brightness << endl;
+    out << "Contrast value: " << this->contrast << endl;
+    out << "Hue value: " << this->hue << endl;
+
+    return out;
+}
+
+Adjustment::~Adjustment() {
+    this->contrast = 0;
+    this->brightness = 0;
+    this->hue = 0;
+    this->adjustment = false;
+}
+
+std::shared_future<bool> Adjustment::write() const {
+    try {
+        string full_path = "../Images with Adjustments/" + this->withoutExtension(this->name) + "_withAdjustments" +
+                           this->extension(this->name);
+        return this->writeRendered(full_path);
+    }
+    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
+    return EncoderPool::finished(false);
+}
+
+bool Adjustment::isCached() const {
+    string extension = this->extension(this->name);
+    uint64_t key = this->renderKey(extension);
+    return key != 0 && RenderCache::getInstance()->contains(key, extension);
+}
+
+string Adjustment::describe() const {
+    std::ostringstream out;
+    out.precision(17);
+    out << "brightness=" << brightness << " contrast=" << contrast << " hue=" << hue;
+    return out.str();
+}
+
+void Adjustment::addOps(std::vector<Op> &ops) const {
+    if (this->brightness != 0 && this->brightness >= -100 && this->brightness <= 100)
+        ops.push_back(this->limited(Op::linear(1, this->brightness, "brightness " + std::to_string((int) this->brightness)),
+                                    "brightness"));
+    if (this->contrast >= 0 && this->contrast <= 10) {
+        std::ostringstream label;
+        label << "contrast " << this->contrast;
+        ops.push_back(this->limited(Op::linear(this->contrast, 0, label.str()), "contrast"));
+    }
+    if (this->hue != 0 && this->hue >= 0 && this->hue <= 180)
+        ops.push_back(this->limited(Op::hueShift(this->hue), "hue"));
+}
+
+void Adjustment::applyAll() {
+    recipe += "adjustment " + this->describe() + " " + this->geometry() + ";";
+    std::vector<Op> ops;
+    this->addOps(ops);
+    if (!ops.empty()) this->adjustment = true;
+    this->addGeometry(ops);
+    this->runOps(ops);
+}
+
+void Adjustment::setBrightness(double brightness) {
+    this->brightness = brightness;
+}
+
+void Adjustment::setContrast(double contrast) {
+    this->contrast = contrast;
+}
+
+void Adjustment::setHue(int hue) {
+    this->hue = hue;
+}
+
+class Edited : public Effect, public Adjustment {
+private:
+    bool edited;
+    string date;
+public:
+    Edited(string name = "cat.png", string path = "../Images/", bool absolute = false, bool effect = false,
+           int blurAmount = 0, bool blackWhite = false, bool cartoon = false,
+           bool adjustment = false, double brightness = 0, double contrast = 1, int hue = 0, bool edited = false,
+           string date = "13/06/1826");
+    Edited(const Edited &obj);
+    Edited(Edited &&obj) noexcept;
+    Edited &operator=(const Edited &obj);
+    Edited &operator=(Edited &&obj) noexcept;
+    std::unique_ptr<Image> clone() const { return std::make_unique<Edited>(*this); }
+
+    ~Edited();
+    istream &read(istream &in);
+    ostream &print(ostream &out) const;
+
+    std::shared_future<bool> write() const;
+    bool isCached() const;
+    void applyAll();
+    void serialize(ostream&) const;
+    void deserialize(istream&);
+protected:
+    void addOps(std::vector<Op> &ops) const;
+};
+
+void Edited::serialize(ostream& out) const {
+    this->Effect::serialize(out);
+
+    out<<adjustment<<" "<<brightness<<" "<<contrast<<" "<<hue<<" "<<edited<<" "<<date;
+}
+
+void Edited::deserialize(istream& in) {
+    this->Effect::deserialize(in);
+
+    bool adjustment,edited;
+    double brightness, contrast;
+    int hue;
+    string date;
+
+    in>>adjustment>>brightness>>contrast>>hue>>edited>>date;
+    this->adjustment = adjustment;
+    this->brightness = brightness;
+    this->contrast = contrast;
+    this->hue = hue;
+    this->edited = edited;
+    this->date = date;
+}
+
+Edited::Edited(string name, string path, bool absolute, bool effect, int blurAmount, bool blackWhite, bool cartoon,
+               bool adjustment, double brightness, double contrast, int hue, bool edited, string date) : Image(name,path,absolute),
+                                                                                                         Effect(name,path,absolute,effect,blurAmount,blackWhite,cartoon),
+                                                                                                         Adjustment(name,path,absolute,adjustment,brightness,contrast,hue) {
+    this->edited = edited;
+    this->date = date;
+    this->scan();
+}
+
+Edited::Edited(const Edited &obj) : Image(obj), Effect(obj), Adjustment(obj) {
+    this->edited = obj.edited;
+    this->date = obj.date;
+}
+
+// Effect and Adjustment only take their own fields, the Image part is moved once
+Edited::Edited(Edited &&obj) noexcept : Image(std::move(obj)), Effect(std::move(obj)), Adjustment(std::move(obj)) {
+    this->edited = obj.edited;
+    this->date = std::move(obj.date);
+}
+
+Edited &Edited::operator=(const Edited &obj) {
+    if (this != &obj) {
+        Effect::operator=(obj);
+        Adjustment::operator=(obj);
+        this->edited = obj.edited;
+        this->date = obj.date;
+    }
+    return *this;
+}
+
+Edited &Edited::operator=(Edited &&obj) noexcept {
+    if (this != &obj) {
+        // Effect::operator= and Adjustment::operator= would both move the shared Image part
+        Image::operator=(std::move(obj));
+        this->effect = obj.effect;
+        this->blurAmount = obj.blurAmount;
+        this->blackWhite = obj.blackWhite;
+        this->cartoon = obj.cartoon;
+        this->adjustment = obj.adjustment;
+        this->brightness = obj.brightness;
+        this->contrast = obj.contrast;
+        this->hue = obj.hue;
+        this->edited = obj.edited;
+        this->date = std::move(obj.date);
+    }
+    return *this;
+}
+
+Edited::~Edited() {
+    this->edited = false;
+    if (!this->date.empty()) this->date.clear();
+}
+
+istream &Edited::read(istream &in) {
+    this->Effect::read(in);
+
+    cout << "Is the image adjusted? (yes:1 no:0)\n";
+    in >> this->adjustment;
+    in.get();
+    cout << "Enter brightness [-100,100]: \n";
+    in >> this->brightness;
+    in.get();
+    cout << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
+    in >> this->contrast;
+    in.get();
+    cout << "Enter hue [0,180]: \n";
+    in >> this->hue;
+    in.get();
+
+    cout << "Is the image edited (yes:1 no:0)?\n";
+    in >> this->edited;
+    in.get();
+    cout << "Enter date of edited image: \n";
+    std::getline(in, this->date);
+
+    this->scan();
+    return in;
+}
+
+ostream &Edited::print(ostream &out) const {
+    this->Effect::print(out);
+
+    if (this->adjustment == true) out << "Has adjustments applied\n";
+    else out << "Doesn't have adjustments applied\n";
+    out << "Brightness value: " << this->brightness << endl;
+    out << "Contrast value: " << this->contrast << endl;
+    out << "Hue value: " << this->hue << endl;
+
+    if (this->edited == true) out << "Is edited\n";
+    else out << "Is not edited\n";
+
+    out << "Date of completion: " << this->date << endl;
+
+    return out;
+}
+
+std::shared_future<bool> Edited::write() const {
+    try {
+        string full_path =
+                "../Edited Images/" + this->withoutExtension(this->name) + "_Edited" + this->extension(this->name);
+        return this->writeRendered(full_path);
+    }
+    catch (...) { cout << "~ WRITING IMAGE FAILED\n"; }
+    return EncoderPool::finished(false);
+}
+
+bool Edited::isCached() const {
+    // Effect and Adjustment compute the same key
+    return this->Effect::isCached();
+}
+
+void Edited::applyAll() {
+    recipe += "edited " + this->Adjustment::describe() + " " + this->Effect::describe() + " " + this->geometry() + ";";
+    std::vector<Op> ops;
+    this->Adjustment::addOps(ops);
+    if (!ops.empty()) this->adjustment = true;
+    size_t adjustments = ops.size();
+    this->Effect::addOps(ops);
+    if (ops.size() > adjustments) this->effect = true;
+    this->addGeometry(ops);
+    this->runOps(ops);
+}
+
+void Edited::addOps(std::vector<Op> &ops) const {
+    this->Adjustment::addOps(ops);
+    this->Effect::addOps(ops);
+}
+
+class Photoshop {
+private:
+    std::unique_ptr<Image> image;
+    bool favorite, goBack;
+
+public:
+    Photoshop() : favorite(false), goBack(false) {}
+    // the copy gets its own image of the same type, sharing the pixels until one of them is edited
+    Photoshop(const Photoshop &obj)
+            : image(obj.image ? obj.image->clone() : nullptr), favorite(obj.favorite), goBack(obj.goBack) {}
+    Photoshop(Photoshop &&) noexcept = default;
+    Photoshop &operator=(const Photoshop &obj) {
+        if (this != &obj) {
+            image = obj.image ? obj.image->clone() : nullptr;
+            favorite = obj.favorite;
+            goBack = obj.goBack;
+        }
+        return *this;
+    }
+    Photoshop &operator=(Photoshop &&) noexcept = default;
+    ~Photoshop() = default;
+
+    Image *getImage() { return this->image.get(); }
+    void setImage(std::unique_ptr<Image> image) { this->image = std::move(image); }
+    friend istream &operator>>(istream &in, Photoshop &obj);
+    friend ostream &operator<<(ostream &out, const Photoshop &obj);
+
+    bool isGoBack() const;
+    bool isFavorite() const { return this->favorite; }
+    string getName() const { return image->getName(); }
+
+    // methods for template
+    void scan(){image->scan();}
+    std::shared_future<bool> write() const {return image->write();}
+    void show() const {image->show();}
+    void preview() {image->preview();}
+    void playFrom(double) {std::cout << "~ OBJECT IS NOT OF TYPE VIDEO\n";}
+    void applyAll(){image->applyAll();}
+    std::vector<Mat> getFrames() const {return image->getFrames();}
+    void setFrames(const std::vector<Mat> &frames) {image->setFrames(frames);}
+    void release() {image->release();}
+    bool isResident() const {return image->isResident();}
+    bool hasSource() const {return image->hasSource();}
+    string getRecipe() const {return image->getRecipe();}
+    void setRecipe(const string &recipe) {image->setRecipe(recipe);}
+    bool isCached() const {return image->isCached();}
+    std::shared_future<Mat> thumbnail(bool urgent = true) const {return image->thumbnail(urgent);}
+    void exportRenditions(const std::vector<Rendition> &renditions) {image->exportRenditions(renditions);}
+
+    // setters for template
+    void setBlurAmount(int);
+    void setBlackWhite(bool);
+    void setCartoon(bool);
+    void setBrightness(double);
+    void setContrast(double);
+    void setHue(int);
+    void setCrop(const cv::Rect &);
+    void setWidth(int);
+    void setRegion(const string &, const Region &);
+    // images are a single frame
+    void setFrameRange(const string &, const cv::Range &) {std::cout << "~ OBJECT IS NOT OF TYPE VIDEO\n";}
+    cv::Rect getCrop() const {return image->getCrop();}
+    int getWidth() const {return image->getWidth();}
+
+    string getType() {
+        return typeid(*image).name();
+    }
+    void serialize(ostream&) const;
+    void deserialize(istream&);
+
+    bool operator<(const Photoshop& obj) const {
+        return *(this->image) < *(obj.image);
+    }
+    bool operator==(const Photoshop& obj) const {
+        return *(this->image) == *(obj.image);
+    }
+};
+
+void Photoshop::serialize(ostream& out) const {
+    image->serialize(out);
+}
+
+void Photoshop::deserialize(istream& in) {
+    image->deserialize(in);
+}
+
+void Photoshop::setBrightness(double brightness) {
+    if (typeid(*image) == typeid(Adjustment) || typeid(*image) == typeid(Edited)) {
+        dynamic_cast<Adjustment&>(*image).setBrightness(brightness);
+        std::cout << "~ ADJUSTMENT WAS APPLIED SUCCESSFULLY\n";
+    } else std::cout << "~ OBJECT IS NOT OF TYPE ADJUSTMENT OR EDITING\n";
+}
+
+void Photoshop::setContrast(double contrast) {
+    if (typeid(*image) == typeid(Adjustment) || typeid(*image) == typeid(Edited)) {
+        dynamic_cast<Adjustment&>(*image).setContrast(contrast);
+        std::cout << "~ ADJUSTMENT WAS APPLIED SUCCESSFULLY\n";
+    } else std::cout << "~ OBJECT IS NOT OF TYPE ADJUSTMENT OR EDITING\n";
+}
+
+void Photoshop::setHue(int hue) {
+    if (typeid(*image) == typeid(Adjustment) || typeid(*image) == typeid(Edited)) {
+        dynamic_cast<Adjustment&>(*image).setHue(hue);
+        std::cout << "~ ADJUSTMENT WAS APPLIED SUCCESSFULLY\n";
+    } else std::cout << "~ OBJECT IS NOT OF TYPE ADJUSTMENT OR EDITING\n";
+}
+
+void Photoshop::setCrop(const cv::Rect &crop) {
+    // plain images are written over their source, so they don't get renditions
+    if (typeid(*image) != typeid(Image)) {
+        image->setCrop(crop);
+        std::cout << "~ CROP WAS SET SUCCESSFULLY\n";
+    } else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT, ADJUSTMENT OR EDITING\n";
+}
+
+void Photoshop::setRegion(const string &operation, const Region &region) {
+    if (typeid(*image) != typeid(Image)) image->setRegion(operation, region);
+    else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT, ADJUSTMENT OR EDITING\n";
+}
+
+void Photoshop::setWidth(int width) {
+    if (typeid(*image) != typeid(Image)) {
+        image->setWidth(width);
+        std::cout << "~ OUTPUT WIDTH WAS SET SUCCESSFULLY\n";
+    } else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT, ADJUSTMENT OR EDITING\n";
+}
+
+void Photoshop::setBlurAmount(int blurAmount) {
+    if (typeid(*image) == typeid(Effect) || typeid(*image) == typeid(Edited)) {
+        dynamic_cast<Effect&>(*image).setBlurAmount(blurAmount);
+        std::cout << "~ EFFECT WAS APPLIED SUCCESSFULLY\n";
+    } else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT OR EDITING\n";
+}
+
+void Photoshop::setBlackWhite(bool blackWhite) {
+    if (typeid(*image) == typeid(Effect) || typeid(*image) == typeid(Edited)) {
+        dynamic_cast<Effect&>(*image).setBlackWhite(blackWhite);
+        std::cout<< "~ EFFECT WAS APPLIED SUCCESSFULLY\n";
+    }
+    else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT OR EDITING\n";
+}
+
+void Photoshop::setCartoon(bool cartoon) {
+    if (typeid(*image) == typeid(Effect) || typeid(*image) == typeid(Edited)) {
+        dynamic_cast<Effect&>(*image).setCartoon(cartoon);
+        std::cout<< "~ EFFECT WAS APPLIED SUCCESSFULLY\n";
+    }
+    else std::cout << "~ OBJECT IS NOT OF TYPE EFFECT OR EDITING\n";
+}
+
+istream &operator>>(istream &in, Photoshop &obj) {
+    // set until a type is chosen, so nothing is added without an image
+    obj.goBack = true;
+
+    for (int i = 0; i < 10; i++) cout << "-";
+    cout << " CREATE ";
+    for (int i = 0; i < 10; i++) cout << "-";
+    cout << endl;
+
+    cout << "1. Effects\n";
+    cout << "2. Adjustments\n";
+    cout << "3. Editing\n";
+    cout << "0. Go back\n";
+
+    int temp;
+    cin >> temp;
+    if(std::cin.fail()) {
+        std::cout<<"~ INVALID INPUT\n";
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(),'\n');
+        return in;
+    }
+    cin.get();
+
+    switch (temp) {
+        case 0: {
+            break;
+        }
+        case 1: {
+            obj.image = std::make_unique<Effect>();
+            obj.goBack = false;
+            break;
+        }
+        case 2: {
+            obj.image = std::make_unique<Adjustment>();
+            obj.goBack = false;
+            break;
+        }
+        case 3: {
+            obj.image = std::make_unique<Edited>();
+            obj.goBack = false;
+            break;
+        }
+        default:
+            cout << "~ INVALID OPTION\n";
+    }
+
+    if (obj.goBack == false) {
+        in >> *obj.image;
+        cout << "Is this a favorite image (yes:1 no:0)?\n";
+        in >> obj.favorite;
+    }
+
+    return in;
+}
+
+ostream &operator<<(ostream &out, const Photoshop &obj) {
+    out << *obj.image;
+
+    if (obj.favorite == true) out << "Is a favorite image\n";
+    else out << "Is not a favorite image\n";
+
+    return out;
+}
+
+bool Photoshop::isGoBack() const {
+    return this->goBack;
+}
+
+// timestamps and keyframes of a video file, kept in ../.index so they are only built once;
+// building reads the packets without decoding them, and a frame is reached afterwards by seeking
+// to the keyframe before it and decoding only from there
+class KeyframeIndex {
+private:
+    string source;
+    double fps;
+    cv::Size size;
+    std::vector<double> times; // ms of every frame
+    std::vector<int> keyframes; // frame numbers, sorted; empty when the backend can't tell
+
+    explicit KeyframeIndex(const string &source) : source(source), fps(0) {}
+    // named after the path, size and time of the file, so an edited file gets a new index
+    string sidecar() const;
+    bool load();
+    bool build();
+    bool save() const;
+public:
+    // NULL when the file can't be opened
+    static std::shared_ptr<KeyframeIndex> open(const string &source);
+
+    int frames() const { return (int) times.size(); }
+    double getFps() const { return fps; }
+    cv::Size getSize() const { return size; }
+    // the frame on screen at ms
+    int frameAt(double ms) const;
+    // where the decoder starts for frame, the backend seeks there on its own
+    int keyframeBefore(int frame) const;
+    // leaves capture so that its next read() gives frame
+    bool seek(cv::VideoCapture &capture, int frame) const;
+    // decodes count frames from first, 0 reads to the end
+    bool read(cv::VideoCapture &capture, int first, int count, std::vector<Mat> &out) const;
+};
+
+string KeyframeIndex::sidecar() const {
+    std::error_code error;
+    uintmax_t bytes = std::filesystem::file_size(source, error);
+    long long time = error ? 0 : std::filesystem::last_write_time(source, error).time_since_epoch().count();
+    string version = source + "|" + std::to_string(bytes) + "|" + std::to_string(time);
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.kfi",
+                  (unsigned long long) hashBytes((const uchar *) version.data(), version.size()));
+    return string("../.index/") + name;
+}
+
+std::shared_ptr<KeyframeIndex> KeyframeIndex::open(const string &source) {
+    std::shared_ptr<KeyframeIndex> index(new KeyframeIndex(source));
+    if (index->load()) return index;
+    cout << "~ INDEXING " << source << endl;
+    if (!index->build()) return NULL;
+    if (!index->save()) cout << "~ COULDN'T SAVE THE INDEX OF " << source << endl;
+    return index;
+}
+
+bool KeyframeIndex::load() {
+    std::ifstream in(this->sidecar());
+    string magic;
+    size_t frameCount = 0, keyCount = 0;
+    if (!(in >> magic >> fps >> size.width >> size.height >> frameCount >> keyCount) || magic != "kfi2") return false;
+    keyframes.resize(keyCount);
+    times.resize(frameCount);
+    for (int &keyframe: keyframes) in >> keyframe;
+    for (double &time: times) in >> time;
+    return (bool) in && !times.empty();
+}
+
+bool KeyframeIndex::save() const {
+    std::error_code error;
+    std::filesystem::create_directories("../.index/", error);
+    string path = this->sidecar();
+    {
+        std::ofstream out(path + ".tmp");
+        out << "kfi2 " << fps << " " << size.width << " " << size.height << " " << times.size() << " "
+            << keyframes.size() << "\n";
+        for (int keyframe: keyframes) out << keyframe << " ";
+        out << "\n";
+        out.precision(10);
+        for (double time: times) out << time << "\n";
+        if (!out) return false;
+    }
+    std::filesystem::rename(path + ".tmp", path, error);
+    return !error;
+}
+
+bool KeyframeIndex::build() {
+    cv::VideoCapture capture;
+    // CAP_PROP_FORMAT -1 makes grab() hand out the packets as they are in the file, nothing is decoded;
+    // backends without it decode every frame once
+    bool raw = capture.open(source, cv::CAP_FFMPEG, {cv::CAP_PROP_FORMAT, -1});
+    if (!raw && !capture.open(source)) return false;
+    fps = capture.get(cv::CAP_PROP_FPS);
+    size = cv::Size((int) capture.get(cv::CAP_PROP_FRAME_WIDTH), (int) capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+    if (fps <= 0) fps = 30;
+    // packets come in decode order, with b-frames a frame can come before ones it is shown after,
+    // so the frames are numbered by sorting their timestamps
+    std::vector<std::pair<double, bool>> packets;
+    while (capture.grab()) {
+        int packet = (int) packets.size();
+        double ms = capture.get(cv::CAP_PROP_POS_MSEC);
+        // some containers have no timestamps, the frame rate gives them
+        if (ms <= 0 && packet > 0) ms = packet * 1000.0 / fps;
+        packets.emplace_back(ms, raw && capture.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) != 0);
+    }
+    std::stable_sort(packets.begin(), packets.end(),
+                     [](const std::pair<double, bool> &a, const std::pair<double, bool> &b) { return a.first < b.first; });
+    for (const auto &packet: packets) {
+        if (packet.second) keyframes.push_back((int) times.size());
+        times.push_back(packet.first);
+    }
+    return !times.empty();
+}
+
+int KeyframeIndex::frameAt(double ms) const {
+    // the last frame that starts at or before ms
+    auto it = std::upper_bound(times.begin(), times.end(), ms);
+    return std::max(0, (int) (it - times.begin()) - 1);
+}
+
+int KeyframeIndex::keyframeBefore(int frame) const {
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), frame);
+    return it == keyframes.begin() ? 0 : *(it - 1);
+}
+
+bool KeyframeIndex::seek(cv::VideoCapture &capture, int frame) const {
+    if (frame <= 0) return capture.set(cv::CAP_PROP_POS_MSEC, 0);
+    // by the time of the frame, the frames are numbered by their timestamps here, POS_FRAMES numbers them
+    // by the frame rate and misses with variable frame rates and streams that don't start at 0; the
+    // backend jumps to the keyframe before it and decodes up to the frame on its own
+    return capture.set(cv::CAP_PROP_POS_MSEC, times[std::min(frame, this->frames() - 1)]);
+}
+
+bool KeyframeIndex::read(cv::VideoCapture &capture, int first, int count, std::vector<Mat> &out) const {
+    first = std::max(0, std::min(first, this->frames() - 1));
+    int last = count > 0 ? std::min(this->frames(), first + count) : this->frames();
+    if (!this->seek(capture, first)) return false;
+    for (int i = first; i < last; i++) {
+        Mat frame;
+        if (!capture.read(frame)) break;
+        out.push_back(frame);
+    }
+    return !out.empty();
+}
+
+class Video {
+private:
+    static int counter;
+    const int id;
+    string name;
+    double fps;
+    int blurAmount, hue;
+    bool blackWhite, cartoon;
+    double brightness, contrast;
+    cv::Rect crop; // empty keeps the whole frame
+    int width; // output width, 0 keeps it
+    Regions regions;
+    // the frames an operation is limited to, by operation name, end exclusive; the others pass through
+    std::map<string, cv::Range> spans;
+    cv::VideoCapture capture;
+    std::vector<Mat> sequence;
+    bool yuv; // the frames are I420, half the bytes of BGR, and the plans run on their planes
+    // a video file, empty for recordings; only the count frames from first are decoded, 0 reads to the end
+    string source;
+    int first, count;
+    std::shared_ptr<KeyframeIndex> index;
+    bool goBack = false; // set by operator>> when the file couldn't be opened, nothing is added then
+
+    // index of an earlier frame with the same pixels (up to dedupTolerance), -1 when there is none;
+    // seen maps the hashes of the unique frames so far to their index
+    int duplicateOf(const Mat &frame, std::unordered_map<uint64_t, int> &seen, int last) const;
+
+    // scan() with the effects applied by a pool of workers as the frames arrive
+    void scanLive();
+    // scan() of a file, decoding starts at the keyframe before the excerpt
+    void scanFile();
+    // edges of the pieces of a sequence of size frames with the same operations each, from 0 to the last frame
+    std::vector<int> cuts(int size) const;
+    // makes the operations render at half the output width, the trailing resize is halved instead of
+    // a second one added, so the planner can still move the crop and the downscale to the front
+    static void halve(std::vector<Op> &ops, cv::Size frame);
+public:
+    static bool yuvCapture; // --yuv, new recordings are kept in I420
+    // largest difference of a channel for a frame to still count as a copy of the previous one,
+    // 0 only catches identical frames, -1 keeps every frame (--dedup=N, --no-dedup)
+    static int dedupTolerance;
+    // --live=MS, the effects run on every frame while recording and a frame has MS from the camera
+    // to the screen; 0 records raw frames for applyAll
+    static double liveBudget;
+    // --timeline-threads=N, clips of a timeline export prepared at once, 0 = one per core but the encoder's
+    static size_t timelineThreads;
+    Video(const string &name = "", double fps = 0.0, int blurAmount = 0, bool blackWhite = false,
+          bool cartoon = false, double brightness = 0, double contrast = 1, int hue = 0);
+    Video(const Video &obj);
+    Video(Video &&obj) noexcept;
+    ~Video();
+    Video &operator=(const Video &obj);
+    Video &operator=(Video &&obj) noexcept;
+    friend istream &operator>>(istream &in, Video &obj);
+    friend ostream &operator<<(ostream &out, const Video &obj);
+
+    bool operator<(const Video& obj) const {
+        return this->id <= obj.id;
+    }
+    bool operator==(const Video& obj) const {
+        return (this->id == obj.id);
+    }
+
+//    methods
+    void scan();
+    void write() const;
+    void show() const;
+    // plays the frames with the current settings applied on the fly, nothing is baked into them
+    void preview();
+    void applyAll();
+    // appends the configured operations for frames of size frame, reporting the ones out of range; with
+    // an index only the operations whose frames include it, without reporting, so a video cut in pieces
+    // reports once
+    void addOps(std::vector<Op> &ops, cv::Size frame, int index = -1) const;
+    // runs op on every frame of frames while showing a loading bar
+    void forEachFrame(const std::function<void(Mat &)> &op, bool parallel,
+                      const cv::Range &frames = cv::Range::all());
+    // the frame as BGR for the window and the encoder
+    Mat picture(const Mat &frame) const;
+    // the excerpt of the source decoded into frames, the video itself isn't changed, so several
+    // of them can decode at once
+    bool decode(std::vector<Mat> &frames) const;
+    // runs the settings that aren't applied yet on pictures of the frames, the video keeps them as they are;
+    // a piece the plan fails on is left without them
+    void render(std::vector<Mat> &frames) const;
+
+//    setters
+    void setBlurAmount(int blurAmount);
+    void setBlackWhite(bool blackWhite);
+    void setCartoon(bool cartoon);
+    void setBrightness(double brightness);
+    void setContrast(double contrast);
+    void setHue(int hue);
+    void setCrop(const cv::Rect &crop);
+    void setWidth(int width);
+    void setRegion(const string &operation, const Region &region) {regions.set(operation, region);}
+    // an empty range makes the operation apply to every frame again
+    void setFrameRange(const string &operation, const cv::Range &frames);
+    cv::Rect getCrop() const {return crop;}
+    int getWidth() const {return width;}
+
+    string getType(){return typeid(*this).name();}
+    string getName() const {return name;}
+    double getFps() const {return fps;}
+    std::vector<Mat> getFrames() const {return sequence;}
+    // frames with a buffer of their own, duplicates share the buffer of the first one
+    size_t uniqueFrames() const;
+    // size of the picture, an I420 frame has half again as many rows
+    cv::Size frameSize() const;
+    void setFrames(const std::vector<Mat> &frames) {sequence = frames;}
+    void release() {sequence.clear();}
+    bool isResident() const {return !sequence.empty();}
+    // recordings come from the camera, they can't be scanned again, files are decoded again
+    bool hasSource() const {return !source.empty();}
+    // the excerpt of a video file from start seconds, 0 seconds long reads to the end
+    bool setSource(const string &path, double start, double seconds);
+    // plays from a time, a file is decoded from the keyframe before it instead of from the start
+    void playFrom(double seconds);
+    // videos aren't written through the render cache
+    string getRecipe() const {return "";}
+    void setRecipe(const string &) {}
+    bool isCached() const {return false;}
+    // the first frame, recordings have no file to decode a preview from
+    std::shared_future<Mat> thumbnail(bool urgent = true) const;
+    // a rendition is one encoded image, so videos don't have them
+    void exportRenditions(const std::vector<Rendition> &) {cout << "~ RENDITIONS ARE ONLY AVAILABLE FOR IMAGES\n";}
+    // videos can't be marked as favorites
+    bool isFavorite() const {return false;}
+    bool isGoBack() const {return goBack;}
+    void serialize(ostream&) const;
+    void deserialize(istream&);
+};
+
+std::shared_future<Mat> Video::thumbnail(bool) const {
+    std::promise<Mat> promise;
+    Mat preview;
+    if (!sequence.empty()) {
+        Mat first = this->picture(sequence[0]);
+        double scale = (double) ThumbnailService::longEdge / std::max(first.cols, first.rows);
+        cv::resize(first, preview, cv::Size(), std::min(scale, 1.0), std::min(scale, 1.0), cv::INTER_AREA);
+    }
+    promise.set_value(preview);
+    return promise.get_future().share();
+}
+
+void Video::serialize(ostream& out) const {
+    out<<name<<" "<<blurAmount<<" "<<blackWhite<<" "<<cartoon<<" "<<brightness<<" "<<contrast<<" "<<hue;
+    // marked so project files from before renditions still load
+    out<<" @ "<<crop.x<<" "<<crop.y<<" "<<crop.width<<" "<<crop.height<<" "<<width<<" ";
+    regions.serialize(out);
+    if (!source.empty()) out<<"& "<<std::quoted(source)<<" "<<first<<" "<<count<<" ";
+    if (!spans.empty()) {
+        out<<"% "<<spans.size()<<" ";
+        for (const auto &entry: spans) out<<entry.first<<" "<<entry.second.start<<" "<<entry.second.end<<" ";
+    }
+}
+
+void Video::deserialize(istream& in) {
+    string name;
+    bool blackWhite,cartoon;
+    int blurAmount,hue;
+    double brightness, contrast;
+
+    in>>name>>blurAmount>>blackWhite>>cartoon>>brightness>>contrast>>hue;
+    this->name = name;
+    this->blurAmount = blurAmount;
+    this->blackWhite = blackWhite;
+    this->cartoon = cartoon;
+    this->brightness = brightness;
+    this->contrast = contrast;
+    this->hue = hue;
+    this->crop = cv::Rect();
+    this->width = 0;
+    if ((in >> std::ws).peek() == '@') {
+        in.get();
+        in>>crop.x>>crop.y>>crop.width>>crop.height>>width;
+    }
+    regions.deserialize(in);
+    // files are decoded again by scan(), the index is opened then
+    this->source.clear();
+    this->index.reset();
+    this->first = this->count = 0;
+    if ((in >> std::ws).peek() == '&') {
+        in.get();
+        in>>std::quoted(source)>>first>>count;
+    }
+    this->spans.clear();
+    if ((in >> std::ws).peek() == '%') {
+        in.get();
+        size_t spanCount = 0;
+        in>>spanCount;
+        for (size_t i = 0; i < spanCount && in; i++) {
+            string operation;
+            cv::Range frames;
+            in>>operation>>frames.start>>frames.end;
+            this->setFrameRange(operation, frames);
+        }
+    }
+}
+
+int Video::counter = 0;
+bool Video::yuvCapture = false;
+int Video::dedupTolerance = 0;
+double Video::liveBudget = 0;
+size_t Video::timelineThreads = 0;
+
+int Video::duplicateOf(const Mat &frame, std::unordered_map<uint64_t, int> &seen, int last) const {
+    auto found = seen.find(hashMat(frame));
+    // the hash only narrows it down, the pixels decide
+    if (found != seen.end() && cv::norm(sequence[found->second], frame, cv::NORM_INF) == 0) return found->second;
+    // sensor noise makes a still scene differ by a few levels, only the previous unique frame is compared
+    if (dedupTolerance > 0 && last >= 0 && cv::norm(sequence[last], frame, cv::NORM_INF) <= dedupTolerance)
+        return last;
+    return -1;
+}
+
+size_t Video::uniqueFrames() const {
+    std::unordered_set<const uchar *> buffers;
+    for (const Mat &frame: sequence) buffers.insert(frame.data);
+    return buffers.size();
+}
+
+Mat Video::picture(const Mat &frame) const {
+    if (!yuv) return frame;
+    Mat bgr;
+    cv::cvtColor(frame, bgr, cv::COLOR_YUV2BGR_I420);
+    return bgr;
+}
+
+cv::Size Video::frameSize() const {
+    if (sequence.empty()) return cv::Size();
+    return yuv ? cv::Size(sequence[0].cols, sequence[0].rows * 2 / 3) : sequence[0].size();
+}
+
+Video::Video(const string &name, double fps, int blurAmount, bool blackWhite,
+             bool cartoon, double brightness, double contrast, int hue) : id(counter++) {
+    if (name.empty()) {
+        this->name = "video" + std::to_string(id);
+        this->name += ".mp4";
+    }
+    else this->name = name;
+    this->fps = fps;
+    this->blurAmount = blurAmount;
+    this->hue = hue;
+    this->blackWhite = blackWhite;
+    this->cartoon = cartoon;
+    this->brightness = brightness;
+    this->contrast = contrast;
+    this->width = 0;
+    this->yuv = false;
+    this->first = 0;
+    this->count = 0;
+//    to open the laptop camera
+    this->capture.open(0);
+}
+
+Video::Video(const Video &obj) : id(counter++) {
+    if (obj.name.empty()) {
+        this->name = "video" + std::to_string(id);
+        this->name += ".mp4";
+    }
+    else this->name = obj.name;
+    this->fps = obj.fps;
+    this->blurAmount = obj.blurAmount;
+    this->hue = obj.hue;
+    this->blackWhite = obj.blackWhite;
+    this->cartoon = obj.cartoon;
+    this->brightness = obj.brightness;
+    this->contrast = obj.contrast;
+    this->crop = obj.crop;
+    this->width = obj.width;
+    this->regions = obj.regions;
+    this->spans = obj.spans;
+    // the frames are shared until one of the copies edits them, scan() opens its own camera
+    this->sequence = obj.sequence;
+    this->yuv = obj.yuv;
+    this->source = obj.source;
+    this->first = obj.first;
+    this->count = obj.count;
+    this->index = obj.index;
+}
+
+// a new id like the copy constructor, the moved from video is still alive and keeps its own
+Video::Video(Video &&obj) noexcept : id(counter++) {
+    if (obj.name.empty()) {
+        this->name = "video" + std::to_string(id);
+        this->name += ".mp4";
+    }
+    else this->name = std::move(obj.name);
+    this->fps = obj.fps;
+    this->blurAmount = obj.blurAmount;
+    this->hue = obj.hue;
+    this->blackWhite = obj.blackWhite;
+    this->cartoon = obj.cartoon;
+    this->brightness = obj.brightness;
+    this->contrast = obj.contrast;
+    this->crop = obj.crop;
+    this->width = obj.width;
+    this->regions = std::move(obj.regions);
+    this->spans = std::move(obj.spans);
+    this->sequence = std::move(obj.sequence);
+    this->yuv = obj.yuv;
+    this->source = std::move(obj.source);
+    this->first = obj.first;
+    this->count = obj.count;
+    this->index = std::move(obj.index);
+}
+
+Video::~Video() {
+    counter = 0;
+    if (!name.empty()) name.clear();
+    fps = 0.0;
+    blurAmount = 0;
+    hue = 0;
+    blackWhite = false;
+    cartoon = false;
+    brightness = 0;
+    contrast = 1;
+    capture.release();
+    if (!sequence.empty()) sequence.clear();
+}
+
+Video &Video::operator=(const Video &obj) {
+    if (this != &obj) {
+        if (obj.name.empty()) {
+            this->name = "video" + std::to_string(id);
+            this->name += ".mp4";
+        }
+        else this->name = obj.name;
+        this->fps = obj.fps;
+        this->blurAmount = obj.blurAmount;
+        this->hue = obj.hue;
+        this->blackWhite = obj.blackWhite;
+        this->cartoon = obj.cartoon;
+        this->brightness = obj.brightness;
+        this->contrast = obj.contrast;
+        this->crop = obj.crop;
+        this->width = obj.width;
+        this->regions = obj.regions;
+        this->spans = obj.spans;
+        this->sequence = obj.sequence;
+        this->yuv = obj.yuv;
+        this->source = obj.source;
+        this->first = obj.first;
+        this->count = obj.count;
+        this->index = obj.index;
+    }
+    return *this;
+}
+
+Video &Video::operator=(Video &&obj) noexcept {
+    if (this != &obj) {
+        // the id stays, it belongs to this object
+        this->name = std::move(obj.name);
+        this->fps = obj.fps;
+        this->blurAmount = obj.blurAmount;
+        this->hue = obj.hue;
+        this->blackWhite = obj.blackWhite;
+        this->cartoon = obj.cartoon;
+        this->brightness = obj.brightness;
+        this->contrast = obj.contrast;
+        this->crop = obj.crop;
+        this->width = obj.width;
+        this->regions = std::move(obj.regions);
+        this->spans = std::move(obj.spans);
+        this->sequence = std::move(obj.sequence);
+        this->yuv = obj.yuv;
+        this->source = std::move(obj.source);
+        this->first = obj.first;
+        this->count = obj.count;
+        this->index = std::move(obj.index);
+    }
+    return *this;
+}
+
+istream &operator>>(istream &in, Video &obj) {
+    if (!obj.name.empty()) obj.name.clear();
+    cout << "Enter name: \n";
+    in >> obj.name;
+
+    obj.goBack = false;
+    cout << "Enter video file to open (0: record from the camera): \n";
+    string path;
+    getline(in >> std::ws, path);
+    // deleting "" from path
+    if (path.size() > 1 && path.front() == '"' && path.back() == '"') path = path.substr(1, path.size() - 2);
+    if (path != "0") {
+        double start, seconds;
+        cout << "Enter start time in seconds: \n";
+        in >> start;
+        cout << "Enter length in seconds (0: until the end): \n";
+        in >> seconds;
+        in.get();
+        // a file that can't be opened isn't swapped for a recording
+        if (!obj.setSource(path, start, seconds)) {
+            obj.goBack = true;
+            return in;
+        }
+    }
+
+    cout << "Do you want to blur the video? (yes:1 no:0)?\n";
+    int temp;
+    in >> temp;
+    in.get();
+    if (temp == 1) {
+        cout << "Enter blur amount: \n";
+        in >> obj.blurAmount;
+    }
+    cout << "Do you want to apply Black and White effect? (yes:1 no:0)?\n";
+    in >> obj.blackWhite;
+    cout << "Do you want to apply Cartoon effect? (yes:1 no:0)?\n";
+    in >> obj.cartoon;
+
+    in.get();
+    cout << "Enter brightness [-100,100]: \n";
+    in >> obj.brightness;
+    in.get();
+    cout << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
+    in >> obj.contrast;
+    in.get();
+    cout << "Enter hue [0,180]: \n";
+    in >> obj.hue;
+    in.get();
+
+    obj.scan();
+    return in;
+}
+
+ostream &operator<<(ostream &out, const Video &obj) {
+    out << obj.name << endl;
+
+    out << "Blur amount: " << obj.blurAmount << endl;
+    if (obj.blackWhite == true) out << "Has Black and White effect applied\n";
+    else out << "Doesn't have Black and White effect applied\n";
+    if (obj.cartoon) out << "Has Cartoon effect applied\n";
+    else out << "Doesn't have Cartoon effect applied\n";
+
+    out << "Brightness value: " << obj.brightness << endl;
+    out << "Contrast value: " << obj.contrast << endl;
+    out << "Hue value: " << obj.hue << endl;
+    if (obj.crop.area() > 0)
+        out << "Crop: " << obj.crop.width << "x" << obj.crop.height << " at " << obj.crop.x << "," << obj.crop.y << endl;
+    if (obj.width > 0) out << "Output width: " << obj.width << endl;
+    if (!obj.source.empty()) {
+        out << "Source: " << obj.source << " from frame " << obj.first;
+        if (obj.count > 0) out << ", " << obj.count << " frames";
+        out << endl;
+    }
+    out << "Frames: " << obj.sequence.size() << " (" << obj.uniqueFrames() << " unique)"
+        << (obj.yuv ? ", YUV 4:2:0" : "") << endl;
+    obj.regions.print(out);
+    for (const auto &entry: obj.spans)
+        out << "Frames of " << entry.first << ": " << entry.second.start << " to " << entry.second.end - 1 << endl;
+    return out;
+}
+
+void Video::scan() {
+    if (!source.empty()) return this->scanFile();
+    if (liveBudget > 0) return this->scanLive();
+    std::chrono::high_resolution_clock::time_point wasted_end;
+    std::chrono::high_resolution_clock::time_point wasted_start;
+    this->capture.open(0);
+    if(!this->sequence.empty()) this->sequence.clear();
+    this->yuv = yuvCapture;
+    // takes 35ms for camera to start which can be seen at low length videos
+    // thats why i took in account the wasted time for it
+    try {
+        if (!capture.isOpened()) throw "~ Failed to open camera";
+        Mat frame;
+        bool started = false;
+        std::unordered_map<uint64_t, int> seen;
+        int last = -1;
+        size_t duplicates = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        wasted_start = std::chrono::high_resolution_clock::now();
+        auto time_elapsed_start = std::chrono::high_resolution_clock::now();
+        auto last_time_output = std::chrono::duration_cast<std::chrono::seconds>(time_elapsed_start - start).count();
+        while (capture.read(frame)) {
+            if (!started) {
+                started = true;
+                wasted_end = std::chrono::high_resolution_clock::now();
+            }
+            cv::imshow("Camera feed", frame);
+            Mat stored = frame;
+            if (yuv) {
+                // converted once here, the frame stays 4:2:0 until it is shown or written
+                stored = Mat();
+                cv::cvtColor(frame, stored, cv::COLOR_BGR2YUV_I420);
+            }
+            int same = dedupTolerance >= 0 ? this->duplicateOf(stored, seen, last) : -1;
+            // a still scene is stored once, its copies share the buffer and are processed once
+            if (same >= 0) {
+                sequence.push_back(sequence[same]);
+                duplicates++;
+            } else {
+                if (dedupTolerance >= 0) seen[hashMat(stored)] = last = (int) sequence.size();
+                // the frame keeps the buffer it was read into, the next read gets a new one from the pixel pool
+                frame = Mat();
+                sequence.push_back(std::move(stored));
+            }
+
+            // to display video duration
+            auto time_elapsed_end = std::chrono::high_resolution_clock::now();
+            if (last_time_output !=
+                std::chrono::duration_cast<std::chrono::seconds>(time_elapsed_end - time_elapsed_start).count()) {
+                last_time_output = std::chrono::duration_cast<std::chrono::seconds>(
+                        time_elapsed_end - time_elapsed_start).count();
+                system("CLS");
+                std::cout << "Video duration: " << std::chrono::duration_cast<std::chrono::seconds>(
+                        time_elapsed_end - time_elapsed_start).count() << " seconds";
+            }
+
+            if (waitKey(1) == 27) break;
+        }
+        system("CLS");
+        if (duplicates > 0) std::cout << "~ " << duplicates << " DUPLICATE FRAMES SHARE A BUFFER\n";
+        // recored time it took, and how many frames there are to get the fps of the video
+        // because the camera won't share that info with opencv
+        auto end = std::chrono::high_resolution_clock::now() - (wasted_end - wasted_start);
+        this->fps = sequence.size() / (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0);
+        capture.release();
+        cv::destroyAllWindows();
+    }
+    catch (string err) {
+        std::cout << err << endl;
+    }
+}
+
+bool Video::setSource(const string &path, double start, double seconds) {
+    std::shared_ptr<KeyframeIndex> opened = KeyframeIndex::open(path);
+    if (!opened) {
+        cout << "~ COULDN'T OPEN " << path << endl;
+        return false;
+    }
+    this->source = path;
+    this->index = opened;
+    this->fps = opened->getFps();
+    this->first = opened->frameAt(start * 1000);
+    this->count = seconds > 0 ? std::max(1, opened->frameAt((start + seconds) * 1000) - first) : 0;
+    return true;
+}
+
+void Video::scanFile() {
+    if (!index) index = KeyframeIndex::open(source);
+    if(!this->sequence.empty()) this->sequence.clear();
+    this->yuv = false;
+    try {
+        if (!index) throw string("~ Failed to open " + source);
+        this->capture.open(source);
+        if (!capture.isOpened() || !index->read(capture, first, count, sequence))
+            throw string("~ Failed to decode " + source);
+        this->fps = index->getFps();
+        capture.release();
+        cout << "~ DECODED " << sequence.size() << " FRAMES FROM " << index->keyframeBefore(first) << " ON\n";
+    }
+    catch (string err) {
+        std::cout << err << endl;
+    }
+}
+
+bool Video::decode(std::vector<Mat> &frames) const {
+    std::shared_ptr<KeyframeIndex> opened = index ? index : KeyframeIndex::open(source);
+    if (!opened) return false;
+    cv::VideoCapture reader(source);
+    return reader.isOpened() && opened->read(reader, first, count, frames);
+}
+
+void Video::playFrom(double seconds) {
+    typedef std::chrono::steady_clock Clock;
+    if (fps <= 0) return;
+    Mat frame;
+    size_t shown = 0;
+    if (!source.empty() && !index) index = KeyframeIndex::open(source);
+    // a file plays from the file, a recording from its frames
+    bool streaming = !source.empty() && index;
+    int from = streaming ? index->frameAt(seconds * 1000) : (int) (seconds * fps);
+    if (streaming) {
+        capture.open(source);
+        if (!capture.isOpened() || !index->seek(capture, from)) {
+            cout << "~ COULDN'T SEEK IN " << source << endl;
+            return;
+        }
+    }
+    auto start = Clock::now();
+    for (int i = from; streaming || i < (int) sequence.size(); i++) {
+        if (streaming) {
+            if (!capture.read(frame)) break;
+        } else frame = this->picture(sequence[i]);
+        cv::imshow("Video", frame);
+        shown++;
+        auto due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(shown / fps));
+        int wait = (int) std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count();
+        if (cv::waitKey(std::max(1, wait)) == 27) break;
+    }
+    if (streaming) capture.release();
+    cv::destroyAllWindows();
+}
+
+void Video::scanLive() {
+    typedef std::chrono::steady_clock Clock;
+    this->capture.open(0);
+    if (!this->sequence.empty()) this->sequence.clear();
+    this->yuv = false;
+    try {
+        if (!capture.isOpened()) throw string("~ Failed to open camera");
+        Mat frame;
+        if (!capture.read(frame)) throw string("~ Failed to read from camera");
+        cv::Size size = frame.size();
+
+        // the recording is cut in pieces with the same operations, a frame runs the plans of the piece
+        // its index falls in, so operations limited to frames only run on those
+        std::vector<int> edges = this->cuts(std::numeric_limits<int>::max());
+        auto pieceOf = [&edges](int index) {
+            return (size_t) (std::upper_bound(edges.begin(), edges.end(), index) - edges.begin() - 1);
+        };
+        // reports the settings out of range once, the pieces leave them out quietly
+        std::vector<Op> all;
+        this->addOps(all, size);
+        // quality tiers for when frames take longer than the budget: full, half size scaled back up
+        // (the planner moves the downscale in front of what it can), half size without the slow filters
+        std::vector<std::array<Plan, 3>> tiers(edges.size() - 1);
+        for (size_t p = 0; p < tiers.size(); p++) {
+            std::vector<Op> ops;
+            this->addOps(ops, size, edges[p]);
+            tiers[p][0] = Planner::plan(ops, size);
+            halve(ops, size);
+            tiers[p][1] = Planner::plan(ops, size);
+            std::vector<Op> fast;
+            for (const Op &op: ops) if (op.kind != Op::BLUR && op.kind != Op::CARTOON) fast.push_back(op);
+            tiers[p][2] = Planner::plan(fast, size);
+        }
+
+        struct Job {
+            int index, tier;
+            Mat frame;
+            Clock::time_point captured;
+        };
+        struct Done {
+            Mat frame;
+            Clock::time_point captured;
+            int tier;
+            int copyOf; // index of an earlier frame with the same pixels, -1 when it was processed
+        };
+        std::deque<Job> jobs;
+        std::map<int, Done> done; // finished frames waiting for the ones before them
+        std::mutex mutex;
+        std::condition_variable wake, finished;
+        bool stop = false;
+        std::atomic<size_t> failures(0);
+
+        // frames are processed in parallel and shown and stored in capture order
+        // one core stays with the capture loop
+        size_t count = std::max(3u, std::thread::hardware_concurrency()) - 1;
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < count; w++)
+            workers.emplace_back([&]() {
+                while (true) {
+                    Job job;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&]() { return !jobs.empty() || stop; });
+                        if (jobs.empty()) return;
+                        job = std::move(jobs.front());
+                        jobs.pop_front();
+                    }
+                    try {
+                        tiers[pieceOf(job.index)][job.tier].run(job.frame);
+                    }
+                    catch (...) {
+                        // the frame is recorded as captured, the first failure is reported right away
+                        if (failures++ == 0) cout << "~ EFFECTS FAILED ON A FRAME, IT IS RECORDED AS CAPTURED\n";
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done[job.index] = Done{job.frame, job.captured, job.tier, -1};
+                    finished.notify_all();
+                }
+            });
+
+        int submitted = 0, next = 0, tier = 0, changed = 0, last = -1;
+        size_t dropped = 0, duplicates = 0, perTier[3] = {0, 0, 0};
+        double latency = 0; // moving average in ms, from the camera to the screen
+        cv::Size output;
+        Mat previous; // last frame that was processed, for the duplicate check
+        auto start = Clock::now();
+
+        // puts the finished frames that are next in order into the sequence and on the screen
+        auto emit = [&](bool all) {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                if (all) finished.wait(lock, [&]() { return next == submitted || done.count(next) > 0; });
+                auto it = done.find(next);
+                if (it == done.end()) return;
+                Done result = std::move(it->second);
+                done.erase(it);
+                lock.unlock();
+
+                if (result.copyOf >= 0) sequence.push_back(sequence[result.copyOf]);
+                else {
+                    if (output.area() == 0) output = result.frame.size();
+                    // the cheaper tiers come back at half size
+                    if (result.frame.size() != output) cv::resize(result.frame, result.frame, output);
+                    sequence.push_back(result.frame);
+                    perTier[result.tier]++;
+                }
+                cv::imshow("Camera feed", sequence.back());
+                double sample = std::chrono::duration<double, std::milli>(Clock::now() - result.captured).count();
+                latency = next == 0 ? sample : 0.9 * latency + 0.1 * sample;
+                // a tier gets a few frames to show its effect before the next change
+                if (latency > liveBudget && tier < 2 && next - changed > (int) count * 2) tier++, changed = next;
+                else if (latency < liveBudget / 2 && tier > 0 && next - changed > 30) tier--, changed = next;
+
+                lock.lock();
+                next++;
+            }
+        };
+
+        auto time_elapsed_start = Clock::now();
+        long long last_time_output = 0;
+        do {
+            auto captured = Clock::now();
+            bool full;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                full = submitted - next > (int) count * 2;
+            }
+            if (full) dropped++; // the recording loses the frame rather than falling further behind
+            else if (dedupTolerance >= 0 && !previous.empty() && pieceOf(last) == pieceOf(submitted) &&
+                     cv::norm(previous, frame, cv::NORM_INF) <= dedupTolerance) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done[submitted] = Done{Mat(), captured, tier, last};
+                submitted++;
+                duplicates++;
+            } else {
+                // the worker changes the frame in place
+                if (dedupTolerance >= 0) frame.copyTo(previous);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    last = submitted;
+                    jobs.push_back(Job{submitted++, tier, frame, captured});
+                }
+                wake.notify_one();
+                // the worker owns the buffer now, the next read gets a new one
+                frame = Mat();
+            }
+            emit(false);
+
+            long long seconds = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - time_elapsed_start).count();
+            if (seconds != last_time_output) {
+                last_time_output = seconds;
+                system("CLS");
+                std::cout << "Video duration: " << seconds << " seconds, latency " << (int) latency << " ms, tier "
+                          << tier;
+            }
+            if (waitKey(1) == 27) break;
+        } while (capture.read(frame));
+        emit(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker: workers) worker.join();
+
+        system("CLS");
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        this->fps = seconds > 0 ? sequence.size() / seconds : 0;
+        capture.release();
+        cv::destroyAllWindows();
+        std::cout << "~ RECORDED " << sequence.size() << " FRAMES (" << perTier[0] << " FULL, " << perTier[1]
+                  << " HALF SIZE, " << perTier[2] << " FAST, " << duplicates << " DUPLICATE, " << dropped
+                  << " DROPPED)\n";
+        if (failures > 0) std::cout << "~ " << failures << " FRAMES WERE RECORDED WITHOUT EFFECTS\n";
+        // the effects are in the frames now, each on its frames, applying them again would double them
+        blurAmount = 0, hue = 0, blackWhite = false, cartoon = false, brightness = 0, contrast = 1;
+        crop = cv::Rect(), width = 0;
+        regions = Regions();
+        spans.clear();
+        std::cout << "~ EFFECTS WERE APPLIED WHILE RECORDING\n";
+    }
+    catch (string err) {
+        std::cout << err << endl;
+    }
+}
+
+void Video::write() const {
+//    fourcc = video encode MJPG is for mp4 and avi
+//    15 = fps (this is max for my webcam) , size for window, true because it has colors
+    try {
+        bool checkImage = true;
+        if(sequence[0].channels() == 1 && !yuv) checkImage = false;
+        cv::VideoWriter writer("../Videos/" + name, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps,
+                               this->frameSize(), checkImage);
+
+//        with address so it won't copy each frame
+        for (const auto &frame: sequence) writer.write(this->picture(frame));
+
+        if (!writer.isOpened()) throw string("~ Failed to open the video writer");
+
+        writer.release();
+    }
+    catch (string err) {
+        std::cout << err << endl;
+    }
+}
+
+void Video::show() const {
+    typedef std::chrono::steady_clock Clock;
+    auto start = Clock::now();
+    for (size_t i = 0; i < sequence.size(); i++) {
+        // showing each image individualy
+        cv::imshow("Video", this->picture(sequence[i]));
+        // waiting until the next frame is due, measured from the start so the drawing time doesn't add up
+        auto due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((i + 1) / fps));
+        int wait = (int) std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now()).count();
+        if (cv::waitKey(std::max(1, wait)) == 27) break;
+    }
+    cv::destroyAllWindows();
+}
+
+void Video::preview() {
+    if (sequence.empty() || fps <= 0) {
+        cout << "~ NOTHING TO PREVIEW\n";
+        return;
+    }
+    cv::Size size = this->frameSize();
+    // two plans per piece of frames with the same operations, tier 1 is the fallback when rendering
+    // can't keep up, the planner moves the downscale in front of the ops it can, so they run on a
+    // quarter of the pixels
+    std::vector<int> edges = this->cuts((int) sequence.size());
+    // reports the settings out of range once, the pieces leave them out quietly
+    std::vector<Op> all;
+    this->addOps(all, size);
+    std::vector<std::array<Plan, 2>> plans(edges.size() - 1);
+    for (size_t p = 0; p < plans.size(); p++) {
+        std::vector<Op> ops;
+        this->addOps(ops, size, edges[p]);
+        plans[p][0] = Planner::plan(ops, size);
+        halve(ops, size);
+        plans[p][1] = Planner::plan(ops, size);
+    }
+
+    struct Rendered {
+        int index;
+        Mat frame;
+        int tier;
+    };
+    const size_t ahead = 8; // frames rendered ahead of the player
+    std::deque<Rendered> ready;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool finished = false;
+    std::atomic<bool> stop(false);
+    std::atomic<int> due(0), tier(0);
+
+    // renders in order into the queue, skipping the frames the player is already past
+    std::thread renderer([&]() {
+        for (int i = 0; i < (int) sequence.size() && !stop; i++) {
+            i = std::max(i, due.load());
+            if (i >= (int) sequence.size()) break;
+            Mat frame;
+            int used = tier;
+            try {
+                frame = yuv ? this->picture(sequence[i]) : sequence[i].clone();
+                size_t piece = std::upper_bound(edges.begin(), edges.end(), i) - edges.begin() - 1;
+                plans[piece][used].run(frame);
+            }
+            catch (...) {
+                // a frame the plan fails on is shown as it was recorded, one that can't even be
+                // converted is left out and the player drops it
+                used = 0;
+                try { frame = this->picture(sequence[i]); }
+                catch (...) { continue; }
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return ready.size() < ahead || stop; });
+            if (stop) break;
+            ready.push_back(Rendered{i, frame, used});
+            changed.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        changed.notify_all();
+    });
+
+    typedef std::chrono::steady_clock Clock;
+    const std::chrono::duration<double> period(1.0 / fps);
+    // the window scales half size frames back up
+    cv::namedWindow("Preview", cv::WINDOW_NORMAL);
+    cv::resizeWindow("Preview", size.width, size.height);
+    size_t shown = 0, dropped = 0, scaled = 0;
+    int streak = 0; // frames in a row found with a full queue, the renderer has time to spare
+    auto start = Clock::now();
+    while (true) {
+        Rendered next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !ready.empty() || finished; });
+            if (ready.empty()) break;
+            streak = ready.size() == ahead ? streak + 1 : 0;
+            next = std::move(ready.front());
+            ready.pop_front();
+        }
+        changed.notify_all();
+
+        auto deadline = start + std::chrono::duration_cast<Clock::duration>(period * next.index);
+        auto now = Clock::now();
+        if (now > deadline + period) {
+            // more than a frame late: skipped, the renderer jumps to the frame due now and drops to half size
+            dropped++;
+            due = (int) ((now - start) / period) + 1;
+            tier = 1;
+            continue;
+        }
+        // two seconds of frames with the queue full, full size is affordable again
+        if (tier == 1 && streak > 2 * fps) tier = 0, streak = 0;
+        std::this_thread::sleep_until(deadline);
+        cv::imshow("Preview", next.frame);
+        shown++;
+        if (next.tier == 1) scaled++;
+        if (cv::waitKey(1) == 27) break;
+    }
+    stop = true;
+    changed.notify_all();
+    renderer.join();
+    cv::destroyWindow("Preview");
+    cout << "~ PREVIEW: " << shown << " FRAMES SHOWN (" << scaled << " AT HALF SIZE), " << dropped << " DROPPED\n";
+}
+
+void Video::render(std::vector<Mat> &frames) const {
+    std::vector<int> edges = this->cuts((int) frames.size());
+    // the size comes from the frames, the video's own sequence may be released by another thread meanwhile
+    std::vector<Op> all;
+    this->addOps(all, frames.empty() ? cv::Size() : frames[0].size());
+    for (size_t p = 0; p + 1 < edges.size(); p++) {
+        cv::Size size = frames[edges[p]].size();
+        std::vector<Op> ops;
+        this->addOps(ops, size, edges[p]);
+        if (ops.empty()) continue;
+        Plan plan = Planner::plan(ops, size);
+        // frames that share a buffer run once, on a copy, the buffer may still be the video's own;
+        // the piece is only replaced once all of it is rendered
+        std::vector<Mat> piece(frames.begin() + edges[p], frames.begin() + edges[p + 1]);
+        std::unordered_map<const uchar *, Mat> rendered;
+        try {
+            for (Mat &frame: piece) {
+                auto found = rendered.find(frame.data);
+                if (found != rendered.end()) {
+                    frame = found->second;
+                    continue;
+                }
+                const uchar *key = frame.data;
+                frame = frame.clone();
+                plan.run(frame);
+                rendered[key] = frame;
+            }
+            std::move(piece.begin(), piece.end(), frames.begin() + edges[p]);
+        }
+        catch (...) {
+            cout << "~ THE SETTINGS OF " << name << " FAILED ON FRAMES " << edges[p] << " TO " << edges[p + 1] - 1
+                 << ", THEY ARE LEFT WITHOUT THEM\n";
+        }
+    }
+}
+
+void Video::forEachFrame(const std::function<void(Mat &)> &op, bool parallel, const cv::Range &frames) {
+    cv::Range range = frames == cv::Range::all() ? cv::Range(0, (int) sequence.size()) : frames;
+    // frames that share a buffer run once, the copies let go of it first so the op doesn't
+    // have to clone it, and get the result afterwards; a copy outside of frames keeps the old pixels,
+    // the buffer is still shared then, so it is cloned before the op
+    std::vector<int> unique, source(sequence.size());
+    std::unordered_map<const uchar *, int> first;
+    for (int i = range.start; i < range.end; i++) {
+        auto found = first.emplace(sequence[i].data, i);
+        source[i] = found.first->second;
+        if (found.second) unique.push_back(i);
+        else sequence[i].release();
+    }
+
+    std::cout << "~ LOADING [          ]";
+    int fraction = std::max(1, (int) floor(((double) unique.size()) / 10));
+    // atomic variable so one a thread cant read and another write in it at the same time
+    std::atomic<int> counter(0);
+    // common variable across threads (like static but for threads)
+    std::mutex printMutex;
+    // [&] = captures all variables used within lambda body and access them by reference
+    auto body = [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; i++) {
+            if (i % fraction == 0 && i != 0 && counter < 10) {
+                // locks the variable until it goes out of scope
+                std::lock_guard<std::mutex> lock(printMutex);
+                counter++;
+                system("CLS");
+                std::cout << "~ LOADING [";
+                for (int j = 1; j <= counter; j++) std::cout << (char) 219;
+                for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
+                std::cout << "]";
+            }
+            int index = unique[i];
+            detachPixels(sequence[index]);
+            op(sequence[index]);
+        }
+    };
+
+    if (parallel) cv::parallel_for_(cv::Range(0, unique.size()), body);
+    else body(cv::Range(0, unique.size()));
+    for (int i = range.start; i < range.end; i++) if (source[i] != i) sequence[i] = sequence[source[i]];
+    std::cout << "\n~ FINISHED\n";
+}
+
+void Video::setBlurAmount(int blurAmount) {
+    this->blurAmount = blurAmount;
+}
+
+void Video::setBlackWhite(bool blackWhite) {
+    this->blackWhite = blackWhite;
+}
+
+void Video::setCartoon(bool cartoon) {
+    this->cartoon = cartoon;
+}
+
+void Video::setBrightness(double brightness) {
+    this->brightness = brightness;
+}
+
+void Video::setContrast(double contrast) {
+    this->contrast = contrast;
+}
+
+void Video::setHue(int hue) {
+    this->hue = hue;
+}
+
+void Video::setFrameRange(const string &operation, const cv::Range &frames) {
+    if (frames.start < 0 || frames.end <= frames.start) spans.erase(operation);
+    else spans[operation] = frames;
+}
+
+std::vector<int> Video::cuts(int size) const {
+    std::set<int> edges = {0, size};
+    for (const auto &entry: spans) {
+        edges.insert(std::min(entry.second.start, size));
+        edges.insert(std::min(entry.second.end, size));
+    }
+    return std::vector<int>(edges.begin(), edges.end());
+}
+
+void Video::halve(std::vector<Op> &ops, cv::Size frame) {
+    int width = frame.width;
+    auto last = ops.end();
+    if (!ops.empty() && ops.back().kind == Op::RESIZE) last = ops.end() - 1;
+    // the crop comes right before the resize
+    auto crop = last == ops.begin() ? ops.end() : last - 1;
+    if (crop != ops.end() && crop->kind == Op::CROP) {
+        cv::Rect kept = crop->rect & cv::Rect(cv::Point(0, 0), frame);
+        if (kept.area() > 0) width = kept.width;
+    }
+    if (last != ops.end()) width = std::min(width, last->width);
+    Op half = Op::resize(std::max(2, width / 2));
+    if (last != ops.end()) *last = half;
+    else ops.push_back(half);
+}
+
+void Video::addOps(std::vector<Op> &ops, cv::Size frame, int index) const {
+    // operations limited to frames that don't include index are left out
+    auto covers = [this, index](const string &operation) {
+        if (index < 0) return true;
+        auto it = spans.find(operation);
+        return it == spans.end() || (index >= it->second.start && index < it->second.end);
+    };
+    bool report = index < 0;
+    if (contrast != 1 && covers("contrast")) {
+        if (contrast < 0 || contrast > 10) {
+            if (report)
+                std::cout << "~ The contrast value: " << contrast << " falls outside the valid range of [0,10]\n";
+        } else {
+            std::ostringstream label;
+            label << "contrast " << contrast;
+            ops.push_back(regions.limit(Op::linear(contrast, 0, label.str()), "contrast", frame));
+        }
+    }
+    if (brightness != 0 && covers("brightness")) {
+        if (brightness < -100 || brightness > 100) {
+            if (report)
+                std::cout << "~ The brightness value: " << brightness
+                          << " falls outside the valid range of [-100,100]\n";
+        } else ops.push_back(regions.limit(Op::linear(1, brightness, "brightness " + std::to_string((int) brightness)),
+                                         "brightness", frame));
+    }
+    if (hue != 0 && covers("hue")) {
+        if (hue < 0 || hue > 180) {
+            if (report) std::cout << "The hue value: " << hue << " falls outside the valid range of [0,180]";
+        } else ops.push_back(regions.limit(Op::hueShift(hue), "hue", frame));
+    }
+    if (blurAmount > 0 && covers("blur"))
+        ops.push_back(regions.limit(Op::blur(blurAmount % 2 == 0 ? blurAmount + 1 : blurAmount), "blur", frame));
+    if (blackWhite == true && covers("bw")) ops.push_back(regions.limit(Op::bw(), "bw", frame));
+    if (cartoon == true && covers("cartoon")) ops.push_back(regions.limit(Op::cartoon(), "cartoon", frame));
+    if (crop.area() > 0) ops.push_back(Op::crop(crop));
+    if (width > 0) ops.push_back(Op::resize(width));
+}
+
+void Video::setCrop(const cv::Rect &crop) {
+    this->crop = crop;
+}
+
+void Video::setWidth(int width) {
+    this->width = width;
+}
+
+void Video::applyAll() {
+    // every piece is planned for the size the frames had before the apply, the first pieces
+    // are cropped and resized by the time the later ones are planned
+    cv::Size before = this->frameSize();
+    // reports the settings out of range once, the pieces leave them out quietly
+    std::vector<Op> all;
+    this->addOps(all, before);
+    if (sequence.empty()) return;
+    // a piece without any operations is left as it is, so the work follows the frames that change
+    int size = (int) sequence.size();
+    std::vector<int> edges = this->cuts((int) sequence.size());
+    int untouched = 0;
+    bool failed = false;
+    for (size_t p = 0; p + 1 < edges.size(); p++) {
+        cv::Range piece(edges[p], edges[p + 1]);
+        std::vector<Op> ops;
+        this->addOps(ops, before, piece.start);
+        Plan plan = Planner::plan(ops, before);
+        if (Planner::explain) {
+            if (!spans.empty()) cout << "Frames " << piece.start << " to " << piece.end - 1 << ":\n";
+            plan.explain(cout);
+        }
+        if (plan.empty()) {
+            untouched += piece.size();
+            continue;
+        }
+        try {
+            // the whole plan runs on a frame while it is in cache, instead of one pass over the video per operation
+            if (yuv) forEachFrame([&plan](Mat &frame) { plan.runYuv(frame); }, true, piece);
+            else forEachFrame([&plan](Mat &frame) { plan.run(frame); }, true, piece);
+        }
+        catch (...) {
+            cout << "~ APPLYING CHANGES FAILED\n";
+            failed = true;
+        }
+    }
+    if (untouched > 0 && untouched < size) cout << "~ " << untouched << " FRAMES WERE LEFT AS THEY WERE\n";
+    // the crop and the width are in the frames now, the next apply would crop the crop,
+    // and the regions move with the pixels
+    if (failed) return;
+    cv::Rect area(0, 0, before.width, before.height);
+    if (crop.area() > 0 && (crop & area).area() > 0) area &= crop;
+    if (this->frameSize() != before) regions.reframe(area, before, this->frameSize());
+    crop = cv::Rect(), width = 0;
+}
+
+class MyException:public std::exception {
+public:
+    virtual const char* what() const throw() {
+        return "~ FAILED TO IMPORT FILES\n";
+    }
+} importException;
+
+// bytes held by a list of frames, a buffer shared by several of them counts once
+size_t frameBytes(const std::vector<Mat> &frames) {
+    size_t total = 0;
+    std::unordered_set<const uchar *> seen;
+    for (const Mat &frame: frames)
+        if (seen.insert(frame.data).second) total += frame.total() * frame.elemSize();
+    return total;
+}
+
+// keeps the pixels of the files of all projects under one memory budget
+// files report how many bytes their pixels hold and when the total goes over the budget
+// the least recently used files that aren't pinned get evicted
+class MemoryGovernor {
+private:
+    struct Asset {
+        string label;
+        size_t bytes;
+        bool pinned;
+        std::function<bool()> evict; // frees the pixels, false when they couldn't be brought back later
+        std::list<const void *>::iterator position;
+    };
+
+    static MemoryGovernor *singleton;
+    std::unordered_map<const void *, Asset> assets;
+    std::list<const void *> recent; // most recently used first
+    size_t budget, used, evictions;
+    mutable std::mutex mutex;
+
+    MemoryGovernor() : budget(1024ull * 1024 * 1024), used(0), evictions(0) {}
+    void enforce();
+public:
+    MemoryGovernor(const MemoryGovernor &) = delete;
+    static MemoryGovernor *getInstance();
+
+    void track(const void *owner, const string &label, size_t bytes, std::function<bool()> evict);
+    void untrack(const void *owner);
+    // new size of the pixels of owner, also marks it as used
+    void update(const void *owner, size_t bytes);
+    void touch(const void *owner);
+    void pin(const void *owner, bool pinned);
+
+    void setBudget(size_t bytes);
+    size_t getBudget() const;
+    size_t getUsed() const;
+    void report(ostream &out) const;
+};
+
+MemoryGovernor *MemoryGovernor::singleton = NULL;
+
+MemoryGovernor *MemoryGovernor::getInstance() {
+    if (!singleton) singleton = new MemoryGovernor();
+    return singleton;
+}
+
+void MemoryGovernor::track(const void *owner, const string &label, size_t bytes, std::function<bool()> evict) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (assets.find(owner) != assets.end()) return;
+        recent.push_front(owner);
+        assets[owner] = Asset{label, bytes, false, evict, recent.begin()};
+        used += bytes;
+    }
+    this->enforce();
+}
+
+void MemoryGovernor::untrack(const void *owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = assets.find(owner);
+    if (it == assets.end()) return;
+    used -= it->second.bytes;
+    recent.erase(it->second.position);
+    assets.erase(it);
+}
+
+void MemoryGovernor::update(const void *owner, size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = assets.find(owner);
+        if (it == assets.end()) return;
+        used = used - it->second.bytes + bytes;
+        it->second.bytes = bytes;
+        recent.splice(recent.begin(), recent, it->second.position);
+    }
+    this->enforce();
+}
+
+void MemoryGovernor::touch(const void *owner) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = assets.find(owner);
+    if (it != assets.end()) recent.splice(recent.begin(), recent, it->second.position);
+}
+
+void MemoryGovernor::pin(const void *owner, bool pinned) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = assets.find(owner);
+    if (it != assets.end()) it->second.pinned = pinned;
+}
+
+void MemoryGovernor::setBudget(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+    }
+    this->enforce();
+}
+
+size_t MemoryGovernor::getBudget() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget;
+}
+
+size_t MemoryGovernor::getUsed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+void MemoryGovernor::enforce() {
+    std::vector<std::pair<const void *, std::function<bool()>>> victims;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (used <= budget) return;
+        size_t over = used - budget;
+        // least recently used first
+        for (auto it = recent.rbegin(); it != recent.rend() && over > 0; it++) {
+            const Asset &asset = assets.at(*it);
+            if (asset.pinned || asset.bytes == 0) continue;
+            victims.push_back({*it, asset.evict});
+            over -= std::min(over, asset.bytes);
+        }
+    }
+
+    // the callbacks run unlocked because they touch the files
+    for (auto &victim: victims) {
+        bool evicted = victim.second();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = assets.find(victim.first);
+        if (evicted && found != assets.end()) {
+            used -= found->second.bytes;
+            found->second.bytes = 0;
+            evictions++;
+        }
+    }
+    // evicted pixels would otherwise wait in the free lists of the pool
+    if (!victims.empty()) PixelPool::getInstance()->trim();
+}
+
+void MemoryGovernor::report(ostream &out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t resident = 0;
+    for (const auto &it: assets) resident += it.second.bytes > 0;
+
+    out << "Memory budget: " << budget / (1024 * 1024) << " MB\n";
+    out << "Pixels in memory: " << used / (1024 * 1024) << " MB\n";
+    out << "Files: " << assets.size() << " (" << resident << " in memory, " << assets.size() - resident
+        << " evicted)\n";
+    out << "Evictions: " << evictions << endl;
+    for (const void *owner: recent) {
+        const Asset &asset = assets.at(owner);
+        if (asset.bytes > 0)
+            out << "\t" << asset.label << ": " << asset.bytes / 1024 << " KB" << (asset.pinned ? " (open)" : "")
+                << endl;
+    }
+}
+
+// version history of a file, every version is a list of frames cut into tiles
+// tiles that didn't change from the previous version are shared instead of copied (copy on write)
+class VersionHistory {
+public:
+    static size_t defaultCap; // bytes
+private:
+    struct Tile {
+        Mat pixels; // empty when the tile is compressed
+        std::vector<uchar> packed; // RawImage record of the pixels, lz4 compressed
+        uint64_t hash;
+    };
+    typedef std::shared_ptr<Tile> TilePtr;
+    struct Frame {
+        int rows, cols, type;
+        std::vector<TilePtr> tiles; // row major
+    };
+    struct Version {
+        std::vector<Frame> frames;
+        string recipe; // edits that produced the frames
+    };
+
+    static constexpr int tileSize = 256;
+    std::deque<Version> versions;
+    size_t cursor; // index of the current version
+    int first; // version number of versions.front(), grows when old versions are evicted
+    size_t cap;
+
+    Frame cut(const Mat &frame, const Frame *previous) const;
+    Mat assemble(const Frame &frame) const;
+    static const Mat &pixels(const TilePtr &tile, Mat &buffer);
+    static size_t bytes(const Tile &tile);
+    void enforceCap();
+public:
+    VersionHistory(size_t cap = defaultCap) : cursor(0), first(0), cap(cap) {}
+
+    // stores frames as the newest version, versions that could be redone are dropped
+    void record(const std::vector<Mat> &frames, const string &recipe);
+    bool empty() const { return versions.empty(); }
+    bool canUndo() const { return cursor > 0; }
+    bool canRedo() const { return cursor + 1 < versions.size(); }
+    std::vector<Mat> undo();
+    std::vector<Mat> redo();
+    std::vector<Mat> restore() const;
+    string recipe() const { return versions.empty() ? "" : versions[cursor].recipe; }
+    // every version kept, oldest first, for saving the whole history
+    size_t size() const { return versions.size(); }
+    size_t position() const { return cursor; }
+    std::vector<Mat> version(size_t index) const;
+    size_t frames(size_t index) const { return versions[index].frames.size(); }
+    string recipe(size_t index) const { return versions[index].recipe; }
+    // changes when a version is recorded or evicted, not when undo and redo move between them
+    uint64_t fingerprint() const;
+
+    int number() const { return first + (int) cursor; }
+    size_t memoryUsage() const;
+    void setCap(size_t cap);
+};
+
+size_t VersionHistory::defaultCap = 512ull * 1024 * 1024;
+
+size_t VersionHistory::bytes(const Tile &tile) {
+    if (!tile.pixels.empty()) return tile.pixels.total() * tile.pixels.elemSize();
+    return tile.packed.size();
+}
+
+const Mat &VersionHistory::pixels(const TilePtr &tile, Mat &buffer) {
+    if (!tile->pixels.empty()) return tile->pixels;
+    RawImage::decode(tile->packed.data(), tile->packed.size(), buffer, true);
+    return buffer;
+}
+
+VersionHistory::Frame VersionHistory::cut(const Mat &frame, const Frame *previous) const {
+    Frame result;
+    result.rows = frame.rows;
+    result.cols = frame.cols;
+    result.type = frame.type();
+    // tiles can only be shared with a frame of the same geometry
+    if (previous != NULL && (previous->rows != frame.rows || previous->cols != frame.cols ||
+                             previous->type != frame.type()))
+        previous = NULL;
+
+    int index = 0;
+    for (int y = 0; y < frame.rows; y += tileSize)
+        for (int x = 0; x < frame.cols; x += tileSize, index++) {
+            Mat view = frame(cv::Rect(x, y, std::min(tileSize, frame.cols - x), std::min(tileSize, frame.rows - y)));
+            uint64_t hash = hashMat(view);
+
+            if (previous != NULL && previous->tiles[index]->hash == hash) {
+                Mat buffer;
+                const Mat &old = pixels(previous->tiles[index], buffer);
+                bool same = true;
+                size_t rowBytes = view.cols * view.elemSize();
+                for (int i = 0; i < view.rows && same; i++)
+                    same = std::memcmp(view.ptr(i), old.ptr(i), rowBytes) == 0;
+                if (same) {
+                    result.tiles.push_back(previous->tiles[index]);
+                    continue;
+                }
+            }
+
+            TilePtr tile = std::make_shared<Tile>();
+            tile->pixels = view.clone();
+            tile->hash = hash;
+            result.tiles.push_back(tile);
+        }
+    return result;
+}
+
+Mat VersionHistory::assemble(const Frame &frame) const {
+    Mat result(frame.rows, frame.cols, frame.type);
+    int index = 0;
+    for (int y = 0; y < frame.rows; y += tileSize)
+        for (int x = 0; x < frame.cols; x += tileSize, index++) {
+            Mat buffer, target = result(cv::Rect(x, y, std::min(tileSize, frame.cols - x),
+                                                 std::min(tileSize, frame.rows - y)));
+            pixels(frame.tiles[index], buffer).copyTo(target);
+        }
+    return result;
+}
+
+void VersionHistory::record(const std::vector<Mat> &frames, const string &recipe) {
+    if (!versions.empty()) versions.erase(versions.begin() + cursor + 1, versions.end());
+
+    Version version;
+    version.recipe = recipe;
+    const std::vector<Frame> *previous = versions.empty() ? NULL : &versions.back().frames;
+    for (size_t i = 0; i < frames.size(); i++)
+        version.frames.push_back(
+                this->cut(frames[i], previous != NULL && i < previous->size() ? &(*previous)[i] : NULL));
+
+    versions.push_back(std::move(version));
+    cursor = versions.size() - 1;
+    this->enforceCap();
+}
+
+std::vector<Mat> VersionHistory::restore() const {
+    if (versions.empty()) return std::vector<Mat>();
+    return this->version(cursor);
+}
+
+std::vector<Mat> VersionHistory::version(size_t index) const {
+    std::vector<Mat> frames;
+    for (const Frame &frame: versions[index].frames) frames.push_back(this->assemble(frame));
+    return frames;
+}
+
+uint64_t VersionHistory::fingerprint() const {
+    uint64_t hash = hashBytes((const uchar *) &first, sizeof(first));
+    for (const Version &version: versions) {
+        hash = hashBytes((const uchar *) version.recipe.data(), version.recipe.size(), hash);
+        for (const Frame &frame: version.frames) {
+            int shape[3] = {frame.rows, frame.cols, frame.type};
+            hash = hashBytes((const uchar *) shape, sizeof(shape), hash);
+            for (const TilePtr &tile: frame.tiles)
+                hash = hashBytes((const uchar *) &tile->hash, sizeof(tile->hash), hash);
+        }
+    }
+    return hash;
+}
+
+std::vector<Mat> VersionHistory::undo() {
+    if (this->canUndo()) cursor--;
+    return this->restore();
+}
+
+std::vector<Mat> VersionHistory::redo() {
+    if (this->canRedo()) cursor++;
+    return this->restore();
+}
+
+size_t VersionHistory::memoryUsage() const {
+    // shared tiles are counted once
+    std::unordered_set<const Tile *> seen;
+    size_t total = 0;
+    for (const Version &version: versions)
+        for (const Frame &frame: version.frames)
+            for (const TilePtr &tile: frame.tiles)
+                if (seen.insert(tile.get()).second) total += bytes(*tile);
+    return total;
+}
+
+void VersionHistory::setCap(size_t cap) {
+    this->cap = cap;
+    this->enforceCap();
+}
+
+void VersionHistory::enforceCap() {
+    size_t usage = this->memoryUsage();
+    if (usage <= cap) return;
+
+    // first compress the tiles the current version doesn't use, oldest versions first
+    std::unordered_set<const Tile *> live;
+    for (const Frame &frame: versions[cursor].frames)
+        for (const TilePtr &tile: frame.tiles) live.insert(tile.get());
+
+    for (size_t v = 0; v < versions.size() && usage > cap; v++) {
+        if (v == cursor) continue;
+        for (Frame &frame: versions[v].frames)
+            for (TilePtr &tile: frame.tiles) {
+                if (usage <= cap) break;
+                if (tile->pixels.empty() || live.count(tile.get())) continue;
+                size_t before = bytes(*tile);
+                RawImage::encode(tile->pixels, tile->packed, RawImage::LZ4);
+                tile->pixels.release();
+                usage = usage - before + bytes(*tile);
+            }
+    }
+
+    // then drop the versions farthest away from the current one
+    while (usage > cap && versions.size() > 1) {
+        if (cursor > 0) {
+            versions.pop_front();
+            cursor--;
+            first++;
+        } else versions.pop_back();
+        usage = this->memoryUsage();
+    }
+}
+
+// filter used by paged listings, empty fields match everything
+struct CatalogFilter {
+    string name; // part of the file name
+    string type; // part of the class name returned by getType()
+    int favorite; // -1 = any, 0 = not favorite, 1 = favorite
+
+    CatalogFilter() : favorite(-1) {}
+    bool empty() const { return name.empty() && type.empty() && favorite == -1; }
+};
+
+template<class T>
+class Catalog {
+public:
+    typedef unsigned int Id;
+    static constexpr Id none = 0;
+
+    struct Entry {
+        Id id;
+        std::unique_ptr<T> file;
+        VersionHistory history;
+        string key; // sort key, taken once when the file is inserted
+    };
+private:
+    Id nextId;
+    std::unordered_map<Id, Entry> entries; // stable id -> entry, O(1) lookup
+    std::vector<Id> order; // ids sorted by (key, id), kept sorted on insert/erase instead of resorting
+
+    bool before(Id a, Id b) const;
+    bool accepts(const Entry &entry, const CatalogFilter &filter) const;
+public:
+    Catalog() : nextId(1) {}
+    Catalog(const Catalog &) = delete;
+    Catalog &operator=(const Catalog &) = delete;
+    // the catalog owns its files
+    ~Catalog() { this->clear(); }
+
+    Id insert(std::unique_ptr<T> file);
+    void erase(Id id);
+    void clear();
+
+    Entry *find(Id id);
+    const Entry *find(Id id) const;
+    T *get(Id id) const;
+    // id of the file at position index in sort order
+    Id at(size_t index) const { return order[index]; }
+    size_t size() const { return order.size(); }
+    bool empty() const { return order.empty(); }
+
+    // ids of the page-th page of files matching the filter, matches gets the total number of matching files
+    std::vector<Id> page(const CatalogFilter &filter, size_t page, size_t pageSize, size_t &matches) const;
+
+    // iteration in sort order
+    typename std::vector<Id>::const_iterator begin() const { return order.begin(); }
+    typename std::vector<Id>::const_iterator end() const { return order.end(); }
+};
+
+template<class T>
+bool Catalog<T>::before(Id a, Id b) const {
+    const Entry &x = entries.at(a), &y = entries.at(b);
+    if (x.key != y.key) return x.key < y.key;
+    return a < b;
+}
+
+template<class T>
+bool Catalog<T>::accepts(const Entry &entry, const CatalogFilter &filter) const {
+    if (!filter.name.empty() && entry.key.find(filter.name) == string::npos) return false;
+    if (!filter.type.empty() && entry.file->getType().find(filter.type) == string::npos) return false;
+    if (filter.favorite != -1 && entry.file->isFavorite() != (filter.favorite == 1)) return false;
+    return true;
+}
+
+template<class T>
+typename Catalog<T>::Id Catalog<T>::insert(std::unique_ptr<T> file) {
+    Id id = nextId++;
+    string key = file->getName();
+    entries.emplace(id, Entry{id, std::move(file), VersionHistory(), key});
+    // binary search for the position, the vector only shifts the tail
+    auto it = std::lower_bound(order.begin(), order.end(), id,
+                               [this](Id a, Id b) { return this->before(a, b); });
+    order.insert(it, id);
+    return id;
+}
+
+template<class T>
+void Catalog<T>::erase(Id id) {
+    if (entries.find(id) == entries.end()) return;
+    auto it = std::lower_bound(order.begin(), order.end(), id,
+                               [this](Id a, Id b) { return this->before(a, b); });
+    if (it != order.end() && *it == id) order.erase(it);
+    entries.erase(id);
+}
+
+template<class T>
+void Catalog<T>::clear() {
+    entries.clear();
+    order.clear();
+}
+
+template<class T>
+typename Catalog<T>::Entry *Catalog<T>::find(Id id) {
+    auto it = entries.find(id);
+    return it == entries.end() ? NULL : &it->second;
+}
+
+template<class T>
+const typename Catalog<T>::Entry *Catalog<T>::find(Id id) const {
+    auto it = entries.find(id);
+    return it == entries.end() ? NULL : &it->second;
+}
+
+template<class T>
+T *Catalog<T>::get(Id id) const {
+    const Entry *entry = this->find(id);
+    return entry == NULL ? NULL : entry->file.get();
+}
+
+template<class T>
+std::vector<typename Catalog<T>::Id> Catalog<T>::page(const CatalogFilter &filter, size_t page, size_t pageSize,
+                                                      size_t &matches) const {
+    std::vector<Id> result;
+    size_t first = page * pageSize;
+
+    // without a filter the page is a slice of the sort index
+    if (filter.empty()) {
+        matches = order.size();
+        for (size_t i = first; i < order.size() && i < first + pageSize; i++) result.push_back(order[i]);
+        return result;
+    }
+
+    matches = 0;
+    for (Id id: order)
+        if (this->accepts(entries.at(id), filter)) {
+            if (matches >= first && matches < first + pageSize) result.push_back(id);
+            matches++;
+        }
+    return result;
+}
+
+// append-only log of the edits done since the last snapshot of a project
+// records are buffered and written by a background thread that puts many records on disk
+// with a single fsync (group commit), so logging an edit never waits for the disk
+class Journal {
+private:
+    string path;
+    std::FILE *file;
+    bool opened, stopping;
+    std::vector<string> pending; // records not written yet
+    // compaction waiting for the writer thread
+    bool compactionPending;
+    // records the pending snapshot contains, they go to the old journal if it can't be swapped in
+    std::vector<string> folded;
+    string snapshotPath, snapshotData, base;
+    size_t appended, written, sinceCompaction;
+    mutable std::mutex mutex;
+    std::condition_variable wake, done;
+    std::thread writer;
+
+    static constexpr int commitInterval = 50; // ms between group commits
+    static constexpr size_t commitBatch = 64; // pending records that trigger an early commit
+
+    void run();
+    static void sync(std::FILE *file);
+public:
+    Journal() : file(NULL), opened(false), stopping(false), compactionPending(false), appended(0), written(0),
+                sinceCompaction(0) {}
+    ~Journal() { this->close(); }
+
+    bool open(const string &path);
+    void close();
+    bool isOpen() const { return opened; }
+    void append(const string &record);
+    // replaces the snapshot with snapshotData and starts the journal over with the base record
+    void compact(const string &snapshotPath, const string &snapshotData, const string &base);
+    // waits until everything appended so far is on disk
+    void flush();
+    // records appended since the last compaction
+    size_t size() const;
+
+    // complete records of a journal file, a record torn by a crash is ignored
+    static std::vector<string> load(const string &path);
+    // writes data to a file and syncs it
+    static bool writeFile(const string &path, const string &data);
+    // writes data to a temporary file, syncs it and renames it over path
+    static bool replaceFile(const string &path, const string &data);
+};
+
+void Journal::sync(std::FILE *file) {
+    std::fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+bool Journal::writeFile(const string &path, const string &data) {
+    std::FILE *out = std::fopen(path.c_str(), "wb");
+    if (out == NULL) return false;
+    bool ok = std::fwrite(data.data(), 1, data.size(), out) == data.size();
+    sync(out);
+    std::fclose(out);
+    return ok;
+}
+
+bool Journal::replaceFile(const string &path, const string &data) {
+    string temp = path + ".tmp";
+    if (!writeFile(temp, data)) return false;
+
+    std::error_code error;
+    std::filesystem::rename(temp, path, error);
+    return !error;
+}
+
+std::vector<string> Journal::load(const string &path) {
+    std::vector<string> records;
+    std::ifstream in(path, std::ios_base::binary);
+    string line;
+    while (std::getline(in, line))
+        // getline also returns the last line when it has no newline, that one was torn
+        if (!in.eof()) records.push_back(line);
+    return records;
+}
+
+bool Journal::open(const string &path) {
+    this->close();
+    this->path = path;
+    file = std::fopen(path.c_str(), "ab");
+    if (file == NULL) return false;
+
+    opened = true;
+    stopping = false;
+    appended = written = sinceCompaction = 0;
+    writer = std::thread(&Journal::run, this);
+    return true;
+}
+
+void Journal::close() {
+    if (!opened) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    if (file != NULL) std::fclose(file);
+    file = NULL;
+    opened = false;
+}
+
+void Journal::append(const string &record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(record);
+    appended++;
+    sinceCompaction++;
+    if (pending.size() >= commitBatch) wake.notify_one();
+}
+
+void Journal::compact(const string &snapshotPath, const string &snapshotData, const string &base) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // the snapshot already contains the edits that weren't written yet
+    folded.insert(folded.end(), pending.begin(), pending.end());
+    pending.clear();
+    this->snapshotPath = snapshotPath;
+    this->snapshotData = snapshotData;
+    this->base = base;
+    compactionPending = true;
+    sinceCompaction = 0;
+    wake.notify_one();
+}
+
+void Journal::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.notify_one();
+    done.wait(lock, [this] { return written >= appended && !compactionPending; });
+}
+
+size_t Journal::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sinceCompaction;
+}
+
+void Journal::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait_for(lock, std::chrono::milliseconds(commitInterval),
+                      [this] { return stopping || compactionPending || pending.size() >= commitBatch; });
+
+        bool compaction = compactionPending;
+        string snapshot, data, record;
+        std::vector<string> kept;
+        if (compaction) snapshot.swap(snapshotPath), data.swap(snapshotData), record.swap(base), kept.swap(folded);
+        std::vector<string> batch;
+        batch.swap(pending);
+        lock.unlock();
+        size_t finished = kept.size() + batch.size();
+
+        if (compaction) {
+            // both files are on disk before either is swapped in, so the swaps are all that can fail;
+            // the journal is closed meanwhile, windows can't rename over a file that is open
+            bool swapped = false;
+            if (writeFile(snapshot + ".tmp", data) && writeFile(path + ".tmp", record + "\n")) {
+                if (file != NULL) std::fclose(file);
+                file = NULL;
+                std::error_code error;
+                std::filesystem::rename(snapshot + ".tmp", snapshot, error);
+                if (!error) {
+                    swapped = true;
+                    // the snapshot is already replaced, so the journal has to start over from its base,
+                    // rewritten in place when it can't be renamed
+                    std::filesystem::rename(path + ".tmp", path, error);
+                    if (error && !writeFile(path, record + "\n")) cout << "~ AUTOSAVE FAILED TO RESTART\n";
+                }
+                file = std::fopen(path.c_str(), "ab");
+            }
+            // the old snapshot is still the one on disk, the records folded into the new one stay in the journal
+            if (!swapped) batch.insert(batch.begin(), kept.begin(), kept.end());
+        }
+        if (!batch.empty() && file != NULL) {
+            for (const string &it: batch) {
+                std::fwrite(it.data(), 1, it.size(), file);
+                std::fputc('\n', file);
+            }
+            sync(file);
+        }
+
+        lock.lock();
+        if (compaction) compactionPending = false;
+        written += finished;
+        done.notify_all();
+        if (stopping && pending.empty() && !compactionPending) return;
+    }
+}
+
+template<class T>
+class Project {
+private:
+    typedef typename Catalog<T>::Id Id;
+
+    string name;
+    T *current;
+    Id currentId;
+    Catalog<T> files; // files with stable ids, sort index and version history of each file
+    CatalogFilter filter; // filter used when listing files
+    static constexpr size_t pageSize = 10;
+    Journal journal; // autosave of the edits done since the last snapshot
+    bool replaying; // replayed edits aren't logged again
+    static constexpr size_t compactEvery = 256; // journal records folded into a new snapshot
+    // histories of edited files saved by compactions, removed once the journal doesn't point at them
+    std::vector<string> pixelFiles;
+    // the last file each history was saved to with the fingerprint of the history then, the next
+    // compaction points at it again while the history is the same
+    std::map<Id, std::pair<uint64_t, string>> savedPixels;
+
+    int currentVersion() const;
+    void select(Id id);
+    Id chooseFile();
+
+    // memory budget of the pixels
+    void track(Id id);
+    void untrackAll();
+    void account(Id id);
+    bool evictFile(Id id);
+    void materialize(Id id);
+    // pixels that can't be restored from a source or a history are spilled to raw files
+    string spillPath(Id id) const { return "../.spill/" + name + "_" + std::to_string(id) + ".raw"; }
+    void removeSpill(Id id) const;
+
+    void exportAll();
+    // the clips one after another in a single video, only video projects have one
+    void exportTimeline();
+    // asks for a list of renditions of the current file and exports them in one job
+    void exportRenditions();
+
+    // edits, shared by the menus and the journal replay
+    Id addFile(std::unique_ptr<T> file);
+    // a copy of the file under a new id, the pixels are shared until one of them is edited
+    Id duplicateFile(Id id);
+    void deleteFile(Id id);
+    void setOption(Id id, const string &option, double value);
+    void setCrop(Id id, const cv::Rect &crop);
+    void setRegion(Id id, const string &operation, const Region &region);
+    void setFrameRange(Id id, const string &operation, const cv::Range &frames);
+    void applyChanges(Id id);
+    void resetFile(Id id);
+    bool undo(Id id);
+    bool redo(Id id);
+
+    string autosavePath(const string &extension) const { return "../" + name + extension; }
+    void log(const string &record);
+    // the pixels record of a file with applied edits, its whole history is written to a file of its own
+    // unless the last one still holds it; empty when there is nothing applied
+    string savePixels(Id id, const string &stamp);
+    void removeStalePixels();
+    void compact();
+    void restartJournal();
+    bool hasAutosave() const;
+    bool replayAutosave();
+    void replay(const string &record, std::map<Id, Id> &ids);
+
+    std::unique_ptr<T> readFile(istream &in);
+    std::vector<Id> load(istream &in);
+    void store(ostream &out) const;
+public:
+    Project() {
+        name = "new project";
+        current = NULL;
+        currentId = Catalog<T>::none;
+        replaying = false;
+    }
+    ~Project() {
+        journal.close();
+        this->untrackAll();
+        for (Id id: files) this->removeSpill(id);
+        if(!files.empty()) files.clear();
+    }
+
+    // doesnt work outside class
+    friend std::istream& operator>>(std::istream &in, Project<T>& obj) {
+        std::cout<<"Enter project name: \n";
+        in>>obj.name;
+
+        obj.startAutosave();
+        obj.menuEngine();
+
+        return in;
+    }
+    friend std::ostream& operator<<(std::ostream &out, const Project<T>& obj) {
+        std::cout<<"Project name: "<<obj.name<<"\n";
+
+        return out;
+    }
+
+    bool operator<(const Project<T>& obj) const{
+        return this->name < obj.name;
+    }
+
+    const string &getName() const {
+        return name;
+    }
+
+    // template methods
+    void displayOptions();
+    void displayEngine();
+    void displayMenu();
+    void menuEngine();
+    void displayEdit();
+    void editEngine();
+    void effectsEngine();
+    void displayEffects();
+    void adjustmentsEngine();
+    void displayAdjusments();
+    // asks for the region one of operations is limited to
+    void regionEngine(const std::vector<string> &operations);
+    // asks for the frames one of operations is limited to
+    void framesEngine(const std::vector<string> &operations);
+
+    void write(string);
+    void read(string);
+    // offers to recover autosaved edits of a project with the same name, then starts autosaving
+    void startAutosave();
+    // loads the autosave of the project with the given name
+    bool recover(const string &projectName);
+};
+
+template<class T>
+int Project<T>::currentVersion() const {
+    const typename Catalog<T>::Entry *entry = files.find(currentId);
+    return entry == NULL ? 0 : entry->history.number();
 }
 
-Video::Video(const Video &obj) : id(counter++) {
-    if (obj.name.empty()) {
-        this->name = "video" + std::to_string(id);
-        this->name += ".mp4";
+template<class T>
+void Project<T>::select(Id id) {
+    MemoryGovernor *governor = MemoryGovernor::getInstance();
+    if (current != NULL) governor->pin(current, false);
+
+    current = files.get(id);
+    currentId = current == NULL ? Catalog<T>::none : id;
+    if (current != NULL) {
+        // the open file is never evicted
+        this->materialize(id);
+        governor->pin(current, true);
     }
-    else this->name = obj.name;
-    this->fps = obj.fps;
-    this->blurAmount = obj.blurAmount;
-    this->hue = obj.hue;
-    this->blackWhite = obj.blackWhite;
-    this->cartoon = obj.cartoon;
-    this->brightness = obj.brightness;
-    this->contrast = obj.contrast;
-    this->capture = capture;
-    this->sequence = sequence;
 }
 
-Video::~Video() {
-    counter = 0;
-    if (!name.empty()) name.clear();
-    fps = 0.0;
-    blurAmount = 0;
-    hue = 0;
-    blackWhite = false;
-    cartoon = false;
-    brightness = 0;
-    contrast = 1;
-    capture.release();
-    if (!sequence.empty()) sequence.clear();
+template<class T>
+void Project<T>::track(Id id) {
+    T *file = files.get(id);
+    MemoryGovernor::getInstance()->track(file, name + "/" + file->getName(), frameBytes(file->getFrames()),
+                                         [this, id]() { return this->evictFile(id); });
 }
 
-Video &Video::operator=(const Video &obj) {
-    if (this != &obj) {
-        if (obj.name.empty()) {
-            this->name = "video" + std::to_string(id);
-            this->name += ".mp4";
-        }
-        else this->name = obj.name;
-        this->fps = obj.fps;
-        this->blurAmount = obj.blurAmount;
-        this->hue = obj.hue;
-        this->blackWhite = obj.blackWhite;
-        this->cartoon = obj.cartoon;
-        this->brightness = obj.brightness;
-        this->contrast = obj.contrast;
-        this->capture = capture;
-        this->sequence = sequence;
-    }
-    return *this;
+template<class T>
+void Project<T>::untrackAll() {
+    for (Id id: files) MemoryGovernor::getInstance()->untrack(files.get(id));
 }
 
-istream &operator>>(istream &in, Video &obj) {
-    if (!obj.name.empty()) obj.name.clear();
-    cout << "Enter name: \n";
-    in >> obj.name;
+template<class T>
+void Project<T>::account(Id id) {
+    T *file = files.get(id);
+    if (file != NULL) MemoryGovernor::getInstance()->update(file, frameBytes(file->getFrames()));
+}
 
-    cout << "Do you want to blur the video? (yes:1 no:0)?\n";
-    int temp;
-    in >> temp;
-    in.get();
-    if (temp == 1) {
-        cout << "Enter blur amount: \n";
-        in >> obj.blurAmount;
-    }
-    cout << "Do you want to apply Black and White effect? (yes:1 no:0)?\n";
-    in >> obj.blackWhite;
-    cout << "Do you want to apply Cartoon effect? (yes:1 no:0)?\n";
-    in >> obj.cartoon;
+template<class T>
+bool Project<T>::evictFile(Id id) {
+    typename Catalog<T>::Entry *entry = files.find(id);
+    if (entry == NULL || id == currentId) return false;
+    // edited pixels come back from the history, unedited ones from the source file,
+    // and recordings from a spill file; stored uncompressed so it maps straight back
+    if (entry->history.empty() && !entry->file->hasSource() &&
+        !RawFile::write(this->spillPath(id), entry->file->getFrames(), RawImage::STORED))
+        return false;
+    entry->file->release();
+    return true;
+}
 
-    in.get();
-    cout << "Enter brightness [-100,100]: \n";
-    in >> obj.brightness;
-    in.get();
-    cout << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
-    in >> obj.contrast;
-    in.get();
-    cout << "Enter hue [0,180]: \n";
-    in >> obj.hue;
-    in.get();
+template<class T>
+void Project<T>::removeSpill(Id id) const {
+    std::error_code error;
+    std::filesystem::remove(this->spillPath(id), error);
+}
 
-    obj.scan();
-    return in;
+template<class T>
+void Project<T>::materialize(Id id) {
+    typename Catalog<T>::Entry *entry = files.find(id);
+    if (entry == NULL || entry->file->isResident()) return;
+    RawFile spill;
+    if (!entry->history.empty()) {
+        entry->file->setFrames(entry->history.restore());
+        entry->file->setRecipe(entry->history.recipe());
+    } else if (spill.open(this->spillPath(id))) {
+        // copied out of the mapping, the file goes away
+        entry->file->setFrames(spill.frames(true));
+        spill.close();
+        this->removeSpill(id);
+    } else entry->file->scan();
+    this->account(id);
 }
 
-ostream &operator<<(ostream &out, const Video &obj) {
-    out << obj.name << endl;
+template<class T>
+typename Project<T>::Id Project<T>::chooseFile() {
+    size_t page = 0;
 
-    out << "Blur amount: " << obj.blurAmount << endl;
-    if (obj.blackWhite == true) out << "Has Black and White effect applied\n";
-    else out << "Doesn't have Black and White effect applied\n";
-    if (obj.cartoon) out << "Has Cartoon effect applied\n";
-    else out << "Doesn't have Cartoon effect applied\n";
+    while (true) {
+        size_t matches = 0;
+        std::vector<Id> ids = files.page(filter, page, pageSize, matches);
+        size_t pages = matches == 0 ? 1 : (matches + pageSize - 1) / pageSize;
+
+        std::cout << "\tPage " << page + 1 << "/" << pages << " (" << matches << " files)\n";
+        for (size_t i = 0; i < ids.size(); i++)
+            std::cout << "\tFile: " << page * pageSize + i << endl, std::cout << *files.get(ids[i]) << endl;
+        if (ThumbnailService::enabled) {
+            std::vector<std::shared_future<Mat>> previews;
+            for (Id id: ids) previews.push_back(files.get(id)->thumbnail());
+            // the next page decodes while this one is looked at
+            size_t ignored;
+            for (Id id: files.page(filter, page + 1, pageSize, ignored)) files.get(id)->thumbnail(false);
+            std::vector<Mat> thumbnails;
+            for (auto &preview: previews) thumbnails.push_back(preview.get());
+            Mat sheet = ThumbnailService::contactSheet(thumbnails, page * pageSize);
+            if (!sheet.empty()) cv::imshow("Files", sheet), cv::waitKey(1);
+        }
 
-    out << "Brightness value: " << obj.brightness << endl;
-    out << "Contrast value: " << obj.contrast << endl;
-    out << "Hue value: " << obj.hue << endl;
-    return out;
+        std::cout << "Choose file (-1: next page, -2: previous page, -3: filter, -4: cancel): \n";
+        long long fileNr;
+        cin >> fileNr;
+        if (std::cin.fail()) {
+            std::cout << "~ INVALID INPUT\n";
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            continue;
+        }
+        cin.get();
+
+        if (fileNr == -1) {
+            if (page + 1 < pages) page++;
+        } else if (fileNr == -2) {
+            if (page > 0) page--;
+        } else if (fileNr == -3) {
+            std::cout << "Enter part of the name (- for any): \n";
+            cin >> filter.name;
+            if (filter.name == "-") filter.name.clear();
+            std::cout << "Enter part of the type (- for any): \n";
+            cin >> filter.type;
+            if (filter.type == "-") filter.type.clear();
+            std::cout << "Favorites only (-1: any, 0: not favorite, 1: favorite)?\n";
+            cin >> filter.favorite;
+            cin.get();
+            page = 0;
+        } else if (fileNr == -4) {
+            if (ThumbnailService::enabled) cv::destroyWindow("Files");
+            return Catalog<T>::none;
+        } else if (fileNr >= (long long) (page * pageSize) && fileNr < (long long) (page * pageSize + ids.size())) {
+            if (ThumbnailService::enabled) cv::destroyWindow("Files");
+            return ids[fileNr - page * pageSize];
+        } else cout << "~ INVALID INDEX\n";
+    }
 }
 
-void Video::scan() {
-    std::chrono::high_resolution_clock::time_point wasted_end;
-    std::chrono::high_resolution_clock::time_point wasted_start;
-    this->capture.open(0);
-    if(!this->sequence.empty()) this->sequence.clear();
-    // takes 35ms for camera to start which can be seen at low length videos
-    // thats why i took in account the wasted time for it
-    try {
-        if (!capture.isOpened()) throw "~ Failed to open camera";
-        cv::Mat frame;
-        bool started = false;
-        auto start = std::chrono::high_resolution_clock::now();
-        wasted_start = std::chrono::high_resolution_clock::now();
-        auto time_elapsed_start = std::chrono::high_resolution_clock::now();
-        auto last_time_output = std::chrono::duration_cast<std::chrono::seconds>(time_elapsed_start - start).count();
-        while (capture.read(frame)) {
-            if (!started) {
-                started = true;
-                wasted_end = std::chrono::high_resolution_clock::now();
-            }
-            sequence.push_back(frame.clone());
+template<class T>
+void Project<T>::exportAll() {
+    size_t written = 0, cached = 0;
+    for (Id id: files) {
+        T *file = files.get(id);
+        // cached renders are only copied, so evicted files don't need their pixels back
+        if (file->isCached()) cached++;
+        else this->materialize(id);
+        file->write();
+        written++;
+    }
+    EncoderPool::getInstance()->wait();
+    cout << "~ EXPORTED " << written << " FILES (" << cached << " FROM RENDER CACHE)\n";
+}
 
-            cv::imshow("Camera feed", frame);
+template<class T>
+void Project<T>::exportTimeline() {
+    cout << "~ ONLY VIDEO PROJECTS HAVE A TIMELINE\n";
+}
 
-            // to display video duration
-            auto time_elapsed_end = std::chrono::high_resolution_clock::now();
-            if (last_time_output !=
-                std::chrono::duration_cast<std::chrono::seconds>(time_elapsed_end - time_elapsed_start).count()) {
-                last_time_output = std::chrono::duration_cast<std::chrono::seconds>(
-                        time_elapsed_end - time_elapsed_start).count();
-                system("CLS");
-                std::cout << "Video duration: " << std::chrono::duration_cast<std::chrono::seconds>(
-                        time_elapsed_end - time_elapsed_start).count() << " seconds";
+// workers get the next clips ready, one clip each at a time, while this thread encodes them in order;
+// the frames waiting for the encoder are kept under half the memory budget
+template<>
+void Project<Video>::exportTimeline() {
+    std::vector<Id> clips;
+    for (Id id: files) clips.push_back(id);
+
+    struct Slot {
+        std::vector<Mat> frames;
+        size_t bytes = 0;
+        bool ready = false;
+    };
+    std::vector<Slot> slots(clips.size());
+    std::mutex mutex;
+    std::mutex catalog; // the files and the memory governor are used by one worker at a time
+    std::condition_variable changed;
+    size_t waiting = 0; // bytes of the clips ready that aren't encoded yet
+    size_t written = 0; // clips encoded so far
+    const size_t budget = MemoryGovernor::getInstance()->getBudget() / 2;
+    // the first clip with frames decides the size and the frame rate, the others are scaled and retimed to it
+    cv::Size size;
+    double fps = 0;
+
+    // the pictures of a clip as it is shown, with the settings that weren't applied yet
+    auto load = [&](size_t k, Video *&clip) {
+        std::vector<Mat> frames;
+        bool decode;
+        {
+            std::lock_guard<std::mutex> lock(catalog);
+            Catalog<Video>::Entry *entry = files.find(clips[k]);
+            clip = entry->file.get();
+            // a file that was never edited is decoded by the worker, alongside the others
+            decode = !clip->isResident() && entry->history.empty() && clip->hasSource();
+            if (!decode) {
+                // pinned so making room for the next clips doesn't evict it before its frames are taken
+                bool pinned = clips[k] != currentId;
+                MemoryGovernor *governor = MemoryGovernor::getInstance();
+                if (pinned) governor->pin(clip, true);
+                this->materialize(clips[k]);
+                frames = clip->getFrames();
+                if (pinned) governor->pin(clip, false);
             }
-
-            if (waitKey(1) == 27) break;
         }
-        system("CLS");
-        // recored time it took, and how many frames there are to get the fps of the video
-        // because the camera won't share that info with opencv
-        auto end = std::chrono::high_resolution_clock::now() - (wasted_end - wasted_start);
-        this->fps = sequence.size() / (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0);
-        capture.release();
-        cv::destroyAllWindows();
+        if (decode && !clip->decode(frames)) cout << "~ COULDN'T DECODE " << clip->getName() << endl;
+        // frames that share a buffer are converted once
+        std::unordered_map<const uchar *, Mat> converted;
+        for (Mat &frame: frames) {
+            auto found = converted.find(frame.data);
+            if (found != converted.end()) frame = found->second;
+            else {
+                const uchar *key = frame.data;
+                frame = converted[key] = clip->picture(frame);
+            }
+        }
+        // the settings that weren't applied are part of the clip as it is shown, so they are exported too;
+        // render only reads the frames it is given, another worker may release the clip's own meanwhile
+        clip->render(frames);
+        return frames;
+    };
+
+    // the pictures retimed to the timeline's frame rate and scaled to its size
+    auto fit = [&](std::vector<Mat> &frames, const Video *clip) {
+        // a clip at another frame rate keeps its length, its frames are repeated or dropped
+        double rate = clip->getFps();
+        if (rate > 0 && std::abs(rate - fps) > 0.01 && !frames.empty()) {
+            cout << "~ " << clip->getName() << " IS AT " << rate << " FPS, ITS FRAMES ARE RETIMED TO " << fps << endl;
+            std::vector<Mat> retimed(std::max<size_t>(1, (size_t) std::lround(frames.size() * fps / rate)));
+            for (size_t j = 0; j < retimed.size(); j++)
+                retimed[j] = frames[std::min(frames.size() - 1, (size_t) (j * rate / fps))];
+            frames = std::move(retimed);
+        }
+        std::unordered_map<const uchar *, Mat> converted;
+        for (Mat &frame: frames) {
+            auto found = converted.find(frame.data);
+            if (found != converted.end()) {
+                frame = found->second;
+                continue;
+            }
+            const uchar *key = frame.data;
+            Mat picture = frame;
+            if (picture.channels() == 1) cv::cvtColor(picture, picture, cv::COLOR_GRAY2BGR);
+            if (picture.size() != size) cv::resize(picture, picture, size, 0, 0, cv::INTER_AREA);
+            frame = converted[key] = picture;
+        }
+    };
+
+    auto prepare = [&](size_t k) {
+        Video *clip;
+        std::vector<Mat> frames = load(k, clip);
+        fit(frames, clip);
+        return frames;
+    };
+
+    // the clips up to the first one with frames are prepared here, its rendered frames, with its pending
+    // crop and width, give the output size; the clips before it have nothing to encode
+    size_t first = 0;
+    for (; first < clips.size() && size.area() <= 0; first++) {
+        Video *clip;
+        std::vector<Mat> frames;
+        try { frames = load(first, clip); }
+        catch (...) { cout << "~ PREPARING CLIP " << first << " FAILED\n"; }
+        if (!frames.empty() && clip->getFps() > 0) {
+            size = frames[0].size();
+            fps = clip->getFps();
+            fit(frames, clip);
+            slots[first].bytes = frameBytes(frames);
+            slots[first].frames = std::move(frames);
+            waiting += slots[first].bytes;
+        }
+        slots[first].ready = true;
     }
-    catch (string err) {
-        std::cout << err << endl;
+    if (size.area() <= 0 || fps <= 0) {
+        cout << "~ NO FRAMES TO EXPORT\n";
+        return;
+    }
+    std::atomic<size_t> next(first);
+
+    auto work = [&]() {
+        for (size_t k = next++; k < clips.size(); k = next++) {
+            {
+                // the clip the encoder waits for always goes ahead, so a full budget can't stall it
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return waiting < budget || k == written; });
+            }
+            std::vector<Mat> frames;
+            try { frames = prepare(k); }
+            catch (...) { cout << "~ PREPARING CLIP " << k << " FAILED\n"; }
+            size_t bytes = frameBytes(frames);
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[k].frames = std::move(frames);
+            slots[k].bytes = bytes;
+            slots[k].ready = true;
+            waiting += bytes;
+            changed.notify_all();
+        }
+    };
+
+    size_t threads = Video::timelineThreads;
+    if (threads == 0) threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(threads, clips.size()); i++) workers.emplace_back(work);
+
+    string output = "../Videos/" + name + ".mp4";
+    cv::VideoWriter writer(output, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, size, true);
+    if (!writer.isOpened()) cout << "~ Failed to open the video writer\n";
+    size_t frames = 0;
+    for (size_t k = 0; k < clips.size(); k++) {
+        std::vector<Mat> clip;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return slots[k].ready; });
+            clip = std::move(slots[k].frames);
+        }
+        // the workers still have to be waited for when the writer didn't open
+        if (writer.isOpened()) for (const Mat &frame: clip) writer.write(frame);
+        frames += clip.size();
+        clip.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        waiting -= slots[k].bytes;
+        written++;
+        changed.notify_all();
     }
+    for (std::thread &worker: workers) worker.join();
+    writer.release();
+    cout << "~ EXPORTED " << clips.size() << " CLIPS, " << frames << " FRAMES, TO " << output << endl;
 }
 
-void Video::write() const {
-//    fourcc = video encode MJPG is for mp4 and avi
-//    15 = fps (this is max for my webcam) , size for window, true because it has colors
-    try {
-        bool checkImage = true;
-        if(sequence[0].channels() == 1) checkImage = false;
-        cv::VideoWriter writer("../Videos/" + name, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps,
-                               cv::Size(sequence[0].cols, sequence[0].rows), checkImage);
-
-//        with address so it won't copy each frame
-        for (const auto &frame: sequence) writer.write(frame);
-
-        if (!writer.isOpened()) throw string("~ Failed to open the video writer");
-
-        writer.release();
+template<class T>
+void Project<T>::exportRenditions() {
+    int count;
+    cout << "Enter number of renditions: \n";
+    cin >> count;
+    cin.get();
+    std::vector<Rendition> renditions;
+    for (int i = 0; i < count && cin; i++) {
+        Rendition rendition;
+        cout << "Rendition " << i + 1 << "\n";
+        cout << "Enter format (jpg, png, webp): \n";
+        cin >> rendition.format;
+        if (rendition.format[0] != '.') rendition.format = "." + rendition.format;
+        cout << "Enter quality (jpg and webp 0-100, png compression 0-9, -1 = default): \n";
+        cin >> rendition.quality;
+        cout << "Enter width in pixels (0 = edited width): \n";
+        cin >> rendition.width;
+        cin.get();
+        cout << "Enter output folder (empty = ../Renditions/): \n";
+        std::getline(cin, rendition.directory);
+        if (rendition.directory.empty()) rendition.directory = "../Renditions/";
+        if (rendition.directory.back() != '/' && rendition.directory.back() != '\\') rendition.directory += "/";
+        renditions.push_back(rendition);
     }
-    catch (string err) {
-        std::cout << err << endl;
+    if (!cin) {
+        cout << "~ INVALID INPUT\n";
+        cin.clear();
+        cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        return;
     }
+    current->exportRenditions(renditions);
 }
 
-void Video::show() const {
-    for (const auto &frame: sequence) {
-        // showing each image individualy
-        cv::imshow("Video", frame);
-        // waiting found time before next frame is displayed
-        // 1000.0 for division to work in double/float
-        if (cv::waitKey(1000.0 / fps) == 27) break;
-    }
-    cv::destroyAllWindows();
+template<class T>
+typename Project<T>::Id Project<T>::addFile(std::unique_ptr<T> file) {
+    std::ostringstream record;
+    string type = file->getType();
+    Id id = files.insert(std::move(file));
+    this->track(id);
+    record << "add " << id << " " << type << " ";
+    files.get(id)->serialize(record);
+    this->log(record.str());
+    return id;
 }
 
-void Video::blur() {
-    if (blurAmount > 0)
-        try {
-            if (blurAmount % 2 == 0) blurAmount += 1;
-            // parallelization of for loop to be faster
-            // [&] = captures all variables used within lambda body and access them by reference
-            std::cout << "~ LOADING [          ]";
-            int fraction = floor(((double) sequence.size()) / 10);
-            // atomic variable so one a thread cant read and another write in it at the same time
-            std::atomic<int> counter = 0;
-            // common variable across threads (like static but for threads)
-            std::mutex printMutex;
-            cv::parallel_for_(cv::Range(0, sequence.size()), [&](const cv::Range &range) {
-                for (int i = range.start; i < range.end; i++) {
-                    if (i % fraction == 0 && i != 0 && counter <= 10) {
-                        // locks the variable until it goes out of scope
-                        std::lock_guard<std::mutex> lock(printMutex);
-                        counter++;
-                        system("CLS");
-                        std::cout << "~ LOADING [";
-                        for (int j = 1; j <= counter; j++) std::cout << (char) 219;
-                        for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
-                        std::cout << "]";
-                    }
+template<class T>
+typename Project<T>::Id Project<T>::duplicateFile(Id id) {
+    if (files.get(id) == NULL) return Catalog<T>::none;
+    // a spilled or released file is brought back first so the copy has pixels to share
+    this->materialize(id);
+    Id copy = files.insert(std::make_unique<T>(*files.get(id)));
+    this->track(copy);
+    this->log("duplicate " + std::to_string(copy) + " " + std::to_string(id));
+    return copy;
+}
 
-                    cv::GaussianBlur(sequence[i], sequence[i], cv::Size(blurAmount, blurAmount), 0);
-                }
-            });
-            std::cout << "\n~ FINISHED\n";
-        }
-        catch (...) { cout << "~ APPLYING EFFECT FAILED\n"; }
+template<class T>
+void Project<T>::deleteFile(Id id) {
+    MemoryGovernor::getInstance()->untrack(files.get(id));
+    if (id == currentId) current = NULL, currentId = Catalog<T>::none;
+    this->removeSpill(id);
+    files.erase(id);
+    this->log("delete " + std::to_string(id));
 }
 
-void Video::bw() {
-    if (blackWhite == true)
-        try {
-            std::cout << "~ LOADING [          ]";
-            int fraction = floor(((double) sequence.size()) / 10);
-            int counter = 0;
-            // no parallelization here because it's a pretty fast effect
-            for (int i = 0; i < sequence.size(); i++) {
-                if (i % fraction == 0 && i != 0 && counter <= 10) {
-                    counter++;
-                    system("CLS");
-                    std::cout << "~ LOADING [";
-                    for (int j = 1; j <= counter; j++) std::cout << (char) 219;
-                    for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
-                    std::cout << "]";
-                }
-                cv::cvtColor(sequence[i], sequence[i], cv::COLOR_BGR2GRAY);
-            }
-            std::cout << "\n~ FINISHED\n";
-        }
-        catch (...) { cout << "~ APPLYING EFFECT FAILED\n"; }
+template<class T>
+void Project<T>::setOption(Id id, const string &option, double value) {
+    T *file = files.get(id);
+    if (file == NULL) return;
+
+    if (option == "blur") file->setBlurAmount((int) value);
+    else if (option == "bw") file->setBlackWhite(value != 0);
+    else if (option == "cartoon") file->setCartoon(value != 0);
+    else if (option == "brightness") file->setBrightness(value);
+    else if (option == "contrast") file->setContrast(value);
+    else if (option == "hue") file->setHue((int) value);
+    else if (option.rfind("crop-", 0) == 0) {
+        // journals from before crop records set the crop an edge at a time
+        cv::Rect crop = file->getCrop();
+        if (option == "crop-x") crop.x = (int) value;
+        else if (option == "crop-y") crop.y = (int) value;
+        else if (option == "crop-width") crop.width = (int) value;
+        else if (option == "crop-height") crop.height = (int) value;
+        else return;
+        file->setCrop(crop);
+    }
+    else if (option == "width") file->setWidth((int) value);
+    else return;
+
+    std::ostringstream record;
+    record.precision(17);
+    record << "set " << id << " " << option << " " << value;
+    this->log(record.str());
 }
 
-void Video::cartoon_effect() {
-    if (cartoon == true)
-        try {
-            Mat gray, tresh, edges;
-            std::cout << "~ LOADING [          ]";
-            int fraction = floor(((double) sequence.size()) / 10);
-            int counter = 0;
-            for (int i = 0; i < sequence.size(); i++) {
-                if (i % fraction == 0 && i != 0 && counter <= 10) {
-                    counter++;
-                    system("CLS");
-                    std::cout << "~ LOADING [";
-                    for (int j = 1; j <= counter; j++) std::cout << (char) 219;
-                    for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
-                    std::cout << "]";
-                }
+template<class T>
+void Project<T>::setCrop(Id id, const cv::Rect &crop) {
+    T *file = files.get(id);
+    if (file == NULL) return;
+    file->setCrop(crop);
+    this->log("crop " + std::to_string(id) + " " + std::to_string(crop.x) + " " + std::to_string(crop.y) + " " +
+              std::to_string(crop.width) + " " + std::to_string(crop.height));
+}
 
-                // to check if the image is already gray
-                if (sequence[i].channels() != 1) cv::cvtColor(sequence[i], gray, cv::COLOR_BGR2GRAY);
-                else sequence[i].copyTo(gray);
-
-                // blur image to get a better mask for outlines
-                cv::medianBlur(gray, gray, 7);
-                // create outline using a treshold
-                cv::adaptiveThreshold(gray, tresh, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, 21, 7);
-                // blur initial image with a safer method
-                cv::bilateralFilter(sequence[i], edges, 21, 250, 250);
-                // combine initial blurred image with the outlines
-                cv::bitwise_and(edges, edges, sequence[i], tresh);
-            }
-            std::cout << "\n~ FINISHED\n";
-        }
-        catch (...) { cout << "~ APPLYING EFFECT FAILED\n"; }
+template<class T>
+void Project<T>::setRegion(Id id, const string &operation, const Region &region) {
+    T *file = files.get(id);
+    if (file == NULL) return;
+    file->setRegion(operation, region);
+
+    const cv::Rect &rect = region.rect;
+    std::ostringstream record;
+    record << "region " << id << " " << operation << " " << rect.x << " " << rect.y << " " << rect.width << " "
+           << rect.height << " " << std::quoted(region.mask);
+    this->log(record.str());
 }
 
-void Video::brightness_adjustment() {
-    if (brightness != 0) {
-        try {
-            if (brightness < -100 || brightness > 100) throw brightness;
-            try {
-                std::cout << "~ LOADING [          ]";
-                int fraction = floor(((double) sequence.size()) / 10);
-                int counter = 0;
-                // no parallelization here because it's a pretty fast adjustment
-                for (int i = 0; i < sequence.size(); i++) {
-                    if (i % fraction == 0 && i != 0 && counter <= 10) {
-                        counter++;
-                        system("CLS");
-                        std::cout << "~ LOADING [";
-                        for (int j = 1; j <= counter; j++) std::cout << (char) 219;
-                        for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
-                        std::cout << "]";
-                    }
-                    // rtype == -1 means same type as source image
-                    // alpha = contrast, beta = brightness
-                    sequence[i].convertTo(sequence[i], -1, 1, brightness);
-                }
-                std::cout << "\n~ FINISHED\n";
-            }
-            catch (...) { cout << "~ APPLYING ADJUSTMENT FAILED\n"; }
-        }
-        catch (double bright) {
-            std::cout << "~ The brightness value: " << bright << " falls outside the valid range of [-100,100]\n";
-        }
-    }
+template<class T>
+void Project<T>::setFrameRange(Id id, const string &operation, const cv::Range &frames) {
+    T *file = files.get(id);
+    if (file == NULL) return;
+    file->setFrameRange(operation, frames);
+    this->log("frames " + std::to_string(id) + " " + operation + " " + std::to_string(frames.start) + " " +
+              std::to_string(frames.end));
 }
 
-void Video::contrast_adjustment() {
-    if(contrast != 1)
-        try {
-            if (contrast < 0 && contrast > 10) throw contrast;
-            try {
-                std::cout << "~ LOADING [          ]";
-                int fraction = floor(((double) sequence.size()) / 10);
-                int temp;
-                cin >> temp;
-                int counter = 0;
-                // no parallelization here because it's a pretty fast adjustment
-                for (int i = 0; i < sequence.size(); i++) {
-                    if (i % fraction == 0 && i != 0 && counter <= 10) {
-                        counter++;
-                        system("CLS");
-                        std::cout << "~ LOADING [";
-                        for (int j = 1; j <= counter; j++) std::cout << (char) 219;
-                        for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
-                        std::cout << "]";
-                    }
-                    // rtype == -1 means same type as source image
-                    // alpha = contrast, beta = brightness
-                    sequence[i].convertTo(sequence[i], -1, contrast, 0);
-                }
-                std::cout << "\n~ FINISHED\n";
-            }
-            catch (...) { cout << "~ APPLYING ADJUSTMENT FAILED\n"; }
-        }
-        catch (double cont) {
-            std::cout << "~ The contrast value: " << cont << " falls outside the valid range of [0,10]\n";
-        }
+template<class T>
+void Project<T>::applyChanges(Id id) {
+    typename Catalog<T>::Entry *entry = files.find(id);
+    if (entry == NULL) return;
+    this->materialize(id);
+    // the unedited file is version 0
+    if (entry->history.empty()) entry->history.record(entry->file->getFrames(), entry->file->getRecipe());
+    entry->file->applyAll();
+    entry->history.record(entry->file->getFrames(), entry->file->getRecipe());
+    this->account(id);
+    this->log("apply " + std::to_string(id));
 }
 
-void Video::hue_adjustment() {
-    if (hue != 0)
-        try {
-            if (hue < 0 || hue > 180) throw hue;
-            try {
-                std::cout << "~ LOADING [          ]";
-                int fraction = floor(((double) sequence.size()) / 10);
-                int counter = 0;
-                // no parallelization here because it's a pretty fast adjustment
-                for (int i = 0; i < sequence.size(); i++) {
-                    if (i % fraction == 0 && i != 0 && counter <= 10) {
-                        counter++;
-                        system("CLS");
-                        std::cout << "~ LOADING [";
-                        for (int j = 1; j <= counter; j++) std::cout << (char) 219;
-                        for (int j = 10 - counter; j >= 1; j--) std::cout << " ";
-                        std::cout << "]";
-                    }
-                    // rtype == -1 means same type as source image
-                    // alpha = contrast, beta = brightness
-                    Mat hsv;
-                    // changing color space to HSV (HUE, SATURATION, VALUE)
-                    cv::cvtColor(sequence[i], hsv, cv::COLOR_BGR2HSV);
-                    for (int i = 0; i < hsv.rows; i++)
-                        for (int j = 0; j < hsv.cols; j++) {
-                            // to extract hue of the current pixel
-                            int h = hsv.at<cv::Vec3b>(i, j)[0];
-                            // adding value of this->hue to h
-                            h = (h + this->hue) % 180;
-                            // changing pixel hue
-                            hsv.at<cv::Vec3b>(i, j)[0] = h;
-                        }
-                    // converting back to original color space
-                    cv::cvtColor(hsv, sequence[i], cv::COLOR_HSV2BGR);
-                }
-                std::cout << "\n~ FINISHED\n";
-            }
-            catch (...) { cout << "~ APPLYING ADJUSTMENT FAILED\n"; }
-        }
-        catch (int h) { std::cout << "The hue value: " << h << " falls outside the valid range of [0,180]"; }
+template<class T>
+void Project<T>::resetFile(Id id) {
+    typename Catalog<T>::Entry *entry = files.find(id);
+    if (entry == NULL) return;
+    this->materialize(id);
+    if (entry->history.empty()) entry->history.record(entry->file->getFrames(), entry->file->getRecipe());
+    entry->file->scan();
+    // reset is a new version too, so it can be undone
+    entry->history.record(entry->file->getFrames(), entry->file->getRecipe());
+    this->account(id);
+    this->log("reset " + std::to_string(id));
 }
 
-void Video::setBlurAmount(int blurAmount) {
-    this->blurAmount = blurAmount;
+template<class T>
+bool Project<T>::undo(Id id) {
+    typename Catalog<T>::Entry *entry = files.find(id);
+    if (entry == NULL || !entry->history.canUndo()) return false;
+    entry->file->setFrames(entry->history.undo());
+    entry->file->setRecipe(entry->history.recipe());
+    this->account(id);
+    this->log("undo " + std::to_string(id));
+    return true;
 }
 
-void Video::setBlackWhite(bool blackWhite) {
-    this->blackWhite = blackWhite;
+template<class T>
+bool Project<T>::redo(Id id) {
+    typename Catalog<T>::Entry *entry = files.find(id);
+    if (entry == NULL || !entry->history.canRedo()) return false;
+    entry->file->setFrames(entry->history.redo());
+    entry->file->setRecipe(entry->history.recipe());
+    this->account(id);
+    this->log("redo " + std::to_string(id));
+    return true;
 }
 
-void Video::setCartoon(bool cartoon) {
-    this->cartoon = cartoon;
+template<class T>
+void Project<T>::log(const string &record) {
+    if (replaying || !journal.isOpen()) return;
+    journal.append(record);
+    if (journal.size() >= compactEvery) this->compact();
 }
 
-void Video::setBrightness(double brightness) {
-    this->brightness = brightness;
+template<class T>
+string Project<T>::savePixels(Id id, const string &stamp) {
+    const VersionHistory &history = files.find(id)->history;
+    // a history with only the unedited file has nothing the source doesn't have
+    if (history.size() < 2 && history.number() == 0) return "";
+    uint64_t fingerprint = history.fingerprint();
+    auto saved = savedPixels.find(id);
+    bool reuse = saved != savedPixels.end() && saved->second.first == fingerprint &&
+                 std::find(pixelFiles.begin(), pixelFiles.end(), saved->second.second) != pixelFiles.end();
+    string path = reuse ? saved->second.second :
+                  this->autosavePath("_" + std::to_string(id) + "_" + stamp + ".pixels");
+    std::ostringstream record;
+    record << "pixels " << id << " " << std::quoted(path) << " " << history.position() << " " << history.size();
+    size_t count = 0;
+    for (size_t v = 0; v < history.size(); v++) {
+        record << " " << history.frames(v) << " " << std::quoted(history.recipe(v));
+        count += history.frames(v);
+    }
+    if (reuse) return record.str();
+
+    std::vector<Mat> frames;
+    for (size_t v = 0; v < history.size(); v++) {
+        std::vector<Mat> version = history.version(v);
+        frames.insert(frames.end(), version.begin(), version.end());
+    }
+    if (count == 0 || !RawFile::write(path, frames, RawImage::LZ4)) {
+        cout << "~ AUTOSAVE COULDN'T KEEP THE EDITS OF " << files.get(id)->getName() << endl;
+        return "";
+    }
+    pixelFiles.push_back(path);
+    savedPixels[id] = std::make_pair(fingerprint, path);
+    return record.str();
 }
 
-void Video::setContrast(double contrast) {
-    this->contrast = contrast;
+template<class T>
+void Project<T>::removeStalePixels() {
+    // the last compaction is done, what its journal doesn't point at can go
+    journal.flush();
+    std::set<string> used;
+    for (const string &record: Journal::load(this->autosavePath(".journal"))) {
+        std::istringstream in(record);
+        string kind, path;
+        Id id;
+        if (in >> kind >> id >> std::quoted(path) && kind == "pixels") used.insert(path);
+    }
+    std::vector<string> kept;
+    for (const string &path: pixelFiles) {
+        std::error_code error;
+        if (used.count(path)) kept.push_back(path);
+        else std::filesystem::remove(path, error);
+    }
+    pixelFiles.swap(kept);
 }
 
-void Video::setHue(int hue) {
-    this->hue = hue;
+template<class T>
+void Project<T>::compact() {
+    std::ostringstream snapshot;
+    this->store(snapshot);
+    string data = snapshot.str();
+
+    // the base record ties the journal to this snapshot and maps the file order of the snapshot to ids
+    std::ostringstream base;
+    base << "base " << hashBytes((const uchar *) data.data(), data.size()) << " " << files.size();
+    for (Id id: files) base << " " << id;
+    // the snapshot only has the settings, the applied edits follow the base as pixels records
+    this->removeStalePixels();
+    string stamp = std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    for (Id id: files) {
+        string pixels = this->savePixels(id, stamp);
+        if (!pixels.empty()) base << "\n" << pixels;
+    }
+
+    journal.compact(this->autosavePath(".snapshot"), data, base.str());
 }
 
-void Video::applyAll() {
-    this->contrast_adjustment();
-    this->brightness_adjustment();
-    this->hue_adjustment();
+template<class T>
+void Project<T>::restartJournal() {
+    if (journal.open(this->autosavePath(".journal"))) this->compact();
+    else std::cout << "~ AUTOSAVE FAILED TO START\n";
+}
 
-    this->blur();
-    this->bw();
-    this->cartoon_effect();
+template<class T>
+bool Project<T>::hasAutosave() const {
+    // a journal with only its base record has nothing the snapshot doesn't have, pixels records
+    // of applied edits are something the project file doesn't have either
+    return Journal::load(this->autosavePath(".journal")).size() > 1;
 }
 
-class MyException:public std::exception {
-public:
-    virtual const char* what() const throw() {
-        return "~ FAILED TO IMPORT FILES\n";
+template<class T>
+bool Project<T>::replayAutosave() {
+    std::ifstream snapshot(this->autosavePath(".snapshot"), std::ios_base::binary);
+    if (!snapshot) return false;
+    std::stringstream content;
+    content << snapshot.rdbuf();
+    string data = content.str();
+
+    std::vector<string> records = Journal::load(this->autosavePath(".journal"));
+    std::istringstream header(records.empty() ? "" : records[0]);
+    string kind;
+    uint64_t hash = 0;
+    size_t count = 0;
+    header >> kind >> hash >> count;
+
+    this->untrackAll();
+    files.clear();
+    current = NULL;
+    currentId = Catalog<T>::none;
+    std::istringstream in(data);
+    std::vector<Id> loaded = this->load(in);
+
+    // a journal that doesn't belong to this snapshot was already folded into it
+    if (kind != "base" || hash != hashBytes((const uchar *) data.data(), data.size())) return true;
+
+    std::map<Id, Id> ids;
+    for (size_t i = 0; i < count && i < loaded.size(); i++) {
+        Id old;
+        header >> old;
+        ids[old] = loaded[i];
     }
-} importException;
+
+    replaying = true;
+    for (size_t i = 1; i < records.size(); i++) {
+        try {
+            this->replay(records[i], ids);
+        } catch (const MyException &e) {}
+    }
+    replaying = false;
+    return true;
+}
 
 template<class T>
-class Project {
-private:
-    string name;
-    T *current;
-    std::list<T*> files; // to store data for fast deletes and insertions
-    std::map<T*,int> versions; // contains version number of the file
-public:
-    Project() {
-        name = "new project";
-        versions[current] = 0;
-        current = NULL;
+void Project<T>::replay(const string &record, std::map<Id, Id> &ids) {
+    std::istringstream in(record);
+    string kind;
+    Id id;
+    in >> kind >> id;
+
+    if (kind == "add") {
+        ids[id] = this->addFile(this->readFile(in));
+        return;
     }
-    ~Project() {
-        if(!files.empty()) files.clear();
-        if(!versions.empty()) versions.clear();
-        if(versions.find(current) != versions.end()) versions.erase(current);
+    if (kind == "duplicate") {
+        Id source;
+        in >> source;
+        auto it = ids.find(source);
+        if (it != ids.end()) ids[id] = this->duplicateFile(it->second);
+        return;
     }
 
-    // doesnt work outside class
-    friend std::istream& operator>>(std::istream &in, Project<T>& obj) {
-        std::cout<<"Enter project name: \n";
-        in>>obj.name;
-
-        obj.menuEngine();
+    auto it = ids.find(id);
+    if (it == ids.end()) return;
+
+    if (kind == "delete") {
+        this->deleteFile(it->second);
+        ids.erase(it);
+    } else if (kind == "set") {
+        string option;
+        double value;
+        in >> option >> value;
+        this->setOption(it->second, option, value);
+    } else if (kind == "crop") {
+        cv::Rect crop;
+        in >> crop.x >> crop.y >> crop.width >> crop.height;
+        this->setCrop(it->second, crop);
+    } else if (kind == "region") {
+        string operation;
+        Region region;
+        in >> operation >> region.rect.x >> region.rect.y >> region.rect.width >> region.rect.height
+           >> std::quoted(region.mask);
+        this->setRegion(it->second, operation, region);
+    } else if (kind == "frames") {
+        string operation;
+        cv::Range frames;
+        in >> operation >> frames.start >> frames.end;
+        this->setFrameRange(it->second, operation, frames);
+    } else if (kind == "pixels") {
+        // the history the snapshot can't hold, versions oldest first
+        string path;
+        size_t position = 0, versions = 0;
+        in >> std::quoted(path) >> position >> versions;
+        pixelFiles.push_back(path);
+        RawFile raw;
+        typename Catalog<T>::Entry *entry = files.find(it->second);
+        if (!raw.open(path)) return;
+        std::vector<Mat> frames = raw.frames(true);
+        raw.close();
+        entry->history = VersionHistory();
+        size_t next = 0;
+        for (size_t v = 0; v < versions && in; v++) {
+            size_t count = 0;
+            string recipe;
+            in >> count >> std::quoted(recipe);
+            if (next + count > frames.size()) break;
+            entry->history.record(std::vector<Mat>(frames.begin() + next, frames.begin() + next + count), recipe);
+            next += count;
+        }
+        while (entry->history.position() > position && entry->history.canUndo()) entry->history.undo();
+        // a history read back whole is the one in the file, the next compaction doesn't write it again
+        if (entry->history.size() == versions)
+            savedPixels[it->second] = std::make_pair(entry->history.fingerprint(), path);
+        entry->file->setFrames(entry->history.restore());
+        entry->file->setRecipe(entry->history.recipe());
+        this->account(it->second);
+    } else if (kind == "apply") this->applyChanges(it->second);
+    else if (kind == "reset") this->resetFile(it->second);
+    else if (kind == "undo") this->undo(it->second);
+    else if (kind == "redo") this->redo(it->second);
+}
 
-        return in;
+template<class T>
+void Project<T>::startAutosave() {
+    journal.close();
+    if (this->hasAutosave()) {
+        std::cout << "Found autosaved changes of " << name << ", recover them (yes:1 no:0)?\n";
+        bool temp;
+        cin >> temp;
+        cin.get();
+        if (temp == true) {
+            if (this->replayAutosave()) std::cout << "~ RECOVERY SUCCESSFUL\n";
+            else std::cout << "~ RECOVERY FAILED\n";
+        }
     }
-    friend std::ostream& operator<<(std::ostream &out, const Project<T>& obj) {
-        std::cout<<"Project name: "<<obj.name<<"\n";
+    this->restartJournal();
+}
 
-        return out;
-    }
+template<class T>
+bool Project<T>::recover(const string &projectName) {
+    journal.close();
+    this->name = projectName;
+    if (!this->replayAutosave()) return false;
+    this->restartJournal();
+    return true;
+}
 
-    bool operator<(const Project<T>& obj) const{
-        return this->name < obj.name;
-    }
+template<class T>
+std::vector<typename Project<T>::Id> Project<T>::load(istream &in) {
+    std::vector<Id> ids;
+    int nrObj;
+    in>>nrObj;
+    in.get();
+    string nameFromFile;
+    in>>nameFromFile;
+    this->name = nameFromFile;
 
-    const string &getName() const {
-        return name;
+    for (int i = 0; i < nrObj; i++) {
+        ids.push_back(files.insert(this->readFile(in)));
+        this->track(ids.back());
     }
+    return ids;
+}
 
-    // template methods
-    void displayOptions();
-    void displayEngine();
-    void displayMenu();
-    void menuEngine();
-    void displayEdit();
-    void editEngine();
-    void effectsEngine();
-    void displayEffects();
-    void adjustmentsEngine();
-    void displayAdjusments();
-
-    void write(string);
-    void read(string);
-};
+template<class T>
+void Project<T>::store(ostream &out) const {
+    out << files.size() << endl << name;
+    for (Id id: files) {
+        out << "\n" << files.get(id)->getType() << " ";
+        files.get(id)->serialize(out);
+    }
+}
 
 template<class T>
 void Project<T>::displayEffects() {
-    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<versions[current]<<"\n";
+    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<this->currentVersion()<<"\n";
     for (int i = 0; i < 10; i++) cout << "-";
     cout << " CHOOSE EFFECT ";
     for (int i = 0; i < 10; i++) cout << "-";
@@ -1559,12 +7118,16 @@ void Project<T>::displayEffects() {
     cout << "1. Blur\n";
     cout << "2. Black and White\n";
     cout << "3. Cartoon\n";
+    cout << "4. Crop\n";
+    cout << "5. Output width\n";
+    cout << "6. Limit an effect to a region\n";
+    cout << "7. Limit an effect to frames of a video\n";
     cout << "0. Go back\n";
 }
 
 template<class T>
 void Project<T>::displayAdjusments() {
-    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<versions[current]<<"\n";
+    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<this->currentVersion()<<"\n";
     for (int i = 0; i < 10; i++) cout << "-";
     cout << " CHOOSE ADJUSTMENT ";
     for (int i = 0; i < 10; i++) cout << "-";
@@ -1573,6 +7136,8 @@ void Project<T>::displayAdjusments() {
     cout << "1. Brightness\n";
     cout << "2. Contrast\n";
     cout << "3. Hue\n";
+    cout << "4. Limit an adjustment to a region\n";
+    cout << "5. Limit an adjustment to frames of a video\n";
     cout << "0. Go back\n";;
 }
 
@@ -1598,7 +7163,7 @@ void Project<T>::effectsEngine() {
                     cout << "Enter blur amount: \n";
                     cin >> temp;
                     cin.get();
-                    current->setBlurAmount(temp);
+                    this->setOption(currentId, "blur", temp);
                     this->displayEffects();
                     break;
                 }
@@ -1608,7 +7173,7 @@ void Project<T>::effectsEngine() {
                     cout << "Do you want to apply Black and White effect to the image (yes:1 no:0)?\n";
                     cin >> temp;
                     cin.get();
-                    current->setBlackWhite(temp);
+                    this->setOption(currentId, "bw", temp);
                     this->displayEffects();
                     break;
                 }
@@ -1618,7 +7183,41 @@ void Project<T>::effectsEngine() {
                     cout << "Do you want to apply Cartoon effect to the image (yes:1 no:0)?\n";
                     cin >> temp;
                     cin.get();
-                    current->setCartoon(temp);
+                    this->setOption(currentId, "cartoon", temp);
+                    this->displayEffects();
+                    break;
+                }
+                case 4: {
+                    system("CLS");
+                    int x, y, width, height;
+                    cout << "Enter top left corner (x y), 0 0 = whole image: \n";
+                    cin >> x >> y;
+                    cout << "Enter width and height, 0 0 = no crop: \n";
+                    cin >> width >> height;
+                    cin.get();
+                    this->setCrop(currentId, cv::Rect(x, y, width, height));
+                    this->displayEffects();
+                    break;
+                }
+                case 5: {
+                    system("CLS");
+                    int temp;
+                    cout << "Enter output width in pixels, the height keeps the aspect ratio (0 = unchanged): \n";
+                    cin >> temp;
+                    cin.get();
+                    this->setOption(currentId, "width", temp);
+                    this->displayEffects();
+                    break;
+                }
+                case 6: {
+                    system("CLS");
+                    this->regionEngine({"blur", "bw", "cartoon"});
+                    this->displayEffects();
+                    break;
+                }
+                case 7: {
+                    system("CLS");
+                    this->framesEngine({"blur", "bw", "cartoon"});
                     this->displayEffects();
                     break;
                 }
@@ -1633,6 +7232,68 @@ void Project<T>::effectsEngine() {
     }
 }
 
+template<class T>
+void Project<T>::regionEngine(const std::vector<string> &operations) {
+    cout << "Choose operation (";
+    for (size_t i = 0; i < operations.size(); i++) cout << (i ? ", " : "") << operations[i];
+    cout << "): \n";
+    string operation;
+    cin >> operation;
+    if (std::find(operations.begin(), operations.end(), operation) == operations.end()) {
+        cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        cout << "~ INVALID OPERATION\n";
+        return;
+    }
+    Region region;
+    cout << "Enter top left corner (x y), 0 0 = whole image: \n";
+    cin >> region.rect.x >> region.rect.y;
+    cout << "Enter width and height, 0 0 = no rectangle: \n";
+    cin >> region.rect.width >> region.rect.height;
+    cin.get();
+    if (std::cin.fail()) {
+        std::cout << "~ INVALID INPUT\n";
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        return;
+    }
+    cout << "Enter path to a mask image, white where the operation applies (- for none): \n";
+    getline(cin, region.mask);
+    if (region.mask == "-") region.mask.clear();
+    // deleting "" from path
+    if (!region.mask.empty() && region.mask[0] == '"') region.mask.erase(0, 1), region.mask.pop_back();
+    this->setRegion(currentId, operation, region);
+    if (region.empty()) cout << "~ " << operation << " APPLIES TO THE WHOLE IMAGE\n";
+    else cout << "~ REGION WAS SET SUCCESSFULLY\n";
+}
+
+template<class T>
+void Project<T>::framesEngine(const std::vector<string> &operations) {
+    cout << "Choose operation (";
+    for (size_t i = 0; i < operations.size(); i++) cout << (i ? ", " : "") << operations[i];
+    cout << "): \n";
+    string operation;
+    cin >> operation;
+    if (std::find(operations.begin(), operations.end(), operation) == operations.end()) {
+        cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        cout << "~ INVALID OPERATION\n";
+        return;
+    }
+    int in, out;
+    cout << "Enter first and last frame (0 -1 = every frame): \n";
+    cin >> in >> out;
+    cin.get();
+    if (std::cin.fail()) {
+        std::cout << "~ INVALID INPUT\n";
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        return;
+    }
+    cv::Range frames(in, out + 1);
+    this->setFrameRange(currentId, operation, frames);
+    if (frames.start < 0 || frames.end <= frames.start) cout << "~ " << operation << " APPLIES TO EVERY FRAME\n";
+    else cout << "~ FRAMES WERE SET SUCCESSFULLY\n";
+}
+
 template<class T>
 void Project<T>::adjustmentsEngine() {
     system("CLS");
@@ -1655,7 +7316,7 @@ void Project<T>::adjustmentsEngine() {
                     cout << "Enter Brightness [-100,100]: \n";
                     cin >> temp;
                     cin.get();
-                    current->setBrightness(temp);
+                    this->setOption(currentId, "brightness", temp);
                     this->displayAdjusments();
                     break;
                 }
@@ -1666,7 +7327,7 @@ void Project<T>::adjustmentsEngine() {
                             << "Enter contrast [0,10]: \n\t1 = nothing changes\n\t[0,1) = lower contrast\n\t(1,10] = higher contrast\n";
                     cin >> temp;
                     cin.get();
-                    current->setContrast(temp);
+                    this->setOption(currentId, "contrast", temp);
                     this->displayAdjusments();
                     break;
                 }
@@ -1676,7 +7337,19 @@ void Project<T>::adjustmentsEngine() {
                     cout << "Enter hue [0,180]: \n";
                     cin >> temp;
                     cin.get();
-                    current->setHue(temp);
+                    this->setOption(currentId, "hue", temp);
+                    this->displayAdjusments();
+                    break;
+                }
+                case 4: {
+                    system("CLS");
+                    this->regionEngine({"brightness", "contrast", "hue"});
+                    this->displayAdjusments();
+                    break;
+                }
+                case 5: {
+                    system("CLS");
+                    this->framesEngine({"brightness", "contrast", "hue"});
                     this->displayAdjusments();
                     break;
                 }
@@ -1692,7 +7365,7 @@ void Project<T>::adjustmentsEngine() {
 
 template<class T>
 void Project<T>::displayEdit() {
-    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<versions[current]<<"\n";
+    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<this->currentVersion()<<"\n";
     for (int i = 0; i < 10; i++) cout << "-";
     cout << " CHOOSE OPTION ";
     for (int i = 0; i < 10; i++) cout << "-";
@@ -1702,6 +7375,9 @@ void Project<T>::displayEdit() {
     cout << "2. Adjustments\n";
     cout << "3. Apply all changes\n";
     cout << "4. Reset\n";
+    cout << "5. Undo\n";
+    cout << "6. Redo\n";
+    cout << "7. History memory cap\n";
     cout << "0. Go back\n";
 }
 
@@ -1735,20 +7411,46 @@ void Project<T>::editEngine() {
                 }
                 case 3: {
                     system("CLS");
-                    current->applyAll();
-                    versions[current]++;
+                    this->applyChanges(currentId);
                     cout << "~ CHANGES APPLIED SUCCESSFULLY\n";
                     this->displayEdit();
                     break;
                 }
                 case 4: {
                     system("CLS");
-                    current->scan();
-                    versions[current] = 0;
+                    this->resetFile(currentId);
                     cout << "~ IMAGE RESET SUCCESSFULLY\n";
                     this->displayEdit();
                     break;
                 }
+                case 5: {
+                    system("CLS");
+                    if (this->undo(currentId)) cout << "~ UNDO SUCCESSFUL\n";
+                    else cout << "~ NOTHING TO UNDO\n";
+                    this->displayEdit();
+                    break;
+                }
+                case 6: {
+                    system("CLS");
+                    if (this->redo(currentId)) cout << "~ REDO SUCCESSFUL\n";
+                    else cout << "~ NOTHING TO REDO\n";
+                    this->displayEdit();
+                    break;
+                }
+                case 7: {
+                    system("CLS");
+                    VersionHistory &history = files.find(currentId)->history;
+                    cout << "History uses " << history.memoryUsage() / (1024 * 1024) << " MB\n";
+                    cout << "Enter history memory cap in MB: \n";
+                    size_t temp;
+                    cin >> temp;
+                    cin.get();
+                    VersionHistory::defaultCap = temp * 1024 * 1024;
+                    history.setCap(VersionHistory::defaultCap);
+                    cout << "~ HISTORY MEMORY CAP SET\n";
+                    this->displayEdit();
+                    break;
+                }
                 case 0: {
                     system("CLS");
                     return;
@@ -1770,6 +7472,8 @@ void Project<T>::displayOptions() {
     cout << "1. Info\n";
     cout << "2. Show\n";
     cout << "3. Save\n";
+    cout << "4. Preview current settings\n";
+    cout << "5. Play from a time\n";
     cout << "0. Go back\n";
 }
 
@@ -1803,8 +7507,26 @@ void Project<T>::displayEngine() {
                 }
                 case 3: {
                     system("CLS");
+                    // images are written in the background, failures are reported when they happen
                     current->write();
-                    cout << "~ FILE WAS SAVED SUCCESSFULLY\n";
+                    cout << "~ SAVING FILE\n";
+                    this->displayOptions();
+                    break;
+                }
+                case 4: {
+                    system("CLS");
+                    // nothing changes, so the history and the journal don't hear about it
+                    current->preview();
+                    this->displayOptions();
+                    break;
+                }
+                case 5: {
+                    system("CLS");
+                    double seconds;
+                    cout << "Enter time in seconds: \n";
+                    cin >> seconds;
+                    cin.get();
+                    current->playFrom(seconds);
                     this->displayOptions();
                     break;
                 }
@@ -1821,11 +7543,15 @@ void Project<T>::displayEngine() {
 
 template<class T>
 void Project<T>::displayMenu() {
-    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<versions[current]<<"\n";
+    std::cout<<"\tProject: "<<name<<"\n\tVersion:"<<this->currentVersion()<<"\n";
     std::cout<<"1. Open\n";
     std::cout<<"2. Edit\n";
     std::cout<<"3. Delete\n";
     std::cout<<"4. Display\n";
+    std::cout<<"5. Export all\n";
+    std::cout<<"6. Export renditions\n";
+    std::cout<<"7. Duplicate\n";
+    std::cout<<"8. Export timeline\n";
     std::cout<<"0. Go Back\n";
 }
 
@@ -1852,28 +7578,13 @@ void Project<T>::menuEngine() {
                     cin >> temp;
                     cin.get();
                     if (temp == true) {
-                        T *tempOBJ = new T();
+                        auto tempOBJ = std::make_unique<T>();
                         cin >> *tempOBJ;
-                        files.push_back(tempOBJ);
-                        current = tempOBJ;
-                    } else if (files.size() > 0) {
-                        int index = 0;
-                        files.sort();
-                        for (auto it = files.begin(); it != files.end(); it++)
-                            std::cout << "\tFile: " << index++ << endl, std::cout << **it << endl;
-                        std::cout << "Choose file: \n";
-                        int fileNr;
-                        cin >> fileNr;
-                        cin.get();
-                        if (fileNr >= 0 && fileNr < files.size()) {
-                            for (auto it = files.begin(); it != files.end(); it++) {
-                                if (fileNr == 0) {
-                                    current = *it;
-                                    break;
-                                }
-                                fileNr--;
-                            }
-                        } else cout << "~ INVALID INDEX\n";
+                        // going back from the type menu, or a video file that didn't open, leaves nothing to add
+                        if (!tempOBJ->isGoBack()) this->select(this->addFile(std::move(tempOBJ)));
+                    } else if (!files.empty()) {
+                        Id id = this->chooseFile();
+                        if (id != Catalog<T>::none) this->select(id);
                     } else cout << "~ NO FILES\n";
                     this->displayMenu();
                     break;
@@ -1889,45 +7600,18 @@ void Project<T>::menuEngine() {
                 case 3: {
                     system("CLS");
                     try {
-                        if (files.size() > 0) {
+                        if (!files.empty()) {
                             if (current == NULL) throw string("~ NO FILE SELECTED\n");
-                            int index = 0;
-                            files.sort();
-                            for (auto it = files.begin(); it != files.end(); it++)
-                                std::cout << "\tFile: " << index++ << endl, std::cout << **it << endl;
-                            std::cout << "Choose file: \n";
-                            int fileNr;
-                            cin >> fileNr;
-                            cin.get();
-                            if (fileNr >= 0 && fileNr < files.size()) {
-                                for (auto it = files.begin(); it != files.end(); it++) {
-                                    if (fileNr == 0) {
-                                        current = *it;
-                                        break;
-                                    }
-                                    fileNr--;
-                                }
-                                files.remove(current);
+                            Id id = this->chooseFile();
+                            if (id != Catalog<T>::none) {
+                                this->deleteFile(id);
                                 cout << "~ FILE WAS DELETED SUCCESSFULLY\n";
-                            } else cout << "~ INVALID INDEX\n";
-
-                            index = 0;
-                            for (auto it = files.begin(); it != files.end(); it++)
-                                std::cout << "\tFile: " << index++ << endl, std::cout << **it << endl;
-
-                            std::cout << "Choose file: \n";
-                            cin >> fileNr;
-                            cin.get();
-
-                            if (fileNr >= 0 && fileNr < files.size()) {
-                                for (auto it = files.begin(); it != files.end(); it++) {
-                                    if (fileNr == 0) {
-                                        current = *it;
-                                        break;
-                                    }
-                                    fileNr--;
-                                }
-                            } else cout << "~ INVALID INDEX\n";
+                            }
+
+                            if (!files.empty()) {
+                                id = this->chooseFile();
+                                if (id != Catalog<T>::none) this->select(id);
+                            }
                         } else cout << "~ NO FILES\n";
                     } catch (const string &err) { std::cout << err; }
                     this->displayMenu();
@@ -1941,6 +7625,36 @@ void Project<T>::menuEngine() {
                     break;
 
                 }
+                case 5: {
+                    system("CLS");
+                    if (!files.empty()) this->exportAll();
+                    else cout << "~ NO FILES\n";
+                    this->displayMenu();
+                    break;
+                }
+                case 6: {
+                    system("CLS");
+                    if (current != NULL) this->exportRenditions();
+                    else cout << "~ NO FILE SELECTED\n";
+                    this->displayMenu();
+                    break;
+                }
+                case 7: {
+                    system("CLS");
+                    if (current != NULL) {
+                        this->select(this->duplicateFile(currentId));
+                        cout << "~ FILE WAS DUPLICATED SUCCESSFULLY\n";
+                    } else cout << "~ NO FILE SELECTED\n";
+                    this->displayMenu();
+                    break;
+                }
+                case 8: {
+                    system("CLS");
+                    if (!files.empty()) this->exportTimeline();
+                    else cout << "~ NO FILES\n";
+                    this->displayMenu();
+                    break;
+                }
                 case 0: {
                     system("CLS");
                     return;
@@ -1958,78 +7672,52 @@ void Project<T>::write(string output) {
     std::ofstream out(output);
 
     if(!files.empty()) {
-        out << files.size() << endl << name;
-        out.close();
-        for (auto it = files.begin(); it != files.end(); it++) {
-            out.open(output, std::ios_base::app);
-            out << "\n" << (*it)->getType() << " ";
-            out.close();
-            (*it)->serialize(output);
-        }
-
+        this->store(out);
         std::cout << "~ EXPORT SUCCESSFUL\n";
     }
     else std::cout<<"~ NO FILES TO EXPORT\n";
 }
 
-template<>
-void Project<Photoshop>::read(string input) {
+template<class T>
+void Project<T>::read(string input) {
     input = "../" + input;
     std::ifstream in(input);
 
-    int nrObj;
-    in>>nrObj;
-    in.get();
-    string nameFromFile;
-    in>>nameFromFile;
-    this->name = nameFromFile;
+    this->load(in);
+    std::cout << "~ IMPORT SUCCESSFUL\n";
+}
 
-    for (int i = 0; i < nrObj; i++) {
-        string cls, name, temp;
-        in >> cls >> name;
+template<>
+std::unique_ptr<Photoshop> Project<Photoshop>::readFile(istream &in) {
+    string cls, name, temp;
+    in >> cls >> name;
 
-        temp = cls + " " + name;
+    temp = cls + " " + name;
 
-        if (temp == "class Video") throw importException;
+    if (temp == "class Video") throw importException;
 
-        Photoshop *p = new Photoshop();
-        if (temp == "class Effect") p->getImageByReference() = new Effect();
-        if (temp == "class Adjustment") p->getImageByReference() = new Adjustment();
-        if (temp == "class Edited") p->getImageByReference() = new Edited();
+    auto p = std::make_unique<Photoshop>();
+    if (temp == "class Effect") p->setImage(std::make_unique<Effect>());
+    if (temp == "class Adjustment") p->setImage(std::make_unique<Adjustment>());
+    if (temp == "class Edited") p->setImage(std::make_unique<Edited>());
 
-        p->deserialize(in);
-        files.push_back(p);
-    }
-    std::cout << "~ IMPORT SUCCESSFUL\n";
+    p->deserialize(in);
+    return p;
 }
 
 template<>
-void Project<Video>::read(string input) {
-    input = "../" + input;
-    std::ifstream in(input);
-
-    int nrObj;
-    in>>nrObj;
-    in.get();
-
-    string nameFromFile;
-    in>>nameFromFile;
-    this->name = nameFromFile;
+std::unique_ptr<Video> Project<Video>::readFile(istream &in) {
+    string cls,name,temp;
+    in>>cls>>name;
 
-    for(int i=0;i<nrObj;i++) {
-        string cls,name,temp;
-        in>>cls>>name;
+    temp = cls + " " + name;
 
-        temp = cls + " " + name;
+    if(temp == "class Effect" || temp == "class Adjustment" || temp == "class Edited")
+        throw importException;
 
-        if(temp == "class Effect" || temp == "class Adjustment" || temp == "class Edited")
-            throw importException;
-
-        Video* v = new Video();
-        v->deserialize(in);
-        files.push_back(v);
-    }
-    std::cout<<"~ IMPORT SUCCESSFUL\n";
+    auto v = std::make_unique<Video>();
+    v->deserialize(in);
+    return v;
 }
 
 template<class T>
@@ -2045,7 +7733,7 @@ private:
    Menu(const Menu&) = delete;
    // 0 for images 1 for videos
    bool projectType, isSaved;
-   std::set<T*> proj;
+   std::vector<std::unique_ptr<T>> proj;
    T* currentProj;
 public:
     static Menu* getInstance() {
@@ -2078,6 +7766,7 @@ void Menu<T>::displayProject() {
     cout << "1. Create new project\n";
     cout << "2. Open project\n";
     cout << "3. Save project\n";
+    cout << "4. Recover project\n";
     cout << "0. Go back\n";
 }
 
@@ -2099,10 +7788,9 @@ void Menu<T>::projectEngine() {
             switch (option) {
                 case 1: {
                     system("CLS");
-                    T *temp = new T();
-                    cin >> *temp;
-                    proj.insert(temp);
-                    currentProj = temp;
+                    proj.push_back(std::make_unique<T>());
+                    cin >> *proj.back();
+                    currentProj = proj.back().get();
                     this->displayProject();
                     break;
                 }
@@ -2112,11 +7800,14 @@ void Menu<T>::projectEngine() {
                     std::cout << "Enter file name: \n";
                     getline(std::cin, temp);
 
-                    if (currentProj == NULL) currentProj = new T();
+                    if (currentProj == NULL) {
+                        proj.push_back(std::make_unique<T>());
+                        currentProj = proj.back().get();
+                    }
                     // tratare my exception
                     try {
                         currentProj->read(temp);
-                        proj.insert(currentProj);
+                        currentProj->startAutosave();
                         currentProj->menuEngine();
                     } catch (const MyException& e) {std::cout<<e.what();}
                     this->displayProject();
@@ -2136,6 +7827,23 @@ void Menu<T>::projectEngine() {
                     this->displayProject();
                     break;
                 }
+                case 4: {
+                    system("CLS");
+                    string temp;
+                    std::cout << "Enter project name: \n";
+                    getline(std::cin, temp);
+
+                    auto recovered = std::make_unique<T>();
+                    try {
+                        if (recovered->recover(temp)) {
+                            currentProj = recovered.get();
+                            proj.push_back(std::move(recovered));
+                            currentProj->menuEngine();
+                        } else std::cout << "~ NO AUTOSAVE FOUND\n";
+                    } catch (const MyException& e) {std::cout<<e.what();}
+                    this->displayProject();
+                    break;
+                }
                 case 0: {
                     system("CLS");
                     if (isSaved == 0) {
@@ -2160,6 +7868,225 @@ void Menu<T>::projectEngine() {
     }
 }
 
+// options given on the command line
+struct Options {
+    bool memoryReport; // print memory usage when the program exits
+    bool benchmarkLayouts; // time the working layouts and exit
+    Options() : memoryReport(false), benchmarkLayouts(false) {}
+} options;
+
+// arguments look like --name or --name=value
+void parseArguments(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t equal = arg.find('=');
+        string key = arg.substr(0, equal);
+        string value = equal == string::npos ? "" : arg.substr(equal + 1);
+
+        try {
+            if (key == "--memory-budget") MemoryGovernor::getInstance()->setBudget(std::stoull(value) * 1024 * 1024);
+            else if (key == "--memory-report") options.memoryReport = true;
+            else if (key == "--isa") {
+                // caps the instruction set used by the kernels, for comparing code paths
+                int found = -1;
+                for (int isa = kernels::SCALAR; isa <= kernels::AVX512; isa++)
+                    if (value == kernels::isaNames[isa]) found = isa;
+                if (found == -1) throw value;
+                kernels::limit = (kernels::Isa) found;
+            }
+            else if (key == "--explain-plan") Planner::explain = true;
+            else if (key == "--layout") {
+                int found = -1;
+                for (int layout = kernels::PACKED; layout <= kernels::PLANAR; layout++)
+                    if (value == kernels::layoutNames[layout]) found = layout;
+                if (found == -1) throw value;
+                Planner::layout = (kernels::Layout) found;
+            }
+            else if (key == "--benchmark-layouts") options.benchmarkLayouts = true;
+            else if (key == "--encoder-threads") EncoderPool::threads = std::stoul(value);
+            else if (key == "--png-level") {
+                encoderSettings.pngLevel = std::stoi(value);
+                if (encoderSettings.pngLevel < 0 || encoderSettings.pngLevel > 9) throw value;
+            }
+            else if (key == "--png-strategy") {
+                const char *strategies[] = {"default", "filtered", "huffman", "rle", "fixed"};
+                int found = -1;
+                for (int i = 0; i < 5; i++) if (value == strategies[i]) found = i;
+                if (found == -1) throw value;
+                // the cv::IMWRITE_PNG_STRATEGY_* values are the zlib ones, in this order
+                encoderSettings.pngStrategy = found;
+            }
+            else if (key == "--jpeg-quality") {
+                encoderSettings.jpegQuality = std::stoi(value);
+                if (encoderSettings.jpegQuality < 0 || encoderSettings.jpegQuality > 100) throw value;
+            }
+            else if (key == "--jpeg-progressive") encoderSettings.jpegProgressive = true;
+            else if (key == "--webp-quality") {
+                encoderSettings.webpQuality = std::stoi(value);
+                if (encoderSettings.webpQuality < 1) throw value;
+            }
+            else if (key == "--yuv") Video::yuvCapture = true;
+            else if (key == "--dedup") Video::dedupTolerance = value.empty() ? 0 : std::stoi(value);
+            else if (key == "--no-dedup") Video::dedupTolerance = -1;
+            else if (key == "--live") Video::liveBudget = std::stod(value);
+            else if (key == "--timeline-threads") Video::timelineThreads = std::stoul(value);
+            else if (key == "--no-thumbnails") ThumbnailService::enabled = false;
+            else if (key == "--out-of-core") TiledImage::threshold = std::stoull(value) * 1024 * 1024;
+            else if (key == "--tile-cache") TiledImage::cacheBytes = std::stoull(value) * 1024 * 1024;
+            else if (key == "--pixel-pool") PixelPool::limit = std::stoull(value) * 1024 * 1024;
+            else if (key == "--huge-pages") PixelPool::hugePages = true;
+            else if (key == "--render-cache-size")
+                RenderCache::getInstance()->setCapacity(std::stoull(value) * 1024 * 1024);
+            else cout << "~ UNKNOWN ARGUMENT " << arg << endl;
+        } catch (...) { cout << "~ INVALID VALUE FOR " << key << endl; }
+    }
+}
+
+// runs a few pipelines on a synthetic full hd frame in every working layout, so it shows how many ops it
+// takes before converting in and out pays for itself on this machine
+void benchmarkLayouts() {
+    Mat frame(1080, 1920, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(256));
+    std::vector<std::vector<Op>> pipelines = {
+            {Op::linear(1.2, 10, "contrast 1.2 brightness 10")},
+            {Op::linear(1.2, 10, "contrast 1.2 brightness 10"), Op::blur(7)},
+            {Op::linear(1.2, 10, "contrast 1.2 brightness 10"), Op::hueShift(30), Op::blur(7)},
+    };
+    const int repeats = 20;
+    typedef std::chrono::steady_clock Clock;
+    auto perFrame = [&](const std::function<void()> &body) {
+        body(); // warms up the caches and the pixel pool
+        auto start = Clock::now();
+        for (int i = 0; i < repeats; i++) body();
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / repeats;
+    };
+
+    cout << "~ LAYOUT BENCHMARK (" << frame.cols << "x" << frame.rows << ", " << repeats << " runs, "
+         << kernels::isaNames[kernels::isa()] << ")\n";
+    for (const auto &ops: pipelines) {
+        cout << "Pipeline:";
+        for (const Op &op: ops) cout << " [" << op.label << "]";
+        cout << endl;
+        Mat reference;
+        double packed = 0;
+        for (int layout = kernels::PACKED; layout <= kernels::PLANAR; layout++) {
+            Plan plan = Planner::plan(ops, frame.size());
+            plan.setLayout((kernels::Layout) layout);
+            Mat result;
+            double total = perFrame([&] {
+                result = frame.clone();
+                plan.run(result);
+            });
+            Mat work, back;
+            double conversion = layout == kernels::PACKED ? 0 : perFrame([&] {
+                kernels::ingest(frame, work, (kernels::Layout) layout);
+                kernels::egress(work, back, (kernels::Layout) layout);
+            });
+            if (layout == kernels::PACKED) reference = result, packed = total;
+            bool same = reference.size() == result.size() && reference.type() == result.type() &&
+                        cv::norm(reference, result, cv::NORM_INF) == 0;
+            cout << std::fixed << std::setprecision(2) << "\t" << kernels::layoutNames[layout] << ": " << total
+                 << " ms per frame";
+            if (layout != kernels::PACKED)
+                cout << " (conversion " << conversion << " ms), " << packed / total << "x packed"
+                     << (same ? ", same pixels" : ", PIXELS DIFFER");
+            cout << endl;
+        }
+    }
+    cout.unsetf(std::ios::fixed);
+    cout << std::setprecision(6);
+}
+
+void memoryEngine() {
+    MemoryGovernor *governor = MemoryGovernor::getInstance();
+    governor->report(cout);
+    PixelPool::getInstance()->report(cout);
+    cout << "Change memory budget (yes:1 no:0)?\n";
+    bool temp;
+    cin >> temp;
+    cin.get();
+    if (temp == true) {
+        size_t budget;
+        cout << "Enter memory budget in MB: \n";
+        cin >> budget;
+        cin.get();
+        governor->setBudget(budget * 1024 * 1024);
+        cout << "~ MEMORY BUDGET SET\n";
+    }
+}
+
+// pages through the images of a folder as contact sheets; the whole folder is queued on the thumbnail
+// service right away, the page on screen goes first
+void browseEngine() {
+    string folder;
+    cout << "Enter folder: \n";
+    getline(cin, folder);
+
+    std::vector<string> paths;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator(folder, error)) {
+        if (!entry.is_regular_file()) continue;
+        string extension = entry.path().extension().string();
+        for (char &c: extension) c = (char) std::tolower((unsigned char) c);
+        if (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp" ||
+            extension == ".webp" || extension == ".tif" || extension == ".tiff")
+            paths.push_back(entry.path().string());
+    }
+    if (error || paths.empty()) {
+        cout << "~ NO IMAGES FOUND\n";
+        return;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    ThumbnailService *service = ThumbnailService::getInstance();
+    service->prefetch(paths);
+    const size_t pageSize = 20;
+    size_t page = 0, pages = (paths.size() + pageSize - 1) / pageSize;
+    while (true) {
+        size_t first = page * pageSize, last = std::min(paths.size(), first + pageSize);
+        cout << "\tPage " << page + 1 << "/" << pages << " (" << paths.size() << " images)\n";
+        for (size_t i = first; i < last; i++)
+            cout << "\t" << i << ". " << std::filesystem::path(paths[i]).filename().string() << endl;
+        if (ThumbnailService::enabled) {
+            std::vector<std::shared_future<Mat>> previews;
+            for (size_t i = first; i < last; i++) previews.push_back(service->request(paths[i]));
+            std::vector<Mat> thumbnails;
+            for (auto &preview: previews) thumbnails.push_back(preview.get());
+            cv::imshow("Browse", ThumbnailService::contactSheet(thumbnails, first));
+            cv::waitKey(1);
+        }
+
+        cout << "Choose image to preview (-1: next page, -2: previous page, -4: back): \n";
+        long long option;
+        cin >> option;
+        if (cin.fail()) {
+            cout << "~ INVALID INPUT\n";
+            cin.clear();
+            cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            continue;
+        }
+        cin.get();
+
+        if (option == -1) {
+            if (page + 1 < pages) page++;
+        } else if (option == -2) {
+            if (page > 0) page--;
+        } else if (option == -4) {
+            cv::destroyAllWindows();
+            return;
+        } else if (option >= (long long) first && option < (long long) last) {
+            // decoded just large enough for the screen
+            Mat preview = ThumbnailService::decodeReduced(paths[option], 1080);
+            if (preview.empty()) cout << "~ COULDN'T DECODE " << paths[option] << endl;
+            else {
+                cv::imshow(std::filesystem::path(paths[option]).filename().string(), preview);
+                cv::waitKey(0);
+                cv::destroyWindow(std::filesystem::path(paths[option]).filename().string());
+            }
+        } else cout << "~ INVALID INDEX\n";
+    }
+}
+
 void displayMainMenu() {
     for (int i = 0; i < 10; i++) cout << "-";
     cout << " EDITING SOFTARE ";
@@ -2168,11 +8095,19 @@ void displayMainMenu() {
 
     cout << "1. Edit images\n";
     cout << "2. Edit videos\n";
+    cout << "3. Memory usage\n";
+    cout << "4. Browse folder\n";
     cout << "0. Exit\n";
 }
 
-int main() {
+int main(int argc, char **argv) {
     initOpenCV();
+    parseArguments(argc, argv);
+    PixelPool::install();
+    if (options.benchmarkLayouts) {
+        benchmarkLayouts();
+        return 0;
+    }
 
     system("CLS");
     displayMainMenu();
@@ -2202,7 +8137,26 @@ int main() {
                     displayMainMenu();
                     break;
                 }
+                case 3: {
+                    system("CLS");
+                    memoryEngine();
+                    displayMainMenu();
+                    break;
+                }
+                case 4: {
+                    system("CLS");
+                    browseEngine();
+                    displayMainMenu();
+                    break;
+                }
                 case 0: {
+                    // queued writes would be lost on exit
+                    if (EncoderPool::getInstance()->pending() > 0) cout << "~ FINISHING WRITES\n";
+                    EncoderPool::getInstance()->wait();
+                    if (options.memoryReport) {
+                        MemoryGovernor::getInstance()->report(cout);
+                        PixelPool::getInstance()->report(cout);
+                    }
                     return 0;
                 }
                 default: